@@ -6,11 +6,76 @@
 
 #define PRIO_Q_SERIAL                             0
 #define PRIO_Q_BT                                 1
-#define PRIO_Q_OTHERS                             2
-#define MAX_PRIORITY_QUEUES                       3
+#define PRIO_Q_DATA_HI                            2
+#define PRIO_Q_OTHERS                             3
+#define MAX_PRIORITY_QUEUES                       4
 
 /* ESP Payload Header Flags */
 #define MORE_FRAGMENT                             (1 << 0)
+#define AGGREGATED_FRAME                          (1 << 1)
+/* SPI: transactions following this one use variable length mode */
+#define SPI_VAR_LEN_SWITCH                        (1 << 2)
+/* Checksum field carries folded CRC-32 instead of byte sum */
+#define FRAME_CRC32                               (1 << 3)
+/* Latency sensitive Wi-Fi data, queued in PRIO_Q_DATA_HI on both sides */
+#define FRAME_PRIO_HIGH                           (1 << 4)
+
+/* Priority queue of frame, as per its interface header */
+#define ESP_PRIO_Q(if_type, flags)                (((if_type) == ESP_SERIAL_IF) ? PRIO_Q_SERIAL : \
+                                                   ((if_type) == ESP_HCI_IF) ? PRIO_Q_BT : \
+                                                   ((flags) & FRAME_PRIO_HIGH) ? PRIO_Q_DATA_HI : \
+                                                   PRIO_Q_OTHERS)
+
+/* Wi-Fi data with DSCP of CS5 and above (signalling, EF voice, network
+ * control) is sent as FRAME_PRIO_HIGH. DSCP is read from IPv4 TOS or IPv6
+ * traffic class, i.e. first two bytes following ethernet header. */
+#define ESP_DSCP_PRIO_HIGH_MIN                    40
+#define ESP_IPV4_DSCP(ip)                         ((ip)[1] >> 2)
+#define ESP_IPV6_DSCP(ip)                         ((((ip)[0] & 0x0F) << 2) | ((ip)[1] >> 6))
+
+/* Aggregated frame:
+ * Header with AGGREGATED_FRAME flag set is followed by 'len' bytes,
+ * carrying complete sub-frames (each with its own esp_payload_header).
+ * Every sub-frame starts at 4 byte aligned position within this payload.
+ * Header of aggregated frame itself is not checksummed, sub-frames are. */
+#define AGGR_FRAME_ALIGNMENT                      4
+#define AGGR_FRAME_ALIGN(x)                       (((x) + AGGR_FRAME_ALIGNMENT - 1) & \
+                                                   ~(AGGR_FRAME_ALIGNMENT - 1))
+
+/* Variable length SPI transactions:
+ * Every transaction is preceded by fixed size header phase, where both
+ * sides announce length of frame they have to send (0 if none).
+ * Payload phase then clocks max of both lengths, rounded up to 4 bytes. */
+/* Magic decodes to invalid if_type, in case peer takes it for payload header */
+#define SPI_VAR_LEN_HDR_MAGIC                     0xEF
+#define SPI_VAR_LEN_ALIGN(x)                      (((x) + 3) & ~3)
+
+struct esp_spi_var_len_hdr {
+	uint8_t          magic;
+	uint8_t          reserved1;
+	uint16_t         len;
+	uint32_t         reserved2;
+} __attribute__((packed));
+
+/* Credit based flow control:
+ * ESP reports consumed rx frames of one of its rx queues (credit pools)
+ * in 'credits' field of frame header, pools in turn:
+ *   bit 7-5: pool index + 1 (0: no report)
+ *   bit 4-0: frames consumed from that pool so far, modulo 32
+ * Pool sizes (initial credits, < 32 each) are sent in ESP_PRIV_RX_QUEUE_SIZE
+ * tag of INIT event. With single pool, all priorities share it.
+ * 'credits' field is set after checksum calculation, receiver clears it
+ * before checksum validation. */
+#define ESP_CREDIT_POOL_SHIFT                     5
+#define ESP_CREDIT_COUNT_MASK                     0x1F
+#define ESP_CREDIT_ENCODE(pool, cnt)              ((((pool) + 1) << ESP_CREDIT_POOL_SHIFT) | \
+                                                   ((cnt) & ESP_CREDIT_COUNT_MASK))
+
+/* CRC frame checksum:
+ * With ESP_TRANSPORT_CRC32 negotiated, sender sets FRAME_CRC32 flag and
+ * fills checksum field with CRC-32 (IEEE 802.3, as zlib crc32()) of the
+ * frame, folded to 16 bits. Receiver picks algorithm as per the flag. */
+#define ESP_CRC32_FOLD(crc)                       ((uint16_t)(((crc) >> 16) ^ ((crc) & 0xFFFF)))
 
 /* Serial interface */
 #define SERIAL_IF_FILE                            "/dev/esps0"
@@ -28,7 +93,7 @@ struct esp_payload_header {
 	uint16_t         offset;
 	uint16_t         checksum;
 	uint16_t		 seq_num;
-	uint8_t          reserved2;
+	uint8_t          credits;		/* Credit report, ESP to host only */
 	/* Position of union field has to always be last,
 	 * this is required for hci_pkt_type */
 	union {
@@ -68,17 +133,68 @@ typedef enum {
 	ESP_CHECKSUM_ENABLED = (1 << 7),
 } ESP_CAPABILITIES;
 
+/* Extended capabilities, exchanged as 32 bit (little endian) value
+ * in ESP_PRIV_CAPABILITY_EXT tag.
+ * ESP advertises these in INIT event. Host replies with the subset
+ * it has enabled in ESP_PRIV_EVENT_HOST_INIT event */
+typedef enum {
+	ESP_TRANSPORT_AGGREGATION = (1 << 0),
+	ESP_TRANSPORT_SPI_VAR_LEN = (1 << 1),
+	ESP_TRANSPORT_CREDITS = (1 << 2),
+	ESP_TRANSPORT_CRC32 = (1 << 3),
+	ESP_TRANSPORT_SDIO_BATCH = (1 << 4),
+} ESP_EXT_CAPABILITIES;
+
 typedef enum {
 	ESP_TEST_RAW_TP = (1 << 0),
 	ESP_TEST_RAW_TP__ESP_TO_HOST = (1 << 1)
 } ESP_RAW_TP_MEASUREMENT;
 
+/* Raw throughput benchmark, driven by host:
+ * Payload of ESP_TEST_IF frame starts with esp_test_hdr, followed by
+ * filler up to frame length. Host sends START, then DATA and/or PING
+ * till test duration ends, then STOP. ESP streams DATA to host if asked
+ * in START, echoes each PING as PONG and answers STOP with REPORT of its
+ * own counters. Frames without magic are from legacy TEST_RAW_TP build.
+ * Multi byte fields are little endian */
+#define ESP_TEST_MAGIC                            0xE5B7
+#define ESP_TEST_FRAME_LEN_MAX                    1500
+
+typedef enum {
+	ESP_TEST_CMD_DATA,
+	ESP_TEST_CMD_START,
+	ESP_TEST_CMD_STOP,
+	ESP_TEST_CMD_REPORT,
+	ESP_TEST_CMD_PING,
+	ESP_TEST_CMD_PONG,
+} ESP_TEST_CMD;
+
+typedef enum {
+	ESP_TEST_START_ESP_TO_HOST = (1 << 0),
+} ESP_TEST_START_FLAGS;
+
+struct esp_test_hdr {
+	uint16_t         magic;
+	uint8_t          cmd;
+	uint8_t          flags;
+	uint16_t         frame_len;	/* START: length of DATA frames from ESP */
+	uint16_t         reserved;
+	uint32_t         seq;
+	uint32_t         duration_ms;	/* START: ESP stops streaming after it */
+	uint64_t         timestamp;	/* PING: host time, returned as is in PONG */
+	uint64_t         tx_frames;	/* REPORT: ESP counters since START */
+	uint64_t         tx_bytes;
+	uint64_t         rx_frames;
+	uint64_t         rx_bytes;
+} __attribute__((packed));
+
 typedef enum {
 	ESP_PACKET_TYPE_EVENT,
 } ESP_PRIV_PACKET_TYPE;
 
 typedef enum {
 	ESP_PRIV_EVENT_INIT,
+	ESP_PRIV_EVENT_HOST_INIT,
 } ESP_PRIV_EVENT_TYPE;
 
 typedef enum {
@@ -87,6 +203,8 @@ typedef enum {
 	ESP_PRIV_FIRMWARE_CHIP_ID,
 	ESP_PRIV_TEST_RAW_TP,
 	ESP_PRIV_FW_DATA,
+	ESP_PRIV_CAPABILITY_EXT,
+	ESP_PRIV_RX_QUEUE_SIZE,
 } ESP_PRIV_TAG_TYPE;
 
 struct esp_priv_event {
@@ -40,6 +40,7 @@
 #endif
 #endif
 #include "endian.h"
+#include "esp_rom_crc.h"
 
 #include <protocomm.h>
 #include "protocomm_pserial.h"
@@ -78,6 +79,10 @@ static const char TAG_TX_S[] = "CONTROL S -> H";
 #endif
 
 #define ETH_DATA_LEN                     1500
+#define ETH_HDR_LEN                      14
+#define ETH_TYPE_IPV4                    0x0800
+#define ETH_TYPE_IPV6                    0x86DD
+#define WLAN_TX_MAX_RETRY                3
 
 volatile uint8_t datapath = 0;
 volatile uint8_t station_connected = 0;
@@ -148,6 +153,61 @@ static uint8_t get_capabilities()
 	return cap;
 }
 
+static uint32_t get_ext_capabilities(void)
+{
+	uint32_t ext_cap = 0;
+
+#if CONFIG_ESP_TRANSPORT_AGGREGATION
+	ESP_LOGI(TAG, "- Transport aggregation");
+	ext_cap |= ESP_TRANSPORT_AGGREGATION;
+#endif
+
+#if CONFIG_ESP_SPI_HOST_INTERFACE && CONFIG_ESP_SPI_VAR_LEN
+	ESP_LOGI(TAG, "- Variable length SPI transactions");
+	ext_cap |= ESP_TRANSPORT_SPI_VAR_LEN;
+#endif
+
+#if CONFIG_ESP_SPI_HOST_INTERFACE && CONFIG_ESP_SPI_CREDITS
+	ESP_LOGI(TAG, "- Credit based flow control");
+	ext_cap |= ESP_TRANSPORT_CREDITS;
+#endif
+
+#if CONFIG_ESP_SDIO_HOST_INTERFACE && CONFIG_ESP_SDIO_BATCH
+	ESP_LOGI(TAG, "- SDIO batched transfers");
+	ext_cap |= ESP_TRANSPORT_SDIO_BATCH;
+#endif
+
+#if CONFIG_ESP_CRC_CHECKSUM
+	ESP_LOGI(TAG, "- CRC frame checksum");
+	ext_cap |= ESP_TRANSPORT_CRC32;
+#endif
+
+	return ext_cap;
+}
+
+/* Checksum of frame (header included), as per its FRAME_CRC32 flag */
+uint16_t compute_frame_checksum(uint8_t *frame, uint16_t len)
+{
+	struct esp_payload_header *header = (struct esp_payload_header *) frame;
+
+	if (header->flags & FRAME_CRC32)
+		return ESP_CRC32_FOLD(esp_rom_crc32_le(0, frame, len));
+
+	return compute_checksum(frame, len);
+}
+
+void set_frame_checksum(uint8_t *frame, uint16_t len)
+{
+	struct esp_payload_header *header = (struct esp_payload_header *) frame;
+
+	header->checksum = 0;
+
+	if (if_context && (if_context->ext_capabilities & ESP_TRANSPORT_CRC32))
+		header->flags |= FRAME_CRC32;
+
+	header->checksum = htole16(compute_frame_checksum(frame, len));
+}
+
 static void esp_wifi_set_debug_log()
 {
 	/* set WiFi log level and module */
@@ -210,8 +270,29 @@ void esp_update_ap_mac(void)
 	}
 }
 
+/* PRIO_Q_DATA_HI for IP traffic with DSCP of voice or network control */
+static uint8_t wlan_rx_prio_q(uint8_t *frame, uint16_t len)
+{
+	uint16_t eth_type = 0;
+	uint8_t *ip = frame + ETH_HDR_LEN;
+	uint8_t dscp = 0;
+
+	if (len < ETH_HDR_LEN + 2)
+		return PRIO_Q_OTHERS;
+
+	eth_type = (frame[ETH_HDR_LEN - 2] << 8) | frame[ETH_HDR_LEN - 1];
+
+	if (eth_type == ETH_TYPE_IPV4)
+		dscp = ESP_IPV4_DSCP(ip);
+	else if (eth_type == ETH_TYPE_IPV6)
+		dscp = ESP_IPV6_DSCP(ip);
+
+	return (dscp >= ESP_DSCP_PRIO_HIGH_MIN) ? PRIO_Q_DATA_HI : PRIO_Q_OTHERS;
+}
+
 esp_err_t wlan_ap_rx_callback(void *buffer, uint16_t len, void *eb)
 {
+	uint8_t prio_q_idx = PRIO_Q_OTHERS;
 	interface_buffer_handle_t buf_handle = {0};
 
 	if (!buffer || !eb || !datapath || ota_ongoing) {
@@ -228,7 +309,11 @@ esp_err_t wlan_ap_rx_callback(void *buffer, uint16_t len, void *eb)
 	buf_handle.wlan_buf_handle = eb;
 	buf_handle.free_buf_handle = esp_wifi_internal_free_rx_buffer;
 
-	if (send_to_host_queue(&buf_handle, PRIO_Q_OTHERS))
+	prio_q_idx = wlan_rx_prio_q(buffer, len);
+	if (prio_q_idx == PRIO_Q_DATA_HI)
+		buf_handle.flag = FRAME_PRIO_HIGH;
+
+	if (send_to_host_queue(&buf_handle, prio_q_idx))
 		goto DONE;
 
 	return ESP_OK;
@@ -240,6 +325,7 @@ DONE:
 
 esp_err_t wlan_sta_rx_callback(void *buffer, uint16_t len, void *eb)
 {
+	uint8_t prio_q_idx = PRIO_Q_OTHERS;
 	interface_buffer_handle_t buf_handle = {0};
 
 	if (!buffer || !eb || !datapath || ota_ongoing) {
@@ -256,7 +342,11 @@ esp_err_t wlan_sta_rx_callback(void *buffer, uint16_t len, void *eb)
 	buf_handle.wlan_buf_handle = eb;
 	buf_handle.free_buf_handle = esp_wifi_internal_free_rx_buffer;
 
-	if (send_to_host_queue(&buf_handle, PRIO_Q_OTHERS))
+	prio_q_idx = wlan_rx_prio_q(buffer, len);
+	if (prio_q_idx == PRIO_Q_DATA_HI)
+		buf_handle.flag = FRAME_PRIO_HIGH;
+
+	if (send_to_host_queue(&buf_handle, prio_q_idx))
 		goto DONE;
 
 	return ESP_OK;
@@ -303,8 +393,11 @@ void send_task(void* pvParameters)
 		}
 
 		if (xQueueReceive(meta_to_host_queue, &queue_type, portMAX_DELAY))
-			if (xQueueReceive(to_host_queue[queue_type], &buf_handle, portMAX_DELAY))
+			if (xQueueReceive(to_host_queue[queue_type], &buf_handle, portMAX_DELAY)) {
+				/* Hint transport to hold the buffer for aggregation */
+				buf_handle.more_pending = uxQueueMessagesWaiting(meta_to_host_queue) ? 1 : 0;
 				process_tx_pkt(&buf_handle);
+			}
 	}
 }
 
@@ -369,12 +462,77 @@ void process_serial_rx_pkt(uint8_t *buf)
 	}
 }
 
+/* Wifi driver runs out of tx buffers at times under load. Wait for it,
+ * blocking instead of busy waiting. Rx buffer from host is held meanwhile,
+ * which (with credit based flow control) throttles host */
+static esp_err_t wlan_tx(wifi_interface_t ifx, void *payload, uint16_t len)
+{
+	uint8_t retry = WLAN_TX_MAX_RETRY;
+	esp_err_t ret = ESP_OK;
+
+	ret = esp_wifi_internal_tx(ifx, payload, len);
+
+	while (ret && retry--) {
+		vTaskDelay(1);
+		ret = esp_wifi_internal_tx(ifx, payload, len);
+	}
+
+	if (ret)
+		ESP_LOGD(TAG, "wlan tx failed: 0x%x, drop", ret);
+
+	return ret;
+}
+
+static void process_host_init_event(uint8_t *evt_buf, uint8_t len)
+{
+	uint8_t len_left = len, tag_len;
+	uint8_t *pos = evt_buf;
+	uint32_t ext_cap = 0;
+
+	while (len_left >= 2) {
+		tag_len = *(pos + 1);
+
+		if (tag_len + 2 > len_left)
+			break;
+
+		if (*pos == ESP_PRIV_CAPABILITY_EXT && tag_len == LENGTH_4_BYTE) {
+			ext_cap = *(pos + 2) | (*(pos + 3) << 8) |
+				(*(pos + 4) << 16) | ((uint32_t)*(pos + 5) << 24);
+
+			if (if_context)
+				if_context->ext_capabilities = ext_cap & get_ext_capabilities();
+
+			ESP_LOGI(TAG, "Host enabled ext capabilities: 0x%x",
+					(unsigned int)(ext_cap & get_ext_capabilities()));
+		} else {
+			ESP_LOGW(TAG, "Unsupported tag[%u] in host event", *pos);
+		}
+
+		pos += (tag_len + 2);
+		len_left -= (tag_len + 2);
+	}
+}
+
+static void process_priv_pkt(struct esp_payload_header *header,
+		uint8_t *payload, uint16_t payload_len)
+{
+	struct esp_priv_event *event = (struct esp_priv_event *) payload;
+
+	if (header->priv_pkt_type != ESP_PACKET_TYPE_EVENT ||
+	    payload_len < sizeof(struct esp_priv_event))
+		return;
+
+	if (event->event_type == ESP_PRIV_EVENT_HOST_INIT)
+		process_host_init_event(event->event_data, event->event_len);
+	else
+		ESP_LOGW(TAG, "Drop unknown priv event[%u]", event->event_type);
+}
+
 void process_rx_pkt(interface_buffer_handle_t *buf_handle)
 {
 	struct esp_payload_header *header = NULL;
 	uint8_t *payload = NULL;
 	uint16_t payload_len = 0;
-	int ret = 0;
 
 	header = (struct esp_payload_header *) buf_handle->payload;
 	payload = buf_handle->payload + le16toh(header->offset);
@@ -385,49 +543,28 @@ void process_rx_pkt(interface_buffer_handle_t *buf_handle)
 
 	if ((buf_handle->if_type == ESP_STA_IF) && station_connected) {
 		/* Forward data to wlan driver */
-		int retry = 6;
-
-		do {
-			ret = esp_wifi_internal_tx(ESP_IF_WIFI_STA, payload, payload_len);
-			retry--;
-
-			if (ret) {
-				if (retry % 3)
-					usleep(600);
-				else
-					vTaskDelay(1);
-			}
-
-		} while (ret && retry);
+		wlan_tx(ESP_IF_WIFI_STA, payload, payload_len);
 		/*ESP_LOG_BUFFER_HEXDUMP("spi_sta_rx", payload, payload_len, ESP_LOG_INFO);*/
 	} else if (buf_handle->if_type == ESP_AP_IF && softap_started) {
-		int retry = 6;
 		/* Forward data to wlan driver */
-		do {
-			ret = esp_wifi_internal_tx(ESP_IF_WIFI_AP, payload, payload_len);
-			retry--;
-
-			if (ret) {
-				if (retry % 3)
-					usleep(600);
-				else
-					vTaskDelay(1);
-			}
-
-		} while (ret && retry);
+		wlan_tx(ESP_IF_WIFI_AP, payload, payload_len);
 	} else if (buf_handle->if_type == ESP_SERIAL_IF) {
 		process_serial_rx_pkt(buf_handle->payload);
 	}
+	else if (buf_handle->if_type == ESP_PRIV_IF) {
+		process_priv_pkt(header, payload, payload_len);
+	}
 #if defined(CONFIG_BT_ENABLED) && BLUETOOTH_HCI
 	else if (buf_handle->if_type == ESP_HCI_IF) {
 		process_hci_rx_pkt(payload, payload_len);
 	}
 #endif
-#if TEST_RAW_TP && TEST_RAW_TP__HOST_TO_ESP
 	else if (buf_handle->if_type == ESP_TEST_IF) {
+#if TEST_RAW_TP && TEST_RAW_TP__HOST_TO_ESP
 		debug_update_raw_tp_rx_count(payload_len);
-	}
 #endif
+		debug_process_raw_tp_bench_pkt(payload, payload_len);
+	}
 
 	/* Free buffer handle */
 	if (buf_handle->free_buf_handle && buf_handle->priv_buffer_handle) {
@@ -436,6 +573,63 @@ void process_rx_pkt(interface_buffer_handle_t *buf_handle)
 	}
 }
 
+static void process_aggregated_rx_pkt(interface_buffer_handle_t *buf_handle)
+{
+	struct esp_payload_header *header = NULL;
+	interface_buffer_handle_t frame_handle = {0};
+	uint32_t pos = 0, end = 0, frame_len = 0;
+#if CONFIG_ESP_SPI_CHECKSUM || CONFIG_ESP_SDIO_CHECKSUM
+	uint16_t rx_checksum = 0, checksum = 0;
+#endif
+
+	header = (struct esp_payload_header *) buf_handle->payload;
+	pos = le16toh(header->offset);
+	end = pos + le16toh(header->len);
+
+	if (end > buf_handle->payload_len) {
+		ESP_LOGE(TAG, "Aggregated frame len[%u] > rx len[%u], drop",
+				(unsigned int)end, buf_handle->payload_len);
+		end = 0;
+	}
+
+	/* Process each frame in place. Buffer is freed once after all frames */
+	while (pos + sizeof(struct esp_payload_header) <= end) {
+		header = (struct esp_payload_header *) (buf_handle->payload + pos);
+		frame_len = le16toh(header->offset) + le16toh(header->len);
+
+		if (!header->len || (pos + frame_len > end))
+			break;
+
+		pos += AGGR_FRAME_ALIGN(frame_len);
+
+#if CONFIG_ESP_SPI_CHECKSUM || CONFIG_ESP_SDIO_CHECKSUM
+		rx_checksum = le16toh(header->checksum);
+		header->checksum = 0;
+
+		checksum = compute_frame_checksum((uint8_t *) header, frame_len);
+
+		if (checksum != rx_checksum) {
+			ESP_LOGE(TAG, "%s: cal_chksum[%u] != exp_chksum[%u], drop",
+					__func__, checksum, rx_checksum);
+			continue;
+		}
+#endif
+
+		memset(&frame_handle, 0, sizeof(frame_handle));
+		frame_handle.if_type = header->if_type;
+		frame_handle.if_num = header->if_num;
+		frame_handle.payload = (uint8_t *) header;
+		frame_handle.payload_len = frame_len;
+
+		process_rx_pkt(&frame_handle);
+	}
+
+	if (buf_handle->free_buf_handle && buf_handle->priv_buffer_handle) {
+		buf_handle->free_buf_handle(buf_handle->priv_buffer_handle);
+		buf_handle->priv_buffer_handle = NULL;
+	}
+}
+
 /* Get data from host */
 void recv_task(void* pvParameters)
 {
@@ -458,7 +652,10 @@ void recv_task(void* pvParameters)
 			}
 		}
 
-		process_rx_pkt(&buf_handle);
+		if (((struct esp_payload_header *) buf_handle.payload)->flags & AGGREGATED_FRAME)
+			process_aggregated_rx_pkt(&buf_handle);
+		else
+			process_rx_pkt(&buf_handle);
 	}
 }
 
@@ -488,7 +685,7 @@ int send_to_host_queue(interface_buffer_handle_t *buf_handle, uint8_t queue_type
 		return ESP_FAIL;
 	}
 
-	if (queue_type == PRIO_Q_SERIAL)
+	if ((queue_type == PRIO_Q_SERIAL) || (queue_type == PRIO_Q_DATA_HI))
 		ret = xQueueSendToFront(meta_to_host_queue, &queue_type, portMAX_DELAY);
 	else
 		ret = xQueueSend(meta_to_host_queue, &queue_type, portMAX_DELAY);
@@ -707,6 +904,7 @@ void app_main()
 {
 	esp_err_t ret;
 	uint8_t capa = 0;
+	uint32_t ext_capa = 0;
 	uint8_t prio_q_idx = 0;
 #ifdef CONFIG_BT_ENABLED
 	uint8_t mac[MAC_LEN] = {0};
@@ -714,6 +912,7 @@ void app_main()
 	print_firmware_version();
 
 	capa = get_capabilities();
+	ext_capa = get_ext_capabilities();
 
 	/* Initialize NVS */
 	ret = nvs_flash_init();
@@ -777,7 +976,7 @@ void app_main()
 		return;
 	}
 
-	meta_to_host_queue = xQueueCreate(TO_HOST_QUEUE_SIZE*3, sizeof(uint8_t));
+	meta_to_host_queue = xQueueCreate(TO_HOST_QUEUE_SIZE*MAX_PRIORITY_QUEUES, sizeof(uint8_t));
 	assert(meta_to_host_queue);
 	for (prio_q_idx=0; prio_q_idx<MAX_PRIORITY_QUEUES; prio_q_idx++) {
 		to_host_queue[prio_q_idx] = xQueueCreate(TO_HOST_QUEUE_SIZE,
@@ -800,7 +999,7 @@ void app_main()
 	}
 
 	/* send capabilities to host */
-	generate_startup_event(capa);
+	generate_startup_event(capa, ext_capa);
 	ESP_LOGI(TAG,"Initial set up done");
 
 	send_event_to_host(CTRL_MSG_ID__Event_ESPInit);
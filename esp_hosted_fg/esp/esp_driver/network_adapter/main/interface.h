@@ -63,6 +63,8 @@ typedef struct {
 	uint8_t flag;
 	uint16_t payload_len;
 	uint16_t seq_num;
+	/* More buffers are waiting to be sent after this one */
+	uint8_t more_pending;
 
 	void (*free_buf_handle)(void *buf_handle);
 } interface_buffer_handle_t;
@@ -88,10 +90,14 @@ typedef struct {
 	void *priv;
 	if_ops_t *if_ops;
 	int (*event_handler)(uint8_t bitmap);
+	/* Extended capabilities enabled by host */
+	uint32_t ext_capabilities;
 } interface_context_t;
 
 interface_context_t * interface_insert_driver(int (*callback)(uint8_t val));
 int interface_remove_driver();
-void generate_startup_event(uint8_t cap);
+void generate_startup_event(uint8_t cap, uint32_t ext_cap);
+uint16_t compute_frame_checksum(uint8_t *frame, uint16_t len);
+void set_frame_checksum(uint8_t *frame, uint16_t len);
 int send_to_host_queue(interface_buffer_handle_t *buf_handle, uint8_t queue_type);
 #endif
@@ -75,6 +75,53 @@ static inline void sdio_buffer_tx_free(void *buf)
 	hosted_mempool_free(buf_mp_tx_g, buf);
 }
 
+#if CONFIG_ESP_SDIO_BATCH
+/* Free buffers which host has read */
+static void sdio_free_sent_buffers(TickType_t wait)
+{
+	void *buf = NULL;
+
+	while (sdio_slave_send_get_finished(&buf, wait) == ESP_OK) {
+		sdio_buffer_tx_free(buf);
+		wait = 0;
+	}
+}
+#endif
+
+/* Send 'len' bytes at 'sendbuf' (within 'buf') to host. 'buf' is freed */
+static esp_err_t sdio_send_buffer(void *buf, uint8_t *sendbuf, size_t len)
+{
+	esp_err_t ret = ESP_OK;
+
+#if CONFIG_ESP_SDIO_BATCH
+	if (context.ext_capabilities & ESP_TRANSPORT_SDIO_BATCH) {
+		/* Do not wait for host to read it: frames queued meanwhile
+		 * are read by host in single transfer */
+		sdio_free_sent_buffers(0);
+
+		while ((ret = sdio_slave_send_queue(sendbuf, len, buf, 0)) == ESP_ERR_TIMEOUT)
+			sdio_free_sent_buffers(portMAX_DELAY);
+
+		if (ret != ESP_OK)
+			sdio_buffer_tx_free(buf);
+
+		return ret;
+	}
+#endif
+
+	ret = sdio_slave_transmit(sendbuf, len);
+	sdio_buffer_tx_free(buf);
+
+	return ret;
+}
+
+#if CONFIG_ESP_TRANSPORT_AGGREGATION
+/* Frames staged for next aggregated transmit */
+static uint8_t *aggr_buf;
+static uint32_t aggr_len;
+static uint8_t aggr_cnt;
+#endif
+
 interface_context_t *interface_insert_driver(int (*event_handler)(uint8_t val))
 {
 	ESP_LOGI(TAG, "Using SDIO interface");
@@ -105,7 +152,7 @@ IRAM_ATTR static void event_cb(uint8_t val)
 	}
 }
 
-void generate_startup_event(uint8_t cap)
+void generate_startup_event(uint8_t cap, uint32_t ext_cap)
 {
 	struct esp_payload_header *header = NULL;
 	interface_buffer_handle_t buf_handle = {0};
@@ -150,6 +197,14 @@ void generate_startup_event(uint8_t cap)
 	*pos = LENGTH_1_BYTE;               pos++;len++;
 	*pos = cap;                         pos++;len++;
 
+	/* TLV - Extended capability */
+	*pos = ESP_PRIV_CAPABILITY_EXT;     pos++;len++;
+	*pos = LENGTH_4_BYTE;               pos++;len++;
+	*pos = ext_cap & 0xFF;              pos++;len++;
+	*pos = (ext_cap >> 8) & 0xFF;       pos++;len++;
+	*pos = (ext_cap >> 16) & 0xFF;      pos++;len++;
+	*pos = (ext_cap >> 24) & 0xFF;      pos++;len++;
+
 	*pos = ESP_PRIV_TEST_RAW_TP;        pos++;len++;
 	*pos = LENGTH_1_BYTE;               pos++;len++;
 	*pos = raw_tp_cap;                  pos++;len++;
@@ -180,7 +235,7 @@ void generate_startup_event(uint8_t cap)
 
 	buf_handle.payload_len = len + sizeof(struct esp_payload_header);
 #if CONFIG_ESP_SDIO_CHECKSUM
-	header->checksum = htole16(compute_checksum(buf_handle.payload, buf_handle.payload_len));
+	set_frame_checksum(buf_handle.payload, buf_handle.payload_len);
 #endif
 
 	ESP_LOG_BUFFER_HEXDUMP("sdio_tx", buf_handle.payload, buf_handle.payload_len, ESP_LOG_VERBOSE);
@@ -279,13 +334,106 @@ static interface_handle_t * sdio_init(void)
 	return &if_handle_g;
 }
 
+static void sdio_fill_tx_frame(uint8_t *sendbuf, interface_buffer_handle_t *buf_handle)
+{
+	uint16_t offset = 0;
+	struct esp_payload_header *header = NULL;
+
+	header = (struct esp_payload_header *) sendbuf;
+
+	memset (header, 0, sizeof(struct esp_payload_header));
+
+	/* Initialize header */
+	header->if_type = buf_handle->if_type;
+	header->if_num = buf_handle->if_num;
+	header->flags = buf_handle->flag & FRAME_PRIO_HIGH;
+	header->len = htole16(buf_handle->payload_len);
+	offset = sizeof(struct esp_payload_header);
+	header->offset = htole16(offset);
+
+	memcpy(sendbuf + offset, buf_handle->payload, buf_handle->payload_len);
+
+#if CONFIG_ESP_SDIO_CHECKSUM
+	set_frame_checksum(sendbuf, offset+buf_handle->payload_len);
+#endif
+}
+
+#if CONFIG_ESP_TRANSPORT_AGGREGATION
+static int32_t sdio_flush_aggr_buf(void)
+{
+	esp_err_t ret = ESP_OK;
+	struct esp_payload_header *header = NULL;
+	uint8_t *sendbuf = aggr_buf;
+	uint32_t total_len = aggr_len;
+
+	if (!aggr_buf)
+		return ESP_OK;
+
+	header = (struct esp_payload_header *) aggr_buf;
+
+	if (aggr_cnt == 1) {
+		/* Single frame, send it without aggregated frame header */
+		sendbuf += sizeof(struct esp_payload_header);
+		total_len -= sizeof(struct esp_payload_header);
+	} else {
+		memset(header, 0, sizeof(struct esp_payload_header));
+		header->if_type = (header + 1)->if_type;
+		header->if_num = (header + 1)->if_num;
+		header->flags = AGGREGATED_FRAME;
+		header->offset = htole16(sizeof(struct esp_payload_header));
+		header->len = htole16(aggr_len - sizeof(struct esp_payload_header));
+	}
+
+	ret = sdio_send_buffer(aggr_buf, sendbuf, total_len);
+	if (ret != ESP_OK)
+		ESP_LOGE(TAG , "sdio slave transmit error, ret : 0x%x\r\n", ret);
+
+	aggr_buf = NULL;
+	aggr_len = 0;
+	aggr_cnt = 0;
+
+	return ret == ESP_OK ? ESP_OK : ESP_FAIL;
+}
+
+/* Stage frame in aggregation buffer. Buffer is sent once full or
+ * when no more frames are pending behind this one */
+static int32_t sdio_write_aggr(interface_buffer_handle_t *buf_handle)
+{
+	int32_t total_len = buf_handle->payload_len + sizeof (struct esp_payload_header);
+	int32_t ret = ESP_OK;
+
+	if (aggr_buf && (AGGR_FRAME_ALIGN(aggr_len) + total_len > BUFFER_SIZE))
+		sdio_flush_aggr_buf();
+
+	if (!aggr_buf) {
+		aggr_buf = sdio_buffer_tx_alloc(MEMSET_NOT_REQUIRED);
+		if (aggr_buf == NULL) {
+			ESP_LOGE(TAG , "Malloc send buffer fail!");
+			return ESP_FAIL;
+		}
+		aggr_len = sizeof(struct esp_payload_header);
+	}
+
+	aggr_len = AGGR_FRAME_ALIGN(aggr_len);
+	sdio_fill_tx_frame(aggr_buf + aggr_len, buf_handle);
+	aggr_len += total_len;
+	aggr_cnt++;
+
+	if (!buf_handle->more_pending)
+		ret = sdio_flush_aggr_buf();
+
+	if (ret != ESP_OK)
+		return ESP_FAIL;
+
+	return buf_handle->payload_len;
+}
+#endif
+
 static int32_t sdio_write(interface_handle_t *handle, interface_buffer_handle_t *buf_handle)
 {
 	esp_err_t ret = ESP_OK;
 	int32_t total_len = 0;
 	uint8_t* sendbuf = NULL;
-	uint16_t offset = 0;
-	struct esp_payload_header *header = NULL;
 
 	if (!handle || !buf_handle) {
 		ESP_LOGE(TAG , "Invalid arguments");
@@ -298,44 +446,37 @@ static int32_t sdio_write(interface_handle_t *handle, interface_buffer_handle_t
 
 	if (!buf_handle->payload_len || !buf_handle->payload) {
 		ESP_LOGE(TAG , "Invalid arguments, len:%d", buf_handle->payload_len);
+#if CONFIG_ESP_TRANSPORT_AGGREGATION
+		sdio_flush_aggr_buf();
+#endif
 		return ESP_FAIL;
 	}
 
 	total_len = buf_handle->payload_len + sizeof (struct esp_payload_header);
 
+#if CONFIG_ESP_TRANSPORT_AGGREGATION
+	if ((context.ext_capabilities & ESP_TRANSPORT_AGGREGATION) &&
+	    (total_len + sizeof(struct esp_payload_header) <= BUFFER_SIZE))
+		return sdio_write_aggr(buf_handle);
+
+	/* Keep order with frames staged earlier */
+	sdio_flush_aggr_buf();
+#endif
+
 	sendbuf = sdio_buffer_tx_alloc(MEMSET_REQUIRED);
 	if (sendbuf == NULL) {
 		ESP_LOGE(TAG , "Malloc send buffer fail!");
 		return ESP_FAIL;
 	}
 
-	header = (struct esp_payload_header *) sendbuf;
-
-	memset (header, 0, sizeof(struct esp_payload_header));
+	sdio_fill_tx_frame(sendbuf, buf_handle);
 
-	/* Initialize header */
-	header->if_type = buf_handle->if_type;
-	header->if_num = buf_handle->if_num;
-	header->len = htole16(buf_handle->payload_len);
-	offset = sizeof(struct esp_payload_header);
-	header->offset = htole16(offset);
-
-	memcpy(sendbuf + offset, buf_handle->payload, buf_handle->payload_len);
-
-#if CONFIG_ESP_SDIO_CHECKSUM
-	header->checksum = htole16(compute_checksum(sendbuf,
-				offset+buf_handle->payload_len));
-#endif
-
-	ret = sdio_slave_transmit(sendbuf, total_len);
+	ret = sdio_send_buffer(sendbuf, sendbuf, total_len);
 	if (ret != ESP_OK) {
 		ESP_LOGE(TAG , "sdio slave transmit error, ret : 0x%x\r\n", ret);
-		sdio_buffer_tx_free(sendbuf);
 		return ESP_FAIL;
 	}
 
-	sdio_buffer_tx_free(sendbuf);
-
 	return buf_handle->payload_len;
 }
 
@@ -375,7 +516,11 @@ static int sdio_read(interface_handle_t *if_handle, interface_buffer_handle_t *b
 	rx_checksum = le16toh(header->checksum);
 	header->checksum = 0;
 
-	checksum = compute_checksum(buf_handle->payload, len);
+	/* Aggregated frame carries checksum per contained frame */
+	if (header->flags & AGGREGATED_FRAME)
+		checksum = rx_checksum;
+	else
+		checksum = compute_frame_checksum(buf_handle->payload, len);
 
 	if (checksum != rx_checksum) {
 		sdio_read_done(buf_handle->sdio_buf_handle);
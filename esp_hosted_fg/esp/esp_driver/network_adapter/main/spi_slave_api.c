@@ -29,6 +29,7 @@
 #include "mempool.h"
 #include "stats.h"
 #include "esp_timer.h"
+#include "esp_attr.h"
 #include "esp_fw_version.h"
 
 static const char TAG[] = "SPI_DRIVER";
@@ -142,9 +143,10 @@ static const char TAG[] = "SPI_DRIVER";
 
 #ifdef CONFIG_ESP_ENABLE_TX_PRIORITY_QUEUES
     #define SPI_TX_WIFI_QUEUE_SIZE     CONFIG_ESP_SPI_TX_WIFI_Q_SIZE
+    #define SPI_TX_WIFI_HI_QUEUE_SIZE  CONFIG_ESP_SPI_TX_WIFI_HI_Q_SIZE
     #define SPI_TX_BT_QUEUE_SIZE       CONFIG_ESP_SPI_TX_BT_Q_SIZE
     #define SPI_TX_SERIAL_QUEUE_SIZE   CONFIG_ESP_SPI_TX_SERIAL_Q_SIZE
-    #define SPI_TX_TOTAL_QUEUE_SIZE (SPI_TX_WIFI_QUEUE_SIZE+SPI_TX_BT_QUEUE_SIZE+SPI_TX_SERIAL_QUEUE_SIZE)
+    #define SPI_TX_TOTAL_QUEUE_SIZE (SPI_TX_WIFI_QUEUE_SIZE+SPI_TX_WIFI_HI_QUEUE_SIZE+SPI_TX_BT_QUEUE_SIZE+SPI_TX_SERIAL_QUEUE_SIZE)
 #else
     #define SPI_TX_QUEUE_SIZE          CONFIG_ESP_SPI_TX_Q_SIZE
     #define SPI_TX_TOTAL_QUEUE_SIZE    SPI_TX_QUEUE_SIZE
@@ -152,18 +154,54 @@ static const char TAG[] = "SPI_DRIVER";
 
 #ifdef CONFIG_ESP_ENABLE_RX_PRIORITY_QUEUES
     #define SPI_RX_WIFI_QUEUE_SIZE     CONFIG_ESP_SPI_RX_WIFI_Q_SIZE
+    #define SPI_RX_WIFI_HI_QUEUE_SIZE  CONFIG_ESP_SPI_RX_WIFI_HI_Q_SIZE
     #define SPI_RX_BT_QUEUE_SIZE       CONFIG_ESP_SPI_RX_BT_Q_SIZE
     #define SPI_RX_SERIAL_QUEUE_SIZE   CONFIG_ESP_SPI_RX_SERIAL_Q_SIZE
-    #define SPI_RX_TOTAL_QUEUE_SIZE (SPI_RX_WIFI_QUEUE_SIZE+SPI_RX_BT_QUEUE_SIZE+SPI_RX_SERIAL_QUEUE_SIZE)
+    #define SPI_RX_TOTAL_QUEUE_SIZE (SPI_RX_WIFI_QUEUE_SIZE+SPI_RX_WIFI_HI_QUEUE_SIZE+SPI_RX_BT_QUEUE_SIZE+SPI_RX_SERIAL_QUEUE_SIZE)
 #else
     #define SPI_RX_QUEUE_SIZE          CONFIG_ESP_SPI_RX_Q_SIZE
     #define SPI_RX_TOTAL_QUEUE_SIZE    SPI_RX_QUEUE_SIZE
 #endif
 
 
+#if CONFIG_ESP_SPI_CREDITS
+  #ifdef CONFIG_ESP_ENABLE_RX_PRIORITY_QUEUES
+    #define SPI_RX_CREDIT_POOLS        MAX_PRIORITY_QUEUES
+    #if (SPI_RX_WIFI_QUEUE_SIZE > ESP_CREDIT_COUNT_MASK) || \
+        (SPI_RX_WIFI_HI_QUEUE_SIZE > ESP_CREDIT_COUNT_MASK) || \
+        (SPI_RX_BT_QUEUE_SIZE > ESP_CREDIT_COUNT_MASK) || \
+        (SPI_RX_SERIAL_QUEUE_SIZE > ESP_CREDIT_COUNT_MASK)
+      #error "Host to ESP SPI queue size must be less than 32 for credit based flow control"
+    #endif
+  #else
+    #define SPI_RX_CREDIT_POOLS        1
+    #if (SPI_RX_QUEUE_SIZE > ESP_CREDIT_COUNT_MASK)
+      #error "Host to ESP SPI queue size must be less than 32 for credit based flow control"
+    #endif
+  #endif
+#endif
+
 static interface_context_t context;
 static interface_handle_t if_handle_g;
 
+#if CONFIG_ESP_SPI_VAR_LEN
+typedef enum {
+	SPI_VAR_LEN_DISABLED,
+	SPI_VAR_LEN_SWITCHING,
+	SPI_VAR_LEN_ENABLED,
+} spi_var_len_state_t;
+
+/* spi_slave_transaction_t.user to mark header phase transactions */
+#define SPI_TRANS_VAR_LEN_HDR      ((void *) 1)
+
+static spi_var_len_state_t var_len_state;
+/* Tx buffer announced in last header phase, sent in payload phase */
+static uint8_t *var_len_tx_buf;
+static uint32_t var_len_tx_len;
+WORD_ALIGNED_ATTR DMA_ATTR static uint8_t var_len_hdr_tx[sizeof(struct esp_spi_var_len_hdr)];
+WORD_ALIGNED_ATTR DMA_ATTR static uint8_t var_len_hdr_rx[sizeof(struct esp_spi_var_len_hdr)];
+#endif
+
 #ifdef CONFIG_ESP_ENABLE_TX_PRIORITY_QUEUES
   static QueueHandle_t spi_tx_queue[MAX_PRIORITY_QUEUES];
   static SemaphoreHandle_t spi_tx_sem;
@@ -178,6 +216,26 @@ static interface_handle_t if_handle_g;
   static QueueHandle_t spi_rx_queue;
 #endif
 
+#if CONFIG_ESP_SPI_CREDITS
+#ifdef CONFIG_ESP_ENABLE_RX_PRIORITY_QUEUES
+static const uint8_t rx_credit_pool_size[SPI_RX_CREDIT_POOLS] = {
+	[PRIO_Q_SERIAL] = SPI_RX_SERIAL_QUEUE_SIZE,
+	[PRIO_Q_BT] = SPI_RX_BT_QUEUE_SIZE,
+	[PRIO_Q_DATA_HI] = SPI_RX_WIFI_HI_QUEUE_SIZE,
+	[PRIO_Q_OTHERS] = SPI_RX_WIFI_QUEUE_SIZE,
+};
+#else
+static const uint8_t rx_credit_pool_size[SPI_RX_CREDIT_POOLS] = { SPI_RX_QUEUE_SIZE };
+#endif
+
+/* Frames consumed from host, per pool. Updated only by recv task
+ * and spi post process task respectively */
+static volatile uint8_t rx_credits_consumed[SPI_RX_CREDIT_POOLS];
+static volatile uint8_t rx_credits_dropped[SPI_RX_CREDIT_POOLS];
+static uint8_t rx_credits_reported[SPI_RX_CREDIT_POOLS];
+static uint8_t rx_credit_pool_next;
+#endif
+
 static interface_handle_t * esp_spi_init(void);
 static int32_t esp_spi_write(interface_handle_t *handle,
 				interface_buffer_handle_t *buf_handle);
@@ -186,6 +244,7 @@ static esp_err_t esp_spi_reset(interface_handle_t *handle);
 static void esp_spi_deinit(interface_handle_t *handle);
 static void esp_spi_read_done(void *handle);
 static void queue_next_transaction(void);
+static void queue_full_len_transaction(uint8_t *tx_buffer);
 
 if_ops_t if_ops = {
 	.init = esp_spi_init,
@@ -289,7 +348,80 @@ int interface_remove_driver()
 	return 0;
 }
 
-void generate_startup_event(uint8_t cap)
+#if CONFIG_ESP_SPI_CREDITS
+static inline uint8_t rx_credit_pool(uint8_t if_type, uint8_t flags)
+{
+#ifdef CONFIG_ESP_ENABLE_RX_PRIORITY_QUEUES
+	return ESP_PRIO_Q(if_type, flags);
+#else
+	return 0;
+#endif
+}
+
+static inline uint8_t rx_credit_count(uint8_t pool)
+{
+	return (rx_credits_consumed[pool] + rx_credits_dropped[pool]) & ESP_CREDIT_COUNT_MASK;
+}
+
+static inline uint8_t rx_credits_unreported(uint8_t pool)
+{
+	return (rx_credit_count(pool) - rx_credits_reported[pool]) & ESP_CREDIT_COUNT_MASK;
+}
+
+static bool rx_credit_report_pending(void)
+{
+	uint8_t pool = 0;
+
+	for (pool = 0; pool < SPI_RX_CREDIT_POOLS; pool++)
+		if (rx_credits_unreported(pool))
+			return true;
+
+	return false;
+}
+
+/* Credit report for next frame header. Pools with new credits go first */
+static uint8_t get_rx_credit_report(void)
+{
+	uint8_t pool = 0, i = 0;
+
+	if (!(context.ext_capabilities & ESP_TRANSPORT_CREDITS))
+		return 0;
+
+	for (i = 0; i < SPI_RX_CREDIT_POOLS; i++) {
+		pool = (rx_credit_pool_next + i) % SPI_RX_CREDIT_POOLS;
+		if (rx_credits_unreported(pool))
+			break;
+	}
+
+	if (i == SPI_RX_CREDIT_POOLS)
+		pool = rx_credit_pool_next;
+
+	rx_credit_pool_next = (pool + 1) % SPI_RX_CREDIT_POOLS;
+	rx_credits_reported[pool] = rx_credit_count(pool);
+
+	return ESP_CREDIT_ENCODE(pool, rx_credits_reported[pool]);
+}
+
+/* Frame consumed from rx queue. Prompt host to collect credits
+ * when it may be running short of them */
+static void rx_credit_consumed(uint8_t pool, QueueHandle_t rx_queue)
+{
+	uint8_t unreported = 0;
+
+	rx_credits_consumed[pool]++;
+
+	if (!(context.ext_capabilities & ESP_TRANSPORT_CREDITS))
+		return;
+
+	unreported = rx_credits_unreported(pool);
+
+	if ((unreported >= (rx_credit_pool_size[pool] + 1) / 2) ||
+	    (unreported && !uxQueueMessagesWaiting(rx_queue)))
+		set_dataready_gpio();
+}
+#endif
+
+void generate_startup_event(uint8_t cap, uint32_t ext_cap)
 {
 	struct esp_payload_header *header = NULL;
 	interface_buffer_handle_t buf_handle = {0};
@@ -332,10 +464,27 @@ void generate_startup_event(uint8_t cap)
 	*pos = LENGTH_1_BYTE;               pos++;len++;
 	*pos = cap;                         pos++;len++;
 
+	/* TLV - Extended capability */
+	*pos = ESP_PRIV_CAPABILITY_EXT;     pos++;len++;
+	*pos = LENGTH_4_BYTE;               pos++;len++;
+	*pos = ext_cap & 0xFF;              pos++;len++;
+	*pos = (ext_cap >> 8) & 0xFF;       pos++;len++;
+	*pos = (ext_cap >> 16) & 0xFF;      pos++;len++;
+	*pos = (ext_cap >> 24) & 0xFF;      pos++;len++;
+
 	*pos = ESP_PRIV_TEST_RAW_TP;        pos++;len++;
 	*pos = LENGTH_1_BYTE;               pos++;len++;
 	*pos = raw_tp_cap;                  pos++;len++;
 
+#if CONFIG_ESP_SPI_CREDITS
+	/* TLV - Host to ESP queue sizes, i.e. initial credits */
+	*pos = ESP_PRIV_RX_QUEUE_SIZE;      pos++;len++;
+	*pos = SPI_RX_CREDIT_POOLS;         pos++;len++;
+	memcpy(pos, rx_credit_pool_size, SPI_RX_CREDIT_POOLS);
+	pos += SPI_RX_CREDIT_POOLS;
+	len += SPI_RX_CREDIT_POOLS;
+#endif
+
 	/* fill structure with fw info */
 	strncpy(fw_ver.project_name, PROJECT_NAME, sizeof(fw_ver.project_name) - 1);
 	fw_ver.project_name[sizeof(fw_ver.project_name) - 1] = '\0';
@@ -369,7 +518,7 @@ void generate_startup_event(uint8_t cap)
 	buf_handle.payload_len = total_len;
 
 #if CONFIG_ESP_SPI_CHECKSUM
-	header->checksum = htole16(compute_checksum(buf_handle.payload, len + sizeof(struct esp_payload_header)));
+	set_frame_checksum(buf_handle.payload, len + sizeof(struct esp_payload_header));
 #endif
 
 #ifdef CONFIG_ESP_ENABLE_TX_PRIORITY_QUEUES
@@ -400,6 +549,79 @@ static void IRAM_ATTR spi_post_trans_cb(spi_slave_transaction_t *trans)
 	reset_handshake_gpio();
 }
 
+#if CONFIG_ESP_TRANSPORT_AGGREGATION
+static QueueHandle_t peek_next_tx_queue(interface_buffer_handle_t *buf_handle)
+{
+#ifdef CONFIG_ESP_ENABLE_TX_PRIORITY_QUEUES
+	uint8_t prio_q_idx = 0;
+
+	for (prio_q_idx = 0; prio_q_idx < MAX_PRIORITY_QUEUES; prio_q_idx++)
+		if (pdTRUE == xQueuePeek(spi_tx_queue[prio_q_idx], buf_handle, 0))
+			return spi_tx_queue[prio_q_idx];
+#else
+	if (pdTRUE == xQueuePeek(spi_tx_queue, buf_handle, 0))
+		return spi_tx_queue;
+#endif
+	return NULL;
+}
+
+/* Pack pending tx buffers, if any, behind the first one into single
+ * aggregated frame. Returns new length of sendbuf */
+static uint32_t aggregate_tx_buffers(uint8_t *sendbuf, uint32_t len)
+{
+	interface_buffer_handle_t buf_handle = {0};
+	struct esp_payload_header *header = NULL;
+	QueueHandle_t tx_queue = NULL;
+	uint32_t total_len = 0;
+	uint8_t aggr_cnt = 0;
+
+	if (!(context.ext_capabilities & ESP_TRANSPORT_AGGREGATION))
+		return len;
+
+	total_len = sizeof(struct esp_payload_header) + len;
+
+	for (;;) {
+		tx_queue = peek_next_tx_queue(&buf_handle);
+
+		if (!tx_queue || !buf_handle.payload ||
+		    (total_len + buf_handle.payload_len > SPI_BUFFER_SIZE))
+			break;
+
+#ifdef CONFIG_ESP_ENABLE_TX_PRIORITY_QUEUES
+		if (pdTRUE != xSemaphoreTake(spi_tx_sem, 0))
+			break;
+#endif
+		if (pdTRUE != xQueueReceive(tx_queue, &buf_handle, 0))
+			break;
+
+		/* Make room for aggregated frame header */
+		if (!aggr_cnt)
+			memmove(sendbuf + sizeof(struct esp_payload_header), sendbuf, len);
+
+		/* Queued buffers are already DMA (4 byte) aligned */
+		memcpy(sendbuf + total_len, buf_handle.payload, buf_handle.payload_len);
+		total_len += buf_handle.payload_len;
+		aggr_cnt++;
+
+		spi_buffer_tx_free(buf_handle.payload);
+	}
+
+	if (!aggr_cnt)
+		return len;
+
+	header = (struct esp_payload_header *) sendbuf;
+	memset(header, 0, sizeof(struct esp_payload_header));
+
+	header->if_type = ((struct esp_payload_header *) (header + 1))->if_type;
+	header->if_num = ((struct esp_payload_header *) (header + 1))->if_num;
+	header->flags = AGGREGATED_FRAME;
+	header->offset = htole16(sizeof(struct esp_payload_header));
+	header->len = htole16(total_len - sizeof(struct esp_payload_header));
+
+	return total_len;
+}
+#endif
+
 static uint8_t * get_next_tx_buffer(uint32_t *len)
 {
 	interface_buffer_handle_t buf_handle = {0};
@@ -417,13 +639,23 @@ static uint8_t * get_next_tx_buffer(uint32_t *len)
 	if (pdTRUE == ret)
 		if (pdFALSE == xQueueReceive(spi_tx_queue[PRIO_Q_SERIAL], &buf_handle, 0))
 			if (pdFALSE == xQueueReceive(spi_tx_queue[PRIO_Q_BT], &buf_handle, 0))
-				if (pdFALSE == xQueueReceive(spi_tx_queue[PRIO_Q_OTHERS], &buf_handle, 0))
-					ret = pdFALSE;
+				if (pdFALSE == xQueueReceive(spi_tx_queue[PRIO_Q_DATA_HI], &buf_handle, 0))
+					if (pdFALSE == xQueueReceive(spi_tx_queue[PRIO_Q_OTHERS], &buf_handle, 0))
+						ret = pdFALSE;
 #else
 	ret = xQueueReceive(spi_tx_queue, &buf_handle, 0);
 #endif
 
 	if (ret == pdTRUE && buf_handle.payload) {
+#if CONFIG_ESP_TRANSPORT_AGGREGATION
+		buf_handle.payload_len = aggregate_tx_buffers(buf_handle.payload,
+				buf_handle.payload_len);
+#endif
+#if CONFIG_ESP_SPI_CREDITS
+		/* Not covered by checksum, set just before sending */
+		((struct esp_payload_header *) buf_handle.payload)->credits =
+			get_rx_credit_report();
+#endif
 		if (len)
 			*len = buf_handle.payload_len;
 		/* Return real data buffer from queue */
@@ -453,6 +685,20 @@ static uint8_t * get_next_tx_buffer(uint32_t *len)
 	if (len)
 		*len = 0;
 
+#if CONFIG_ESP_SPI_CREDITS
+	if (rx_credit_report_pending()) {
+		/* Carries new credits. Have host clock it */
+		header->credits = get_rx_credit_report();
+		if (header->credits) {
+			set_dataready_gpio();
+			if (len)
+				*len = sizeof(struct esp_payload_header);
+		}
+	} else {
+		header->credits = get_rx_credit_report();
+	}
+#endif
+
 	return sendbuf;
 }
 
@@ -480,6 +726,9 @@ static int process_spi_rx(interface_buffer_handle_t *buf_handle)
 
 	if (len+offset > SPI_BUFFER_SIZE) {
 		ESP_LOGE(TAG, "rx_pkt len+offset[%u]>max[%u], dropping it", len+offset, SPI_BUFFER_SIZE);
+#if CONFIG_ESP_SPI_CREDITS
+		rx_credits_dropped[rx_credit_pool(header->if_type, header->flags)]++;
+#endif
 		return -1;
 	}
 
@@ -487,11 +736,18 @@ static int process_spi_rx(interface_buffer_handle_t *buf_handle)
 	rx_checksum = le16toh(header->checksum);
 	header->checksum = 0;
 
-	checksum = compute_checksum(buf_handle->payload, len+offset);
+	/* Aggregated frame carries checksum per contained frame */
+	if (header->flags & AGGREGATED_FRAME)
+		checksum = rx_checksum;
+	else
+		checksum = compute_frame_checksum(buf_handle->payload, len+offset);
 
 	if (checksum != rx_checksum) {
 		ESP_LOGE(TAG, "%s: cal_chksum[%u] != exp_chksum[%u], drop len[%u] offset[%u]",
 				__func__, checksum, rx_checksum, len, offset);
+#if CONFIG_ESP_SPI_CREDITS
+		rx_credits_dropped[rx_credit_pool(header->if_type, header->flags)]++;
+#endif
 		return -1;
 	}
 #endif
@@ -499,6 +755,7 @@ static int process_spi_rx(interface_buffer_handle_t *buf_handle)
 	/* Buffer is valid */
 	buf_handle->if_type = header->if_type;
 	buf_handle->if_num = header->if_num;
+	buf_handle->flag = header->flags;
 	buf_handle->free_buf_handle = esp_spi_read_done;
 	buf_handle->payload_len = le16toh(header->len) + offset;
 	buf_handle->priv_buffer_handle = buf_handle->payload;
@@ -508,13 +765,8 @@ static int process_spi_rx(interface_buffer_handle_t *buf_handle)
 		pkt_stats.sta_rx_in++;
 #endif
 #ifdef CONFIG_ESP_ENABLE_RX_PRIORITY_QUEUES
-	if (header->if_type == ESP_SERIAL_IF) {
-		xQueueSend(spi_rx_queue[PRIO_Q_SERIAL], buf_handle, portMAX_DELAY);
-	} else if (header->if_type == ESP_HCI_IF) {
-		xQueueSend(spi_rx_queue[PRIO_Q_BT], buf_handle, portMAX_DELAY);
-	} else {
-		xQueueSend(spi_rx_queue[PRIO_Q_OTHERS], buf_handle, portMAX_DELAY);
-	}
+	xQueueSend(spi_rx_queue[ESP_PRIO_Q(header->if_type, header->flags)],
+			buf_handle, portMAX_DELAY);
 
 	xSemaphoreGive(spi_rx_sem);
 #else
@@ -523,9 +775,135 @@ static int process_spi_rx(interface_buffer_handle_t *buf_handle)
 	return 0;
 }
 
-static void queue_next_transaction(void)
+#if CONFIG_ESP_SPI_VAR_LEN
+static void queue_var_len_hdr_transaction(uint8_t *tx_buffer, uint32_t len)
 {
+	struct esp_spi_var_len_hdr *tx_hdr = (struct esp_spi_var_len_hdr *) var_len_hdr_tx;
 	spi_slave_transaction_t *spi_trans = NULL;
+
+	var_len_tx_buf = tx_buffer;
+	var_len_tx_len = len;
+
+	memset(var_len_hdr_tx, 0, sizeof(var_len_hdr_tx));
+	memset(var_len_hdr_rx, 0, sizeof(var_len_hdr_rx));
+
+	tx_hdr->magic = SPI_VAR_LEN_HDR_MAGIC;
+	tx_hdr->len = htole16(len);
+
+	spi_trans = spi_trans_alloc(MEMSET_REQUIRED);
+	assert(spi_trans);
+
+	spi_trans->tx_buffer = var_len_hdr_tx;
+	spi_trans->rx_buffer = var_len_hdr_rx;
+	spi_trans->length = sizeof(var_len_hdr_tx) * SPI_BITS_PER_WORD;
+	spi_trans->user = SPI_TRANS_VAR_LEN_HDR;
+
+	spi_slave_queue_trans(ESP_SPI_CONTROLLER, spi_trans, portMAX_DELAY);
+}
+
+static void queue_next_transaction(void);
+
+/* Partial tx frames which could not be put back to full queue */
+static uint32_t tx_requeue_dropped;
+
+/* Host may still be in variable length mode after ESP restart and clock
+ * only header phase. Put tx frame, which was cut short, back to queue.
+ * Returns false if frame is not requeued, caller then frees it */
+static bool requeue_partial_tx_buffer(spi_slave_transaction_t *spi_trans)
+{
+	struct esp_payload_header *header = NULL;
+	interface_buffer_handle_t buf_handle = {0};
+	uint32_t frame_len = 0;
+	BaseType_t ret = pdFALSE;
+
+	header = (struct esp_payload_header *) spi_trans->tx_buffer;
+	frame_len = le16toh(header->len) + le16toh(header->offset);
+
+	if (!header->len || (spi_trans->trans_len >= frame_len * SPI_BITS_PER_WORD))
+		return false;
+
+	buf_handle.if_type = header->if_type;
+	buf_handle.if_num = header->if_num;
+	buf_handle.payload = (uint8_t *) spi_trans->tx_buffer;
+	buf_handle.payload_len = SPI_VAR_LEN_ALIGN(frame_len);
+
+	/* Post process task must not block on full queue */
+#ifdef CONFIG_ESP_ENABLE_TX_PRIORITY_QUEUES
+	ret = xQueueSendToFront(spi_tx_queue[ESP_PRIO_Q(header->if_type, header->flags)],
+			&buf_handle, 0);
+
+	if (ret == pdTRUE)
+		xSemaphoreGive(spi_tx_sem);
+#else
+	ret = xQueueSendToFront(spi_tx_queue, &buf_handle, 0);
+#endif
+	if (ret != pdTRUE) {
+		tx_requeue_dropped++;
+		ESP_LOGW(TAG, "tx queue full, drop partial tx frame, dropped[%u]",
+				(unsigned int)tx_requeue_dropped);
+		return false;
+	}
+
+	set_dataready_gpio();
+
+	return true;
+}
+
+/* Header phase done. Clock max of announced lengths in payload phase */
+static void queue_var_len_payload_transaction(void)
+{
+	struct esp_spi_var_len_hdr *rx_hdr = (struct esp_spi_var_len_hdr *) var_len_hdr_rx;
+	spi_slave_transaction_t *spi_trans = NULL;
+	uint32_t host_len = 0, xfer_len = 0;
+
+	if (rx_hdr->magic != SPI_VAR_LEN_HDR_MAGIC) {
+		/* Host is back to full length transactions, as after its restart.
+		 * Follow it, and switch again only once host renegotiates capabilities */
+		ESP_LOGW(TAG, "Invalid header phase from host, magic[0x%x], back to full length transactions",
+				rx_hdr->magic);
+		var_len_state = SPI_VAR_LEN_DISABLED;
+		context.ext_capabilities &= ~ESP_TRANSPORT_SPI_VAR_LEN;
+
+		queue_full_len_transaction(var_len_tx_buf);
+		var_len_tx_buf = NULL;
+		return;
+	}
+
+	host_len = le16toh(rx_hdr->len);
+
+	if (host_len > SPI_BUFFER_SIZE) {
+		ESP_LOGE(TAG, "Host announced len[%u] > max[%u]",
+				(unsigned int)host_len, SPI_BUFFER_SIZE);
+		host_len = SPI_BUFFER_SIZE;
+	}
+
+	xfer_len = (host_len > var_len_tx_len) ? host_len : var_len_tx_len;
+	xfer_len = SPI_VAR_LEN_ALIGN(xfer_len);
+
+	if (!xfer_len) {
+		/* Nothing to exchange, drop dummy buffer and announce again */
+		spi_buffer_tx_free(var_len_tx_buf);
+		var_len_tx_buf = NULL;
+		queue_next_transaction();
+		return;
+	}
+
+	spi_trans = spi_trans_alloc(MEMSET_REQUIRED);
+	assert(spi_trans);
+
+	spi_trans->rx_buffer = spi_buffer_rx_alloc(MEMSET_REQUIRED);
+	assert(spi_trans->rx_buffer);
+
+	spi_trans->tx_buffer = var_len_tx_buf;
+	spi_trans->length = xfer_len * SPI_BITS_PER_WORD;
+	var_len_tx_buf = NULL;
+
+	spi_slave_queue_trans(ESP_SPI_CONTROLLER, spi_trans, portMAX_DELAY);
+}
+#endif
+
+static void queue_next_transaction(void)
+{
 	uint32_t len = 0;
 	uint8_t *tx_buffer = get_next_tx_buffer(&len);
 	if (!tx_buffer) {
@@ -534,6 +912,28 @@ static void queue_next_transaction(void)
 		return;
 	}
 
+#if CONFIG_ESP_SPI_VAR_LEN
+	if (var_len_state == SPI_VAR_LEN_ENABLED) {
+		queue_var_len_hdr_transaction(tx_buffer, len);
+		return;
+	}
+
+	if ((var_len_state == SPI_VAR_LEN_DISABLED) &&
+	    (context.ext_capabilities & ESP_TRANSPORT_SPI_VAR_LEN)) {
+		/* Last full length transaction. Host switches on seeing this flag.
+		 * Host clears it again before validating the frame */
+		((struct esp_payload_header *) tx_buffer)->flags |= SPI_VAR_LEN_SWITCH;
+		var_len_state = SPI_VAR_LEN_SWITCHING;
+	}
+#endif
+
+	queue_full_len_transaction(tx_buffer);
+}
+
+static void queue_full_len_transaction(uint8_t *tx_buffer)
+{
+	spi_slave_transaction_t *spi_trans = NULL;
+
 	spi_trans = spi_trans_alloc(MEMSET_REQUIRED);
 	assert(spi_trans);
 
@@ -564,9 +964,25 @@ static void spi_transaction_post_process_task(void* pvParameters)
 		 */
 		spi_slave_get_trans_result(ESP_SPI_CONTROLLER, &spi_trans,
 				portMAX_DELAY);
+		assert(spi_trans);
+
+#if CONFIG_ESP_SPI_VAR_LEN
+		if (spi_trans->user == SPI_TRANS_VAR_LEN_HDR) {
+			/* Header buffers are static, nothing to free */
+			queue_var_len_payload_transaction();
+			spi_trans_free(spi_trans);
+			continue;
+		}
+
+		if (var_len_state == SPI_VAR_LEN_SWITCHING)
+			var_len_state = SPI_VAR_LEN_ENABLED;
+		else if ((var_len_state == SPI_VAR_LEN_DISABLED) &&
+		         requeue_partial_tx_buffer(spi_trans))
+			spi_trans->tx_buffer = NULL;
+#endif
+
 		/* Queue new transaction to get ready as soon as possible */
 		queue_next_transaction();
-		assert(spi_trans);
 
 		/* Free any tx buffer, data is not relevant anymore */
 		spi_buffer_tx_free((void *)spi_trans->tx_buffer);
@@ -716,6 +1132,8 @@ static interface_handle_t * esp_spi_init(void)
 
 	spi_tx_queue[PRIO_Q_OTHERS] = xQueueCreate(SPI_TX_WIFI_QUEUE_SIZE, sizeof(interface_buffer_handle_t));
 	assert(spi_tx_queue[PRIO_Q_OTHERS]);
+	spi_tx_queue[PRIO_Q_DATA_HI] = xQueueCreate(SPI_TX_WIFI_HI_QUEUE_SIZE, sizeof(interface_buffer_handle_t));
+	assert(spi_tx_queue[PRIO_Q_DATA_HI]);
 	spi_tx_queue[PRIO_Q_BT] = xQueueCreate(SPI_TX_BT_QUEUE_SIZE, sizeof(interface_buffer_handle_t));
 	assert(spi_tx_queue[PRIO_Q_BT]);
 	spi_tx_queue[PRIO_Q_SERIAL] = xQueueCreate(SPI_TX_SERIAL_QUEUE_SIZE, sizeof(interface_buffer_handle_t));
@@ -731,6 +1149,8 @@ static interface_handle_t * esp_spi_init(void)
 
 	spi_rx_queue[PRIO_Q_OTHERS] = xQueueCreate(SPI_RX_WIFI_QUEUE_SIZE, sizeof(interface_buffer_handle_t));
 	assert(spi_rx_queue[PRIO_Q_OTHERS]);
+	spi_rx_queue[PRIO_Q_DATA_HI] = xQueueCreate(SPI_RX_WIFI_HI_QUEUE_SIZE, sizeof(interface_buffer_handle_t));
+	assert(spi_rx_queue[PRIO_Q_DATA_HI]);
 	spi_rx_queue[PRIO_Q_BT] = xQueueCreate(SPI_RX_BT_QUEUE_SIZE, sizeof(interface_buffer_handle_t));
 	assert(spi_rx_queue[PRIO_Q_BT]);
 	spi_rx_queue[PRIO_Q_SERIAL] = xQueueCreate(SPI_RX_SERIAL_QUEUE_SIZE, sizeof(interface_buffer_handle_t));
@@ -808,17 +1228,12 @@ static int32_t esp_spi_write(interface_handle_t *handle, interface_buffer_handle
 
 
 #if CONFIG_ESP_SPI_CHECKSUM
-	header->checksum = htole16(compute_checksum(tx_buf_handle.payload,
-				offset+buf_handle->payload_len));
+	set_frame_checksum(tx_buf_handle.payload, offset+buf_handle->payload_len);
 #endif
 
 #ifdef CONFIG_ESP_ENABLE_TX_PRIORITY_QUEUES
-	if (header->if_type == ESP_SERIAL_IF)
-		xQueueSend(spi_tx_queue[PRIO_Q_SERIAL], &tx_buf_handle, portMAX_DELAY);
-	else if (header->if_type == ESP_HCI_IF)
-		xQueueSend(spi_tx_queue[PRIO_Q_BT], &tx_buf_handle, portMAX_DELAY);
-	else
-		xQueueSend(spi_tx_queue[PRIO_Q_OTHERS], &tx_buf_handle, portMAX_DELAY);
+	xQueueSend(spi_tx_queue[ESP_PRIO_Q(header->if_type, header->flags)],
+			&tx_buf_handle, portMAX_DELAY);
 
 	xSemaphoreGive(spi_tx_sem);
 #else
@@ -848,12 +1263,22 @@ static int esp_spi_read(interface_handle_t *if_handle, interface_buffer_handle_t
 
 	if (pdFALSE == xQueueReceive(spi_rx_queue[PRIO_Q_SERIAL], buf_handle, 0))
 		if (pdFALSE == xQueueReceive(spi_rx_queue[PRIO_Q_BT], buf_handle, 0))
-			if (pdFALSE == xQueueReceive(spi_rx_queue[PRIO_Q_OTHERS], buf_handle, 0)) {
-				ESP_LOGI(TAG, "%s No element in rx queue", __func__);
-		return ESP_FAIL;
-	}
+			if (pdFALSE == xQueueReceive(spi_rx_queue[PRIO_Q_DATA_HI], buf_handle, 0))
+				if (pdFALSE == xQueueReceive(spi_rx_queue[PRIO_Q_OTHERS], buf_handle, 0)) {
+					ESP_LOGI(TAG, "%s No element in rx queue", __func__);
+					return ESP_FAIL;
+				}
+
+#if CONFIG_ESP_SPI_CREDITS
+	rx_credit_consumed(rx_credit_pool(buf_handle->if_type, buf_handle->flag),
+			spi_rx_queue[rx_credit_pool(buf_handle->if_type, buf_handle->flag)]);
+#endif
 #else
 	xQueueReceive(spi_rx_queue, buf_handle, portMAX_DELAY);
+
+#if CONFIG_ESP_SPI_CREDITS
+	rx_credit_consumed(0, spi_rx_queue);
+#endif
 #endif
 
 	return buf_handle->payload_len;
@@ -866,6 +1291,15 @@ static esp_err_t esp_spi_reset(interface_handle_t *handle)
 	if (ESP_OK != ret) {
 		ESP_LOGE(TAG, "spi slave bus free failed\n");
 	}
+
+#if CONFIG_ESP_SPI_VAR_LEN
+	/* Host starts again with full length transactions */
+	var_len_state = SPI_VAR_LEN_DISABLED;
+	if (var_len_tx_buf) {
+		spi_buffer_tx_free(var_len_tx_buf);
+		var_len_tx_buf = NULL;
+	}
+#endif
 	return ret;
 }
 
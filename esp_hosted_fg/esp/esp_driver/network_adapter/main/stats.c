@@ -16,11 +16,15 @@
 
 #include "stats.h"
 #include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
 #include "esp_log.h"
+#include "esp_timer.h"
+#include "interface.h"
 
-#if TEST_RAW_TP
 static const char TAG[] = "stats";
-#endif
+
+extern volatile uint8_t datapath;
 
 #ifdef CONFIG_FREERTOS_GENERATE_RUN_TIME_STATS
 /* These functions are only for debugging purpose
@@ -150,7 +154,6 @@ static void raw_tp_timer_func(void* arg)
 }
 
 #if TEST_RAW_TP__ESP_TO_HOST
-extern volatile uint8_t datapath;
 static void raw_tp_tx_task(void* pvParameters)
 {
 	int ret;
@@ -208,6 +211,161 @@ static void start_timer_to_display_raw_tp(void)
 
 #endif
 
+/* Raw throughput benchmark, driven by host. See esp_test_hdr in adapter.h.
+ * All commands are handled in rx path, DATA stream has own task */
+static uint8_t raw_tp_bench_buf[ESP_TEST_FRAME_LEN_MAX];
+static TaskHandle_t raw_tp_bench_task_handle;
+static SemaphoreHandle_t raw_tp_bench_done;
+static volatile uint8_t raw_tp_bench_stop;
+static uint16_t raw_tp_bench_frame_len;
+static uint32_t raw_tp_bench_duration_ms;
+static uint64_t raw_tp_bench_tx_frames;
+static uint64_t raw_tp_bench_tx_bytes;
+static uint64_t raw_tp_bench_rx_frames;
+static uint64_t raw_tp_bench_rx_bytes;
+
+static void raw_tp_bench_tx_task(void* pvParameters)
+{
+	interface_buffer_handle_t buf_handle = {0};
+	int64_t end_time = esp_timer_get_time() +
+		MSEC_TO_USEC((int64_t)raw_tp_bench_duration_ms);
+
+	while (!raw_tp_bench_stop && datapath && (esp_timer_get_time() < end_time)) {
+		memset(&buf_handle, 0, sizeof(buf_handle));
+		buf_handle.if_type = ESP_TEST_IF;
+		buf_handle.if_num = 0;
+		/* Same buffer for all frames, its content does not change */
+		buf_handle.payload = raw_tp_bench_buf;
+		buf_handle.payload_len = raw_tp_bench_frame_len;
+
+		if (send_to_host_queue(&buf_handle, PRIO_Q_OTHERS))
+			continue;
+
+		raw_tp_bench_tx_frames++;
+		raw_tp_bench_tx_bytes += raw_tp_bench_frame_len;
+	}
+
+	raw_tp_bench_task_handle = NULL;
+	xSemaphoreGive(raw_tp_bench_done);
+	vTaskDelete(NULL);
+}
+
+static void raw_tp_bench_stop_tx(void)
+{
+	if (!raw_tp_bench_task_handle)
+		return;
+
+	raw_tp_bench_stop = 1;
+	if (xSemaphoreTake(raw_tp_bench_done, pdMS_TO_TICKS(500)) != pdTRUE)
+		ESP_LOGW(TAG, "raw_tp tx task did not stop");
+}
+
+/* Sends copy of test frame, with new command */
+static void raw_tp_bench_reply(struct esp_test_hdr *test_hdr, uint16_t len, uint8_t cmd)
+{
+	interface_buffer_handle_t buf_handle = {0};
+	struct esp_test_hdr *reply = NULL;
+
+	reply = malloc(len);
+	if (!reply) {
+		ESP_LOGE(TAG, "Failed to allocate raw_tp reply");
+		return;
+	}
+
+	memcpy(reply, test_hdr, len);
+	reply->cmd = cmd;
+
+	buf_handle.if_type = ESP_TEST_IF;
+	buf_handle.if_num = 0;
+	buf_handle.payload = (uint8_t *) reply;
+	buf_handle.payload_len = len;
+	buf_handle.priv_buffer_handle = reply;
+	buf_handle.free_buf_handle = free;
+
+	if (send_to_host_queue(&buf_handle, PRIO_Q_OTHERS))
+		free(reply);
+}
+
+static void raw_tp_bench_start(struct esp_test_hdr *test_hdr)
+{
+	struct esp_test_hdr *data_hdr = (struct esp_test_hdr *) raw_tp_bench_buf;
+
+	raw_tp_bench_stop_tx();
+
+	raw_tp_bench_tx_frames = raw_tp_bench_tx_bytes = 0;
+	raw_tp_bench_rx_frames = raw_tp_bench_rx_bytes = 0;
+
+	raw_tp_bench_frame_len = le16toh(test_hdr->frame_len);
+	raw_tp_bench_duration_ms = le32toh(test_hdr->duration_ms);
+
+	ESP_LOGI(TAG, "raw_tp start: flags[0x%x] frame_len[%u] duration_ms[%u]",
+			test_hdr->flags, raw_tp_bench_frame_len,
+			(unsigned int)raw_tp_bench_duration_ms);
+
+	if (!(test_hdr->flags & ESP_TEST_START_ESP_TO_HOST))
+		return;
+
+	if ((raw_tp_bench_frame_len < sizeof(struct esp_test_hdr)) ||
+	    (raw_tp_bench_frame_len > ESP_TEST_FRAME_LEN_MAX)) {
+		ESP_LOGE(TAG, "Invalid raw_tp frame_len[%u]", raw_tp_bench_frame_len);
+		return;
+	}
+
+	if (!raw_tp_bench_done) {
+		raw_tp_bench_done = xSemaphoreCreateBinary();
+		assert(raw_tp_bench_done);
+	}
+	/* Given already, if last task ended by itself */
+	xSemaphoreTake(raw_tp_bench_done, 0);
+
+	memset(raw_tp_bench_buf, 0, sizeof(raw_tp_bench_buf));
+	data_hdr->magic = htole16(ESP_TEST_MAGIC);
+	data_hdr->cmd = ESP_TEST_CMD_DATA;
+
+	raw_tp_bench_stop = 0;
+	assert(xTaskCreate(raw_tp_bench_tx_task, "raw_tp_bench_tx_task",
+				CONFIG_ESP_DEFAULT_TASK_STACK_SIZE, NULL,
+				CONFIG_ESP_DEFAULT_TASK_PRIO, &raw_tp_bench_task_handle) == pdTRUE);
+}
+
+void debug_process_raw_tp_bench_pkt(uint8_t *payload, uint16_t payload_len)
+{
+	struct esp_test_hdr *test_hdr = (struct esp_test_hdr *) payload;
+
+	if ((payload_len < sizeof(struct esp_test_hdr)) ||
+	    (le16toh(test_hdr->magic) != ESP_TEST_MAGIC))
+		return;
+
+	switch (test_hdr->cmd) {
+	case ESP_TEST_CMD_DATA:
+		raw_tp_bench_rx_frames++;
+		raw_tp_bench_rx_bytes += payload_len;
+		break;
+
+	case ESP_TEST_CMD_START:
+		raw_tp_bench_start(test_hdr);
+		break;
+
+	case ESP_TEST_CMD_STOP:
+		/* Report is queued after last DATA frame */
+		raw_tp_bench_stop_tx();
+
+		test_hdr->tx_frames = htole64(raw_tp_bench_tx_frames);
+		test_hdr->tx_bytes = htole64(raw_tp_bench_tx_bytes);
+		test_hdr->rx_frames = htole64(raw_tp_bench_rx_frames);
+		test_hdr->rx_bytes = htole64(raw_tp_bench_rx_bytes);
+		raw_tp_bench_reply(test_hdr, sizeof(struct esp_test_hdr), ESP_TEST_CMD_REPORT);
+		break;
+
+	case ESP_TEST_CMD_PING:
+		raw_tp_bench_reply(test_hdr, payload_len, ESP_TEST_CMD_PONG);
+		break;
+
+	default:
+		break;
+	}
+}
+
 void create_debugging_tasks(void)
 {
 #ifdef CONFIG_FREERTOS_GENERATE_RUN_TIME_STATS
@@ -92,5 +92,6 @@ void debug_update_raw_tp_rx_count(uint16_t len);
 
 void create_debugging_tasks(void);
 uint8_t debug_get_raw_tp_conf(void);
+void debug_process_raw_tp_bench_pkt(uint8_t *payload, uint16_t payload_len);
 void debug_set_wifi_logging(void);
 #endif  /*__STATS__H__*/
@@ -8,28 +8,55 @@
 #ifndef __ESP_QUEUE_H__
 #define __ESP_QUEUE_H__
 
+#include <stddef.h>
+#include <stdint.h>
+
 #define ESP_QUEUE_SUCCESS               0
 #define ESP_QUEUE_ERR_UNINITALISED      -1
 #define ESP_QUEUE_ERR_MEMORY            -2
+#define ESP_QUEUE_ERR_FULL              -3
 
-typedef struct q_element {
-	void *buf;
-	int buf_len;
-} esp_queue_elem_t;
+#ifndef ESP_QUEUE_CACHE_LINE_SIZE
+#define ESP_QUEUE_CACHE_LINE_SIZE       64
+#endif
 
-/* Queue based on Linked List */
-typedef struct esp_queue_node {
+/* Queue based on bounded ring of pointers
+ *
+ * Any number of producers and consumers can use the queue concurrently.
+ * Ring positions are claimed with atomic increments, and each slot
+ * carries sequence number telling whether it is free or filled.
+ * Counting semaphores of free and filled slots make put and get
+ * non-blocking, blocking, or timed, as per timeout (in sec):
+ *   HOSTED_SEM_NON_BLOCKING : return right away if full or empty
+ *   HOSTED_SEM_BLOCKING     : wait till slot or element is available
+ *   > 0                     : wait for at most timeout seconds
+ * No memory is allocated after queue creation.
+ */
+typedef struct esp_queue_slot {
+	size_t seq;
 	void *data;
-	struct esp_queue_node* next;
-} q_node_t;
+} esp_queue_slot_t;
 
 typedef struct esp_queue {
-	q_node_t *front, *rear;
+	/* Consumer and producer positions are kept on separate cache lines */
+	size_t head;
+	uint8_t pad_head[ESP_QUEUE_CACHE_LINE_SIZE - sizeof(size_t)];
+	size_t tail;
+	uint8_t pad_tail[ESP_QUEUE_CACHE_LINE_SIZE - sizeof(size_t)];
+
+	esp_queue_slot_t *slots;
+	size_t mask;
+	void *free_sem;
+	void *used_sem;
 } esp_queue_t;
 
-esp_queue_t* create_esp_queue(void);
+/* Capacity is rounded up to power of 2 */
+esp_queue_t* create_esp_queue(uint32_t capacity);
 void *esp_queue_get(esp_queue_t* q);
+void *esp_queue_get_wait(esp_queue_t* q, int timeout);
 int esp_queue_put(esp_queue_t* q, void *data);
+int esp_queue_put_wait(esp_queue_t* q, void *data, int timeout);
+/* Elements left in queue are not freed */
 void esp_queue_destroy(esp_queue_t** q);
 
 #endif /*__ESP_QUEUE_H__*/
@@ -8,106 +8,134 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include "esp_queue.h"
+#include "platform_wrapper.h"
 
-/* create new node */
-static q_node_t * new_q_node(void *data)
-{
-	q_node_t* new_node = (q_node_t*)malloc(sizeof(q_node_t));
-	if (!new_node)
-		return NULL;
-	new_node->data = data;
-	new_node->next = NULL;
-	return new_node;
-}
+#define ESP_QUEUE_LOAD(x)               __atomic_load_n(&(x), __ATOMIC_ACQUIRE)
+#define ESP_QUEUE_STORE(x, v)           __atomic_store_n(&(x), (v), __ATOMIC_RELEASE)
+#define ESP_QUEUE_CLAIM(x)              __atomic_fetch_add(&(x), 1, __ATOMIC_RELAXED)
 
 /* Create app queue */
-esp_queue_t* create_esp_queue(void)
+esp_queue_t* create_esp_queue(uint32_t capacity)
 {
-	esp_queue_t* q = (esp_queue_t*)malloc(sizeof(esp_queue_t));
+	esp_queue_t* q = NULL;
+	size_t size = 1, i = 0;
+
+	if (!capacity) {
+		printf("Invalid queue capacity\n");
+		return NULL;
+	}
+
+	while (size < capacity)
+		size <<= 1;
+
+	q = (esp_queue_t*)hosted_calloc(1, sizeof(esp_queue_t));
 	if (!q)
 		return NULL;
 
-	q->front = q->rear = NULL;
+	q->slots = (esp_queue_slot_t*)hosted_calloc(size, sizeof(esp_queue_slot_t));
+	if (!q->slots)
+		goto free_q;
+
+	/* Slot i is free for position i */
+	for (i = 0; i < size; i++)
+		q->slots[i].seq = i;
+	q->mask = size - 1;
+
+	/* Created with all slots counted in, then drained for used_sem,
+	 * as semaphore may be created with max count as available */
+	q->free_sem = hosted_create_semaphore(size);
+	q->used_sem = hosted_create_semaphore(size);
+	if (!q->free_sem || !q->used_sem)
+		goto free_q;
+
+	while (!hosted_get_semaphore(q->used_sem, HOSTED_SEM_NON_BLOCKING))
+		;
+
 	return q;
+
+free_q:
+	printf("Failed to create queue\n");
+	esp_queue_destroy(&q);
+	return NULL;
 }
 
-/* Put element in app queue */
-int esp_queue_put(esp_queue_t* q, void *data)
+/* Put element in app queue, waiting for free slot as per timeout */
+int esp_queue_put_wait(esp_queue_t* q, void *data, int timeout)
 {
-	q_node_t* new_node = NULL;
+	esp_queue_slot_t *slot = NULL;
+	size_t pos = 0;
 
 	if (!q) {
 		printf("q undefined\n");
 		return ESP_QUEUE_ERR_UNINITALISED;
 	}
 
-	new_node = new_q_node(data);
-	if (!new_node) {
-		printf("malloc failed in qpp_q_put\n");
-		return ESP_QUEUE_ERR_MEMORY;
-	}
+	if (hosted_get_semaphore(q->free_sem, timeout))
+		return ESP_QUEUE_ERR_FULL;
 
-	/* queue empty condition */
-	if (q->rear == NULL) {
-		q->front = q->rear = new_node;
-		return ESP_QUEUE_SUCCESS;
-	}
+	/* Slot is reserved by free_sem. Its last consumer
+	 * may still be about to release it */
+	pos = ESP_QUEUE_CLAIM(q->tail);
+	slot = &q->slots[pos & q->mask];
+	while (ESP_QUEUE_LOAD(slot->seq) != pos)
+		hosted_thread_yield();
+
+	slot->data = data;
+	ESP_QUEUE_STORE(slot->seq, pos + 1);
 
-	q->rear->next = new_node;
-	q->rear = new_node;
+	hosted_post_semaphore(q->used_sem);
 	return ESP_QUEUE_SUCCESS;
 }
 
-/* Get element in app queue */
-void *esp_queue_get(esp_queue_t* q)
+int esp_queue_put(esp_queue_t* q, void *data)
 {
-	void * data = NULL;
-	q_node_t* temp = NULL;
-
-	if (!q || q->front == NULL)
-		return NULL;
+	return esp_queue_put_wait(q, data, HOSTED_SEM_NON_BLOCKING);
+}
 
-	/* move front one node ahead */
-	temp = q->front;
+/* Get element in app queue, waiting for it as per timeout */
+void *esp_queue_get_wait(esp_queue_t* q, int timeout)
+{
+	esp_queue_slot_t *slot = NULL;
+	void *data = NULL;
+	size_t pos = 0;
 
-	if (!temp)
+	if (!q)
 		return NULL;
 
-	q->front = q->front->next;
-
-	data = temp->data;
+	if (hosted_get_semaphore(q->used_sem, timeout))
+		return NULL;
 
-	free(temp);
-	temp = NULL;
+	/* Element is reserved by used_sem. Its producer
+	 * may still be about to publish it */
+	pos = ESP_QUEUE_CLAIM(q->head);
+	slot = &q->slots[pos & q->mask];
+	while (ESP_QUEUE_LOAD(slot->seq) != pos + 1)
+		hosted_thread_yield();
 
-	/* If front is NULL, change rear also as NULL */
-	if (q->front == NULL)
-		q->rear = NULL;
+	data = slot->data;
+	slot->data = NULL;
+	ESP_QUEUE_STORE(slot->seq, pos + q->mask + 1);
 
+	hosted_post_semaphore(q->free_sem);
 	return data;
 }
 
-void esp_queue_destroy(esp_queue_t** q)
+void *esp_queue_get(esp_queue_t* q)
 {
-	q_node_t* temp = NULL;
+	return esp_queue_get_wait(q, HOSTED_SEM_NON_BLOCKING);
+}
 
+void esp_queue_destroy(esp_queue_t** q)
+{
 	if (!q || !*q)
 		return;
 
-	while ((*q)->front) {
-
-		temp = (*q)->front;
-		(*q)->front = (*q)->front->next;
+	if ((*q)->free_sem)
+		hosted_destroy_semaphore((*q)->free_sem);
 
-		if (temp->data) {
-			free(temp->data);
-			temp->data = NULL;
-		}
-
-		free(temp);
-		temp = NULL;
-	}
+	if ((*q)->used_sem)
+		hosted_destroy_semaphore((*q)->used_sem);
 
-	free(*q);
-	*q = NULL;
+	mem_free((*q)->slots);
+	mem_free(*q);
 }
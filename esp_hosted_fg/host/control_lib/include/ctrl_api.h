@@ -28,9 +28,12 @@
 #define CALLBACK_NOT_REGISTERED              -1
 #define MSG_ID_OUT_OF_ORDER                  -2
 
-/* If request is already being served and
- * another request is pending, time period for
- * which new request will wait in seconds
+/* Requests which may be awaiting response at a time.
+ * Responses are matched to requests by uid */
+#define CTRL_MAX_PENDING_REQ                 8
+
+/* If CTRL_MAX_PENDING_REQ requests are already pending,
+ * time period for which new request will wait in seconds
  * */
 #define WAIT_TIME_B2B_CTRL_REQ               5
 #define DEFAULT_CTRL_RESP_TIMEOUT            30
@@ -463,9 +466,18 @@ typedef int (*ctrl_event_cb_t) (ctrl_cmd_t * event);
  *   1. allocated buffer within library are saved in `app_resp->free_buffer_handle`
  *   Please use `app_resp->free_buffer_func` for freeing them.
  *   2. Response `ctrl_cmd_t *app_resp` is also allocated from library,
- *   need to free using hosted_free() function.
+ *   need to free using free_ctrl_msg() function.
  **/
 
+/* Free control response or event
+ *
+ * Response and event `ctrl_cmd_t` passed to application are taken
+ * from pool within library, so these are to be returned using this
+ * function, rather than free(). Buffer in `free_buffer_handle` is
+ * to be freed before, using `free_buffer_func`
+ */
+void free_ctrl_msg(ctrl_cmd_t *app_msg);
+
 /* Set control event callback
  *
  * when user sets event callback, user provided function pointer
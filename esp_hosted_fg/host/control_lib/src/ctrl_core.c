@@ -50,7 +50,8 @@
         app_msg->free_buffer_handle = NULL;                                   \
       }                                                                       \
     }                                                                         \
-    mem_free(app_msg);                                                        \
+    free_ctrl_msg(app_msg);                                                   \
+    app_msg = NULL;                                                           \
   }                                                                           \
 } while(0);
 
@@ -89,41 +90,81 @@ struct ctrl_lib_context {
 	int state;
 };
 
-typedef void (*ctrl_rx_ind_t)(void);
+/* Control request awaiting its response
+ * 1. Asynchronous request: response, or timeout of `timer_handle`,
+ *    is passed to `resp_cb`
+ * 2. Synchronous request: response is stored in `resp`, and
+ *    requesting thread waiting on `wait_sem` is woken up.
+ *    On timeout of `timer_handle`, it is woken up without `resp`
+ */
+struct ctrl_pending_req {
+	uint8_t in_use;
+	int32_t uid;
+	int resp_msg_id;
+	ctrl_resp_cb_t resp_cb;
+	void * timer_handle;
+	void * wait_sem;
+	ctrl_cmd_t *resp;
+};
 
-esp_queue_t* ctrl_msg_Q = NULL;
 static void * ctrl_rx_thread_handle;
-static void * read_sem;
+/* Counts free entries of pending_reqs */
 static void * ctrl_req_sem;
-static void * async_timer_handle;
+/* Protects pending_reqs and uid */
+static void * pending_req_lock;
+static struct ctrl_pending_req pending_reqs[CTRL_MAX_PENDING_REQ];
 static struct ctrl_lib_context ctrl_lib_ctxt;
 
+/* Received control msg is unpacked in ctrl_rx_arena, which is reset
+ * for every msg, as app structs keep copy of what they need.
+ * Msg not fitting in arena falls back to heap */
+#ifndef CTRL_RX_ARENA_SIZE
+#define CTRL_RX_ARENA_SIZE           (16 * 1024)
+#endif
+#define CTRL_RX_ARENA_ALIGN(x)       (((x) + sizeof(uint64_t) - 1) & \
+                                      ~(sizeof(uint64_t) - 1))
+
+static uint64_t ctrl_rx_arena[CTRL_RX_ARENA_SIZE / sizeof(uint64_t)];
+static size_t ctrl_rx_arena_used;
+
+static void * ctrl_rx_arena_alloc(void *allocator_data, size_t size);
+static void ctrl_rx_arena_free(void *allocator_data, void *ptr);
+
+static ProtobufCAllocator ctrl_rx_allocator = {
+	.alloc = ctrl_rx_arena_alloc,
+	.free = ctrl_rx_arena_free,
+	.allocator_data = NULL,
+};
+
+/* Responses and events passed to application are taken from
+ * ctrl_msg_pool, and returned to it in free_ctrl_msg().
+ * Free entries are kept in ctrl_msg_pool_q, which is lock free,
+ * as entries are freed from application threads.
+ * Heap is used once pool runs out */
+#ifndef CTRL_MSG_POOL_SIZE
+#define CTRL_MSG_POOL_SIZE           (2 * CTRL_MAX_PENDING_REQ)
+#endif
+
+static ctrl_cmd_t ctrl_msg_pool[CTRL_MSG_POOL_SIZE];
+/* NULL while lib is not initialised */
+static esp_queue_t * ctrl_msg_pool_q;
+
+/* Pool entry ownership. Entry is put in ctrl_msg_pool_q only by the one
+ * moving it from CTRL_MSG_IDLE to CTRL_MSG_QUEUED, so that entry held by
+ * application across deinit and re-init is not queued twice */
+enum {
+	CTRL_MSG_IDLE,
+	CTRL_MSG_QUEUED,
+	CTRL_MSG_IN_USE,
+};
+static uint8_t ctrl_msg_pool_state[CTRL_MSG_POOL_SIZE];
+
 static int call_event_callback(ctrl_cmd_t *app_event);
-static int is_async_resp_callback_registered_by_resp_msg_id(int resp_msg_id);
-static int call_async_resp_callback(ctrl_cmd_t *app_resp);
 
 /* uid to link between requests and responses
  * uids are incrementing values from 1 onwards. */
 static int32_t uid = 0;
 
-/* expected uid in response
- * -1 means not a valid id
- *  0 means slave fw was not updated to support UIDs */
-static int32_t expected_resp_uid = -1;
-
-/* Control response callbacks
- * These will be updated per control request received
- * 1. If application wants to use synchrounous, i.e. Wait till the response received
- *    after current control request is sent or timeout occurs,
- *    application will pass this callback in request as NULL.
- * 2. If application wants to use `asynchrounous`, i.e. Just send the request and
- *    unblock for next processing, application will assign function pointer in
- *    control request, which will be registered here.
- *    When the response comes, the this registered callback function will be called
- *    with input as response
- */
-static ctrl_resp_cb_t ctrl_resp_cb_table [CTRL_RESP_MAX - CTRL_RESP_BASE] = { NULL };
-
 /* Control event callbacks
  * These will be updated when user registers event callback
  * using `set_event_callback` API
@@ -329,12 +370,12 @@ static int ctrl_app_parse_event(CtrlMsg *ctrl_msg, ctrl_cmd_t *app_ntfy)
 		}
 	}
 
-	ctrl_msg__free_unpacked(ctrl_msg, NULL);
+	ctrl_msg__free_unpacked(ctrl_msg, &ctrl_rx_allocator);
 	ctrl_msg = NULL;
 	return SUCCESS;
 
 fail_parse_ctrl_msg:
-	ctrl_msg__free_unpacked(ctrl_msg, NULL);
+	ctrl_msg__free_unpacked(ctrl_msg, &ctrl_rx_allocator);
 	ctrl_msg = NULL;
 	app_ntfy->resp_event_status = FAILURE;
 	return FAILURE;
@@ -359,12 +400,6 @@ static int ctrl_app_parse_resp(CtrlMsg *ctrl_msg, ctrl_cmd_t *app_resp)
 	app_resp->msg_id = ctrl_msg->msg_id;
 	app_resp->uid = ctrl_msg->uid;
 	app_resp->resp_event_status = FAILURE;
-	/* if app_resp->uid is 0, slave fw is not updated to return uid
-	 * so we skip this check */
-	if (app_resp->uid && (expected_resp_uid != app_resp->uid)) {
-		// response uid mis-match: ignore this response
-		goto fail_parse_ctrl_msg2;
-	}
 
 	/* 3. parse CtrlMsg into ctrl_cmd_t */
 	switch (ctrl_msg->msg_id) {
@@ -683,30 +718,178 @@ static int ctrl_app_parse_resp(CtrlMsg *ctrl_msg, ctrl_cmd_t *app_resp)
 	}
 
 	/* 4. Free up buffers */
-	ctrl_msg__free_unpacked(ctrl_msg, NULL);
+	ctrl_msg__free_unpacked(ctrl_msg, &ctrl_rx_allocator);
 	ctrl_msg = NULL;
-	expected_resp_uid = -1;
 	return SUCCESS;
 
 	/* 5. Free up buffers in failure cases */
 fail_parse_ctrl_msg:
-	ctrl_msg__free_unpacked(ctrl_msg, NULL);
+	ctrl_msg__free_unpacked(ctrl_msg, &ctrl_rx_allocator);
 	ctrl_msg = NULL;
-	expected_resp_uid = -1;
 	return SUCCESS;
 	/* intended fall-through */
 
 fail_parse_ctrl_msg2:
-	ctrl_msg__free_unpacked(ctrl_msg, NULL);
+	ctrl_msg__free_unpacked(ctrl_msg, &ctrl_rx_allocator);
 	ctrl_msg = NULL;
-	expected_resp_uid = -1;
 	return FAILURE;
 }
 
-/* Control path RX indication */
-static void ctrl_rx_ind(void)
+/* Add request to pending requests, with new uid
+ * Caller holds pending_req_lock. As ctrl_req_sem is taken before,
+ * free entry is expected */
+static struct ctrl_pending_req * add_pending_req(ctrl_cmd_t *app_req)
+{
+	struct ctrl_pending_req *pending = NULL;
+	int i = 0;
+
+	for (i = 0; i < CTRL_MAX_PENDING_REQ; i++) {
+		if (!pending_reqs[i].in_use) {
+			pending = &pending_reqs[i];
+			break;
+		}
+	}
+
+	if (!pending)
+		return NULL;
+
+	// handle rollover in uid value (range: 1 to INT32_MAX)
+	if (uid < INT32_MAX)
+		uid++;
+	else
+		uid = 1;
+	app_req->uid = uid;
+
+	/* Drop wakeup left by response which came after timeout */
+	while (!hosted_get_semaphore(pending->wait_sem, HOSTED_SEM_NON_BLOCKING))
+		;
+
+	pending->in_use = 1;
+	pending->uid = uid;
+	pending->resp_msg_id = app_req->msg_id - CTRL_REQ_BASE + CTRL_RESP_BASE;
+	pending->resp_cb = app_req->ctrl_resp_cb;
+	pending->timer_handle = NULL;
+	pending->resp = NULL;
+
+	return pending;
+}
+
+/* Find pending request of response. Caller holds pending_req_lock
+ * uid 0 is from slave fw not updated to return uid. It is matched with
+ * oldest pending request of same msg id */
+static struct ctrl_pending_req * find_pending_req(int32_t resp_uid, int resp_msg_id)
+{
+	struct ctrl_pending_req *pending = NULL;
+	int i = 0;
+
+	for (i = 0; i < CTRL_MAX_PENDING_REQ; i++) {
+		if (!pending_reqs[i].in_use)
+			continue;
+
+		if (resp_uid) {
+			if (pending_reqs[i].uid == resp_uid)
+				return &pending_reqs[i];
+		} else if ((pending_reqs[i].resp_msg_id == resp_msg_id) &&
+		           (!pending || (pending_reqs[i].uid < pending->uid))) {
+			pending = &pending_reqs[i];
+		}
+	}
+
+	return pending;
+}
+
+/* Remove pending request and return its entry to ctrl_req_sem
+ * Caller holds pending_req_lock */
+static void remove_pending_req(struct ctrl_pending_req *pending)
+{
+	pending->in_use = 0;
+	pending->uid = 0;
+	pending->resp_cb = NULL;
+	pending->timer_handle = NULL;
+	pending->resp = NULL;
+	hosted_post_semaphore(ctrl_req_sem);
+}
+
+static void * ctrl_rx_arena_alloc(void *allocator_data, size_t size)
+{
+	void *ptr = NULL;
+
+	size = CTRL_RX_ARENA_ALIGN(size);
+	if (size > sizeof(ctrl_rx_arena) - ctrl_rx_arena_used)
+		return hosted_malloc(size);
+
+	ptr = (uint8_t *)ctrl_rx_arena + ctrl_rx_arena_used;
+	ctrl_rx_arena_used += size;
+	return ptr;
+}
+
+/* Arena memory is freed all at once, by ctrl_rx_arena_reset */
+static void ctrl_rx_arena_free(void *allocator_data, void *ptr)
+{
+	if (((uint8_t *)ptr >= (uint8_t *)ctrl_rx_arena) &&
+	    ((uint8_t *)ptr < (uint8_t *)ctrl_rx_arena + sizeof(ctrl_rx_arena)))
+		return;
+
+	mem_free(ptr);
+}
+
+static void ctrl_rx_arena_reset(void)
+{
+	ctrl_rx_arena_used = 0;
+}
+
+/* Returns true if pool entry moved from state 'from' to 'to' */
+static int ctrl_msg_pool_move(int idx, uint8_t from, uint8_t to)
+{
+	return __atomic_compare_exchange_n(&ctrl_msg_pool_state[idx], &from, to,
+			0, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED);
+}
+
+/* Queue idle pool entry, if lib is initialised */
+static void ctrl_msg_pool_put(int idx)
+{
+	if (!ctrl_msg_pool_q)
+		return;
+
+	if (!ctrl_msg_pool_move(idx, CTRL_MSG_IDLE, CTRL_MSG_QUEUED))
+		return;
+
+	if (esp_queue_put(ctrl_msg_pool_q, &ctrl_msg_pool[idx]))
+		__atomic_store_n(&ctrl_msg_pool_state[idx], CTRL_MSG_IDLE, __ATOMIC_RELEASE);
+}
+
+/* Zeroed ctrl_cmd_t, from ctrl_msg_pool if available */
+static ctrl_cmd_t * alloc_ctrl_msg(void)
+{
+	ctrl_cmd_t *app_msg = NULL;
+
+	app_msg = (ctrl_cmd_t *)esp_queue_get(ctrl_msg_pool_q);
+	if (!app_msg)
+		return (ctrl_cmd_t *)hosted_calloc(1, sizeof(ctrl_cmd_t));
+
+	__atomic_store_n(&ctrl_msg_pool_state[app_msg - ctrl_msg_pool],
+			CTRL_MSG_IN_USE, __ATOMIC_RELEASE);
+	memset(app_msg, 0, sizeof(ctrl_cmd_t));
+	return app_msg;
+}
+
+void free_ctrl_msg(ctrl_cmd_t *app_msg)
 {
-	hosted_post_semaphore(read_sem);
+	if (!app_msg)
+		return;
+
+	if ((app_msg < ctrl_msg_pool) ||
+	    (app_msg >= ctrl_msg_pool + CTRL_MSG_POOL_SIZE)) {
+		mem_free(app_msg);
+		return;
+	}
+
+	/* Not in use, as freed twice */
+	if (!ctrl_msg_pool_move(app_msg - ctrl_msg_pool, CTRL_MSG_IN_USE, CTRL_MSG_IDLE))
+		return;
+
+	/* Pool is refilled on init, if freed after deinit */
+	ctrl_msg_pool_put(app_msg - ctrl_msg_pool);
 }
 
 /* Returns CALLBACK_AVAILABLE if a non NULL control event
@@ -732,11 +915,14 @@ static int is_event_callback_registered(int event)
 
 
 /* Process control msg (response or event) received from ESP32 */
-static int process_ctrl_rx_msg(CtrlMsg * proto_msg, ctrl_rx_ind_t ctrl_rx_func)
+static int process_ctrl_rx_msg(CtrlMsg * proto_msg)
 {
-	esp_queue_elem_t *elem = NULL;
+	struct ctrl_pending_req *pending = NULL;
+	ctrl_resp_cb_t resp_cb = NULL;
+	void *timer_handle = NULL;
 	ctrl_cmd_t *app_resp = NULL;
 	ctrl_cmd_t *app_event = NULL;
+	int32_t resp_uid = 0;
 
 	/* 1. Check if valid proto msg */
 	if (!proto_msg) {
@@ -757,12 +943,11 @@ static int process_ctrl_rx_msg(CtrlMsg * proto_msg, ctrl_rx_ind_t ctrl_rx_func)
 			 **/
 
 			/* Allocate app struct for event */
-			app_event = (ctrl_cmd_t *)hosted_malloc(sizeof(ctrl_cmd_t));
+			app_event = alloc_ctrl_msg();
 			if (!app_event) {
 				printf("Failed to allocate app_event\n");
 				goto free_buffers;
 			}
-			memset(app_event, 0, sizeof(ctrl_cmd_t));
 
 			/* Decode protobuf buffer of event and
 			 * copy into app structures */
@@ -780,79 +965,70 @@ static int process_ctrl_rx_msg(CtrlMsg * proto_msg, ctrl_rx_ind_t ctrl_rx_func)
 	/* 3. Check if it is response msg */
 	} else if (proto_msg->msg_type == CTRL_MSG_TYPE__Resp) {
 
-		/* Ctrl responses are handled asynchronously and
-		 * asynchronpusly */
+		/* Ctrl responses are handled synchronously and
+		 * asynchronously, as per their request */
+
+		/* Response to request which timed out, or was never sent,
+		 * is dropped */
+		hosted_get_semaphore(pending_req_lock, HOSTED_SEM_BLOCKING);
+		pending = find_pending_req(proto_msg->uid, proto_msg->msg_id);
+		if (pending)
+			resp_uid = pending->uid;
+		hosted_post_semaphore(pending_req_lock);
+
+		if (!pending) {
+			printf("Drop resp[%u] of uid[%d], no request pending\n",
+					proto_msg->msg_id, (int)proto_msg->uid);
+			goto free_buffers;
+		}
 
 		/* Allocate app struct for response */
-		app_resp = (ctrl_cmd_t *)hosted_malloc(sizeof(ctrl_cmd_t));
+		app_resp = alloc_ctrl_msg();
 		if (!app_resp) {
 			printf("Failed to allocate app_resp\n");
 			goto free_buffers;
 		}
-		memset(app_resp, 0, sizeof(ctrl_cmd_t));
-
-		/* If this was async procedure, timer would have
-		 * been running for response.
-		 * As response received, stop timer */
-		if (async_timer_handle) {
-			/* async_timer_handle will be cleaned in hosted_timer_stop */
-			hosted_timer_stop(async_timer_handle);
-			async_timer_handle = NULL;
-		}
 
 		/* Decode protobuf buffer of response and
 		 * copy into app structures */
 		if (ctrl_app_parse_resp(proto_msg, app_resp)) {
 			// failed to parse response into app_resp
-			if (app_resp)
-				mem_free(app_resp);
+			free_ctrl_msg(app_resp);
 			return FAILURE;
 		}
+		app_resp->uid = resp_uid;
 
-		/* Is callback is available,
-		 * progress as async response */
-		if (CALLBACK_AVAILABLE ==
-			is_async_resp_callback_registered_by_resp_msg_id(app_resp->msg_id)) {
+		/* Request may have timed out meanwhile */
+		hosted_get_semaphore(pending_req_lock, HOSTED_SEM_BLOCKING);
+		if (!pending->in_use || (pending->uid != resp_uid)) {
+			hosted_post_semaphore(pending_req_lock);
+			free_ctrl_msg(app_resp);
+			return FAILURE;
+		}
 
-			/* User registered control async response callback
-			 * function is available for this proto_msg,
-			 * so call to that function should be done and
-			 * return to select
-			 */
-			call_async_resp_callback(app_resp);
+		if (pending->resp_cb) {
+			/* Asynchronous request: stop its response timer,
+			 * and pass response to callback */
+			resp_cb = pending->resp_cb;
+			timer_handle = pending->timer_handle;
+			remove_pending_req(pending);
+			hosted_post_semaphore(pending_req_lock);
 
-			//CLEANUP_APP_MSG(app_resp);
+			/* timer_handle will be cleaned in hosted_timer_stop */
+			if (timer_handle)
+				hosted_timer_stop(timer_handle);
 
+			resp_cb(app_resp);
+			//CLEANUP_APP_MSG(app_resp);
 		} else {
-
-			/* as control async response callback function is
-			 * NOT available/registered, treat this response as
-			 * synchronous response. forward this response to app
-			 * using 'esp_queue' and help of semaphore
-			 **/
-
-			elem = (esp_queue_elem_t*)hosted_malloc(sizeof(esp_queue_elem_t));
-			if (!elem) {
-				printf("%s %u: Malloc failed\n",__func__,__LINE__);
-				goto free_buffers;
-			}
-
-			/* User is RESPONSIBLE to free memory from
-			 * app_resp in case of async callbacks NOT provided
-			 * to free memory, please refer CLEANUP_APP_MSG macro
-			 **/
-			elem->buf = app_resp;
-			elem->buf_len = sizeof(ctrl_cmd_t);
-			if (esp_queue_put(ctrl_msg_Q, (void*)elem)) {
-				printf("%s %u: ctrl Q put fail\n",__func__,__LINE__);
-				goto free_buffers;
-			}
-
-			/* Call up rx ind to unblock user */
-			if (ctrl_rx_func)
-				ctrl_rx_func();
+			/* Synchronous request: waiter takes response and
+			 * removes pending request.
+			 * User is RESPONSIBLE to free memory from app_resp,
+			 * please refer CLEANUP_APP_MSG macro */
+			pending->resp = app_resp;
+			hosted_post_semaphore(pending_req_lock);
+			hosted_post_semaphore(pending->wait_sem);
 		}
-		hosted_post_semaphore(ctrl_req_sem);
 
 	} else {
 		/* 4. some unsupported msg, drop it */
@@ -863,10 +1039,9 @@ static int process_ctrl_rx_msg(CtrlMsg * proto_msg, ctrl_rx_ind_t ctrl_rx_func)
 
 	/* 5. cleanup */
 free_buffers:
-	mem_free(elem);
-	mem_free(app_event);
+	free_ctrl_msg(app_event);
 	if (proto_msg) {
-		ctrl_msg__free_unpacked(proto_msg, NULL);
+		ctrl_msg__free_unpacked(proto_msg, &ctrl_rx_allocator);
 		proto_msg = NULL;
 	}
 	return FAILURE;
@@ -878,29 +1053,12 @@ static void ctrl_rx_thread(void const *arg)
 {
 	uint32_t buf_len = 0;
 
-	ctrl_rx_ind_t ctrl_rx_func;
-	ctrl_rx_func = (ctrl_rx_ind_t) arg;
-
-	/* 1. Get callback for synchronous procedure
-	 * for semaphore post */
-	if (!ctrl_rx_func) {
-		printf("ERROR: NULL rx async cb for esp_queue,sem\n");
-		return;
-	}
-
-	/* 2. This queue should already be created
-	 * if NULL, exit here */
-	if (!ctrl_msg_Q) {
-		printf("Ctrl msg Q is not created\n");
-		return;
-	}
-
-	/* 3. Infinite loop to process incoming msg on serial interface */
+	/* 1. Infinite loop to process incoming msg on serial interface */
 	while (1) {
 		uint8_t *buf = NULL;
 		CtrlMsg *resp = NULL;
 
-		/* 3.1 Block on read of protobuf encoded msg */
+		/* 1.1 Block on read of protobuf encoded msg */
 		if (is_ctrl_lib_state(CTRL_LIB_STATE_INACTIVE)) {
 			sleep(1);
 			continue;
@@ -912,23 +1070,25 @@ static void ctrl_rx_thread(void const *arg)
 			goto free_bufs;
 		}
 
-		/* 3.2 Decode protobuf */
-		resp = ctrl_msg__unpack(NULL, buf_len, buf);
+		/* 1.2 Decode protobuf */
+		ctrl_rx_arena_reset();
+		resp = ctrl_msg__unpack(&ctrl_rx_allocator, buf_len, buf);
 		if (!resp) {
 			goto free_bufs;
 		}
-		/* 3.3 Free the read buffer */
-		mem_free(buf);
+		/* 1.3 Release the read buffer */
+		transport_pserial_read_done(buf);
 
-		/* 3.4 Send for further processing as event or response */
-		process_ctrl_rx_msg(resp, ctrl_rx_func);
+		/* 1.4 Send for further processing as event or response */
+		process_ctrl_rx_msg(resp);
 		continue;
 
-		/* 4. cleanup */
+		/* 2. cleanup */
 free_bufs:
-		mem_free(buf);
+		if (buf)
+			transport_pserial_read_done(buf);
 		if (resp) {
-			ctrl_msg__free_unpacked(resp, NULL);
+			ctrl_msg__free_unpacked(resp, &ctrl_rx_allocator);
 			resp = NULL;
 		}
 	}
@@ -938,7 +1098,7 @@ free_bufs:
 /* create new thread for control RX path handling */
 static int spawn_ctrl_rx_thread(void)
 {
-	ctrl_rx_thread_handle = hosted_thread_create(ctrl_rx_thread, ctrl_rx_ind);
+	ctrl_rx_thread_handle = hosted_thread_create(ctrl_rx_thread, NULL);
 	if (!ctrl_rx_thread_handle) {
 		printf("Thread creation failed for ctrl_rx_thread\n");
 		return FAILURE;
@@ -960,80 +1120,6 @@ static int cancel_ctrl_rx_thread(void)
 
 
 
-/* This function will be only invoked in synchrounous control response path,
- * i.e. if control response callbcak is not available i.e. NULL
- * This function is called after sending synchrounous control request to wait
- * for the response using semaphores and esp_queue
- **/
-static ctrl_cmd_t * get_response(int *read_len, int timeout_sec)
-{
-	void * data = NULL;
-	uint8_t * buf = NULL;
-	esp_queue_elem_t *elem = NULL;
-	int ret = 0;
-
-	/* 1. Any problems in response, return NULL */
-	if (!read_len) {
-		printf("Invalid input parameter\n");
-		return NULL;
-	}
-
-	/* 2. If timeout not specified, use default */
-	if (!timeout_sec)
-		timeout_sec = DEFAULT_CTRL_RESP_TIMEOUT;
-
-	/* 3. Wait for response */
-	ret = hosted_get_semaphore(read_sem, timeout_sec);
-	if (ret) {
-		if (errno == ETIMEDOUT)
-			printf("Control response timed out after %u sec\n", timeout_sec);
-		else
-			printf("ctrl lib error[%u] in sem of timeout[%u]\n", errno, timeout_sec);
-		/* Unlock semaphore in negative case */
-		hosted_post_semaphore(ctrl_req_sem);
-		return NULL;
-	}
-
-	/* 4. Fetch response from `esp_queue` */
-	data = esp_queue_get(ctrl_msg_Q);
-	if (data) {
-		elem = (esp_queue_elem_t*)data;
-		if (!elem)
-			return NULL;
-
-		*read_len = elem->buf_len;
-		buf = elem->buf;
-		mem_free(elem);
-		/* Free queue element and return the rx data */
-		return (ctrl_cmd_t*)buf;
-
-	} else {
-		printf("Ctrl Q empty or uninitialised\n");
-		return NULL;
-	}
-
-	return NULL;
-}
-
-/* Check and call control response asynchronous callback if available
- * else flag error
- *     MSG_ID_OUT_OF_ORDER - if response id is not understandable
- *     CALLBACK_NOT_REGISTERED - callback is not registered
- **/
-static int call_async_resp_callback(ctrl_cmd_t *app_resp)
-{
-	if ((app_resp->msg_id <= CTRL_RESP_BASE) ||
-	    (app_resp->msg_id >= CTRL_RESP_MAX)) {
-		return MSG_ID_OUT_OF_ORDER;
-	}
-
-	if (ctrl_resp_cb_table[app_resp->msg_id-CTRL_RESP_BASE]) {
-		return ctrl_resp_cb_table[app_resp->msg_id-CTRL_RESP_BASE](app_resp);
-	}
-
-	return CALLBACK_NOT_REGISTERED;
-}
-
 /* Check and call control event asynchronous callback if available
  * else flag error
  *     MSG_ID_OUT_OF_ORDER - if event id is not understandable
@@ -1053,48 +1139,9 @@ static int call_event_callback(ctrl_cmd_t *app_event)
 	return CALLBACK_NOT_REGISTERED;
 }
 
-/* Set asynchronous control response callback from control **request**
- * In case of synchronous request, `resp_cb` will be NULL and table
- * `ctrl_resp_cb_table` will be updated with NULL
- * In case of asynchronous request, valid callback will be cached
- **/
-static int set_async_resp_callback(int req_msg_id, ctrl_resp_cb_t resp_cb)
-{
-	/* Assign(Replace) response callback passed */
-	int exp_resp_msg_id = (req_msg_id - CTRL_REQ_BASE + CTRL_RESP_BASE);
-	if (exp_resp_msg_id >= CTRL_RESP_MAX) {
-		printf("Not able to map new request to resp id\n");
-		return MSG_ID_OUT_OF_ORDER;
-	} else {
-		ctrl_resp_cb_table[exp_resp_msg_id-CTRL_RESP_BASE] = resp_cb;
-		return CALLBACK_SET_SUCCESS;
-	}
-}
-
-/* Set asynchronous control response callback from control **response**
- * In case of synchronous request, `resp_cb` will be NULL and table
- * `ctrl_resp_cb_table` will be updated with NULL
- * In case of asynchronous request, valid callback will be cached
- **/
-static int is_async_resp_callback_registered_by_resp_msg_id(int resp_msg_id)
-{
-	if ((resp_msg_id <= CTRL_RESP_BASE) || (resp_msg_id >= CTRL_RESP_MAX)) {
-		printf("resp id[%u] out of range\n", resp_msg_id);
-		return MSG_ID_OUT_OF_ORDER;
-	}
-
-	if (ctrl_resp_cb_table[resp_msg_id-CTRL_RESP_BASE]) {
-		return CALLBACK_AVAILABLE;
-	}
-
-	return CALLBACK_NOT_REGISTERED;
-}
-
-
-
 /* Check if async control response callback is available
  * Returns CALLBACK_AVAILABLE if a non NULL asynchrounous control response
- * callback is available. It will return failure -
+ * callback is passed in request. It will return failure -
  *     MSG_ID_OUT_OF_ORDER - if request msg id is unsupported
  *     CALLBACK_NOT_REGISTERED - if aync callback is not available
  **/
@@ -1106,7 +1153,7 @@ int is_async_resp_callback_registered(ctrl_cmd_t req)
 		return MSG_ID_OUT_OF_ORDER;
 	}
 
-	if (ctrl_resp_cb_table[exp_resp_msg_id-CTRL_RESP_BASE]) {
+	if (req.ctrl_resp_cb) {
 		return CALLBACK_AVAILABLE;
 	}
 
@@ -1140,75 +1187,109 @@ int reset_event_callback(int event)
 
 /* This is only used in synchrounous control path
  * When request is sent without async callback, this function will be called
- * It will wait for control response or timeout for control response
+ * It will wait for control response of this request (by uid) or timeout
+ * Requests of other threads are served meanwhile
  **/
 ctrl_cmd_t * ctrl_wait_and_parse_sync_resp(ctrl_cmd_t *app_req)
 {
-	ctrl_cmd_t * rx_buf = NULL;
-	int rx_buf_len = 0;
-
-	rx_buf = get_response(&rx_buf_len, app_req->cmd_timeout_sec);
-	if (!rx_buf || !rx_buf_len) {
-		printf("Response not received\n");
-		if (rx_buf) {
-			mem_free(rx_buf);
-		}
+	struct ctrl_pending_req *pending = NULL;
+	ctrl_cmd_t *rx_buf = NULL;
+	void *timer_handle = NULL;
+	int timeout_sec = app_req->cmd_timeout_sec;
+	int ret = 0;
+
+	/* 1. Find pending request */
+	hosted_get_semaphore(pending_req_lock, HOSTED_SEM_BLOCKING);
+	pending = find_pending_req(app_req->uid, 0);
+	hosted_post_semaphore(pending_req_lock);
+
+	if (!app_req->uid || !pending || pending->resp_cb) {
+		printf("No pending request of uid[%d]\n", (int)app_req->uid);
+		return NULL;
+	}
 
-		/* Response timeout
-		 * Reset the response uid to an invalid value as we no longer
-		 * expect a response until the next request
-		 * If a response arrives after this, it will be flagged
-		 * as an invalid response */
-		expected_resp_uid = -1;
+	/* 2. Wait for response, or for response timer to expire */
+	ret = hosted_get_semaphore(pending->wait_sem, HOSTED_SEM_BLOCKING);
+	if (ret)
+		printf("ctrl lib error[%u] in sem of uid[%d]\n", errno, (int)app_req->uid);
+
+	/* 3. Take response, if any, and remove request
+	 * If a response arrives after this, it will be dropped */
+	hosted_get_semaphore(pending_req_lock, HOSTED_SEM_BLOCKING);
+	if (pending->in_use && (pending->uid == app_req->uid)) {
+		rx_buf = pending->resp;
+		timer_handle = pending->timer_handle;
+		remove_pending_req(pending);
 	}
+	hosted_post_semaphore(pending_req_lock);
+
+	/* timer_handle will be cleaned in hosted_timer_stop */
+	if (timer_handle)
+		hosted_timer_stop(timer_handle);
+
+	if (!rx_buf)
+		printf("Control response timed out after %u sec\n", timeout_sec);
+
 	return rx_buf;
 }
 
 
-/* This function is called for async procedure
- * Timer started when async control req is received
- * But there was no response in due time, this function will
- * be called to send error to application
+/* Timer started when control req is sent
+ * But there was no response in due time, this function will be called
+ * For sync procedure, it wakes up ctrl_wait_and_parse_sync_resp,
+ * which cleans up the request.
+ * For async procedure, it sends error to application
  * */
-static void ctrl_async_timeout_handler(void const *arg)
+static void ctrl_resp_timeout_handler(void const *arg)
 {
-	ctrl_resp_cb_t func = arg;
+	int32_t req_uid = (int32_t)(intptr_t)arg;
+	struct ctrl_pending_req *pending = NULL;
+	ctrl_resp_cb_t func = NULL;
+	void *timer_handle = NULL;
+	ctrl_cmd_t *app_resp = NULL;
+	int resp_msg_id = 0;
+
+	/* Response may have been received meanwhile */
+	hosted_get_semaphore(pending_req_lock, HOSTED_SEM_BLOCKING);
+	pending = find_pending_req(req_uid, 0);
+	if (!req_uid || !pending) {
+		hosted_post_semaphore(pending_req_lock);
+		return;
+	}
+
+	if (!pending->resp_cb) {
+		hosted_post_semaphore(pending_req_lock);
+		hosted_post_semaphore(pending->wait_sem);
+		return;
+	}
+
+	func = pending->resp_cb;
+	timer_handle = pending->timer_handle;
+	resp_msg_id = pending->resp_msg_id;
+	remove_pending_req(pending);
+	hosted_post_semaphore(pending_req_lock);
+
+	/* timer_handle will be cleaned in hosted_timer_stop */
+	if (timer_handle)
+		hosted_timer_stop(timer_handle);
+
 	if (!func) {
 		printf("NULL func, failed to call callback\n");
-		hosted_post_semaphore(ctrl_req_sem);
 		return;
 	}
-	ctrl_cmd_t *app_resp = NULL;
-	app_resp = (ctrl_cmd_t *)hosted_calloc(1, sizeof(ctrl_cmd_t));
+
+	app_resp = alloc_ctrl_msg();
 	if (!app_resp) {
 		printf("Failed to allocate app_resp\n");
-		hosted_post_semaphore(ctrl_req_sem);
 		return;
 	}
 	app_resp->msg_type = CTRL_RESP;
+	app_resp->msg_id = resp_msg_id;
+	app_resp->uid = req_uid;
 	app_resp->resp_event_status = CTRL_ERR_REQUEST_TIMEOUT;
 
 	/* call func pointer to notify failure */
 	func(app_resp);
-
-	/* only one async timer at a time is handled
-	 * therefore, only one wifi request can be sent at a time
-	 */
-	if (async_timer_handle) {
-		/* async_timer_handle will be cleaned in hosted_timer_stop */
-		hosted_timer_stop(async_timer_handle);
-		async_timer_handle = NULL;
-	}
-
-	/* Response timeout
-	 * Reset the response uid to an invalid value as we no longer
-	 * expect a response until the next request
-	 * If a response arrives after this, it will be flagged
-	 * as an invalid response */
-	expected_resp_uid = -1;
-
-	/* Unlock semaphore in negative case */
-	hosted_post_semaphore(ctrl_req_sem);
 }
 
 /* This is entry level function when control request APIs are used
@@ -1225,31 +1306,34 @@ int ctrl_app_send_req(ctrl_cmd_t *app_req)
 	uint8_t  *buff_to_free1 = NULL;
 	void     *buff_to_free2 = NULL;
 	uint8_t   failure_status = 0;
-	uint8_t   got_ctrl_req_sem = 0;
+	struct ctrl_pending_req *pending = NULL;
+	void     *timer_handle = NULL;
 
 	if (!app_req) {
 		failure_status = CTRL_ERR_INCORRECT_ARG;
 		goto fail_req;
 	}
 
-	/* 1. Check if any ongoing request present
-	 * Send failure in that case */
+	/* 1. Add to pending requests, with new uid
+	 * If CTRL_MAX_PENDING_REQ requests are already awaiting
+	 * response, wait for one of them. Send failure on timeout */
 	ret = hosted_get_semaphore(ctrl_req_sem, WAIT_TIME_B2B_CTRL_REQ);
 	if (ret) {
 		failure_status = CTRL_ERR_REQ_IN_PROG;
 		goto fail_req;
-	} else {
-		got_ctrl_req_sem = 1;
 	}
 
 	app_req->msg_type = CTRL_REQ;
 
-	// handle rollover in uid value (range: 1 to INT32_MAX)
-	if (uid < INT32_MAX)
-		uid++;
-	else
-		uid = 1;
-	app_req->uid = uid;
+	hosted_get_semaphore(pending_req_lock, HOSTED_SEM_BLOCKING);
+	pending = add_pending_req(app_req);
+	hosted_post_semaphore(pending_req_lock);
+
+	if (!pending) {
+		hosted_post_semaphore(ctrl_req_sem);
+		failure_status = CTRL_ERR_REQ_IN_PROG;
+		goto fail_req;
+	}
 
 	/* 2. Protobuf msg init */
 	ctrl_msg__init(&req);
@@ -1259,9 +1343,6 @@ int ctrl_app_send_req(ctrl_cmd_t *app_req)
 	req.payload_case = (CtrlMsg__PayloadCase) app_req->msg_id;
 
 	req.uid = app_req->uid;
-	assert(expected_resp_uid == -1);
-	// set the expected response uid
-	expected_resp_uid = req.uid;
 
 	/* 3. identify request and compose CtrlMsg */
 	switch(req.msg_id) {
@@ -1537,33 +1618,26 @@ int ctrl_app_send_req(ctrl_cmd_t *app_req)
 		goto fail_req;
 	}
 
-	/* 6. Assign response callback
-	 * a. If the response callback is not set, this will reset the
-	 *    callback to NULL.
-	 * b. If the non NULL response is assigned, this will set the
-	 *    callback to user defined callback function */
-	ret = set_async_resp_callback(app_req->msg_id, app_req->ctrl_resp_cb);
-	if (ret < 0) {
-		printf("could not set callback for req[%u]\n",req.msg_id);
-		failure_status = CTRL_ERR_SET_ASYNC_CB;
+	/* 6. Start timeout for response, for both sync and async
+	 * Response may come as soon as request is sent, so timer is
+	 * set in pending request before */
+	if (!app_req->cmd_timeout_sec)
+		app_req->cmd_timeout_sec = DEFAULT_CTRL_RESP_TIMEOUT;
+
+	timer_handle = hosted_timer_start_ms(app_req->cmd_timeout_sec * 1000,
+			CTRL__TIMER_ONESHOT, ctrl_resp_timeout_handler,
+			(void *)(intptr_t)app_req->uid);
+	if (!timer_handle) {
+		printf("Failed to start resp timer\n");
+		failure_status = CTRL_ERR_MEMORY_FAILURE;
 		goto fail_req;
 	}
 
-	/* 7. Start timeout for response for async only
-	 * For sync procedures, hosted_get_semaphore takes care to
-	 * handle timeout situations */
-	if (app_req->ctrl_resp_cb) {
-		async_timer_handle = hosted_timer_start(app_req->cmd_timeout_sec, CTRL__TIMER_ONESHOT,
-				ctrl_async_timeout_handler, app_req->ctrl_resp_cb);
-		if (!async_timer_handle) {
-			printf("Failed to start async resp timer\n");
-			goto fail_req;
-		}
-		/* For async, clearing semaphore on failed cases done on above timer expiry */
-		got_ctrl_req_sem = 0;
-	}
+	hosted_get_semaphore(pending_req_lock, HOSTED_SEM_BLOCKING);
+	pending->timer_handle = timer_handle;
+	hosted_post_semaphore(pending_req_lock);
 
-	/* 8. Pack in protobuf and send the request */
+	/* 7. Pack in protobuf and send the request */
 	ctrl_msg__pack(&req, tx_data);
 	if (transport_pserial_send(tx_data, tx_len)) {
 		command_log("Send control req[%u] failed\n",req.msg_id);
@@ -1573,14 +1647,14 @@ int ctrl_app_send_req(ctrl_cmd_t *app_req)
 
 
 
-	/* 9. Free hook for application */
+	/* 8. Free hook for application */
 	if (app_req->free_buffer_handle) {
 		if (app_req->free_buffer_func) {
 			app_req->free_buffer_func(app_req->free_buffer_handle);
 		}
 	}
 
-	/* 10. Cleanup */
+	/* 9. Cleanup */
 	mem_free(tx_data);
 	mem_free(buff_to_free2);
 	mem_free(buff_to_free1);
@@ -1588,23 +1662,32 @@ int ctrl_app_send_req(ctrl_cmd_t *app_req)
 
 fail_req:
 
-	if (got_ctrl_req_sem) {
-		hosted_post_semaphore(ctrl_req_sem);
+	/* 10. Remove from pending requests, unless timed out meanwhile */
+	if (pending) {
+		timer_handle = NULL;
+
+		hosted_get_semaphore(pending_req_lock, HOSTED_SEM_BLOCKING);
+		if (pending->in_use && (pending->uid == app_req->uid)) {
+			timer_handle = pending->timer_handle;
+			remove_pending_req(pending);
+		}
+		hosted_post_semaphore(pending_req_lock);
+
+		/* timer_handle will be cleaned in hosted_timer_stop */
+		if (timer_handle)
+			hosted_timer_stop(timer_handle);
 	}
 
-	//TODO: need to test below and possibly remove redundant code
-	// if(!async_timer_handle && app_req->ctrl_resp_cb) {
 	if (app_req->ctrl_resp_cb) {
 		/* 11. In case of async procedure,
 		 * Let application know of failure using callback itself
 		 **/
 		ctrl_cmd_t *app_resp = NULL;
-		app_resp = (ctrl_cmd_t *)hosted_malloc(sizeof(ctrl_cmd_t));
+		app_resp = alloc_ctrl_msg();
 		if (!app_resp) {
 			printf("Failed to allocate app_resp\n");
 			goto fail_req2;
 		}
-		memset(app_resp, 0, sizeof(ctrl_cmd_t));
 		app_resp->msg_type = CTRL_RESP;
 		app_resp->msg_id = (app_req->msg_id - CTRL_REQ_BASE + CTRL_RESP_BASE);
 		app_resp->resp_event_status = failure_status;
@@ -1632,28 +1715,43 @@ fail_req2:
 int deinit_hosted_control_lib_internal(void)
 {
 	int ret = SUCCESS;
+	int i = 0;
 
 	set_ctrl_lib_state(CTRL_LIB_STATE_INACTIVE);
 
-	if (ctrl_msg_Q) {
-		esp_queue_destroy(&ctrl_msg_Q);
+	/* Drop pending requests */
+	for (i = 0; i < CTRL_MAX_PENDING_REQ; i++) {
+		if (pending_reqs[i].timer_handle) {
+			/* timer_handle will be cleaned in hosted_timer_stop */
+			hosted_timer_stop(pending_reqs[i].timer_handle);
+		}
+		free_ctrl_msg(pending_reqs[i].resp);
+
+		if (pending_reqs[i].wait_sem &&
+		    hosted_destroy_semaphore(pending_reqs[i].wait_sem)) {
+			ret = FAILURE;
+			printf("ctrl resp sem deinit failed\n");
+		}
+		memset(&pending_reqs[i], 0, sizeof(pending_reqs[i]));
 	}
 
 	if (ctrl_req_sem && hosted_destroy_semaphore(ctrl_req_sem)) {
 		ret = FAILURE;
 		printf("ctrl req sem deinit failed\n");
 	}
+	ctrl_req_sem = NULL;
 
-	if (read_sem && hosted_destroy_semaphore(read_sem)) {
+	if (pending_req_lock && hosted_destroy_semaphore(pending_req_lock)) {
 		ret = FAILURE;
-		printf("read sem deinit failed\n");
+		printf("pending req sem deinit failed\n");
 	}
+	pending_req_lock = NULL;
 
-	if (async_timer_handle) {
-		/* async_timer_handle will be cleaned in hosted_timer_stop */
-		hosted_timer_stop(async_timer_handle);
-		async_timer_handle = NULL;
-	}
+	esp_queue_destroy(&ctrl_msg_pool_q);
+
+	/* Queued entries went with queue, these are queued again on init */
+	for (i = 0; i < CTRL_MSG_POOL_SIZE; i++)
+		ctrl_msg_pool_move(i, CTRL_MSG_QUEUED, CTRL_MSG_IDLE);
 
 	if (serial_deinit()) {
 		ret = FAILURE;
@@ -1672,6 +1770,7 @@ int deinit_hosted_control_lib_internal(void)
 int init_hosted_control_lib_internal(void)
 {
 	int ret = SUCCESS;
+	int i = 0;
 #ifndef MCU_SYS
 	if(getuid()) {
 		printf("Please re-run program with superuser access\n");
@@ -1680,28 +1779,37 @@ int init_hosted_control_lib_internal(void)
 #endif
 
 	/* semaphore init */
-	read_sem = hosted_create_semaphore(1);
-	ctrl_req_sem = hosted_create_semaphore(1);
-	if (!read_sem || !ctrl_req_sem) {
+	ctrl_req_sem = hosted_create_semaphore(CTRL_MAX_PENDING_REQ);
+	pending_req_lock = hosted_create_semaphore(1);
+	if (!ctrl_req_sem || !pending_req_lock) {
 		printf("sem init failed, exiting\n");
 		goto free_bufs;
 	}
 
-	/* serial init */
-	if (serial_init()) {
-		printf("Failed to serial_init\n");
+	/* ctrl msg pool init */
+	ctrl_msg_pool_q = create_esp_queue(CTRL_MSG_POOL_SIZE);
+	if (!ctrl_msg_pool_q) {
+		printf("ctrl msg pool init failed, exiting\n");
 		goto free_bufs;
 	}
 
-	/* queue init */
-	ctrl_msg_Q = create_esp_queue();
-	if (!ctrl_msg_Q) {
-		printf("Failed to create app ctrl msg Q\n");
-		goto free_bufs;
+	/* Entries still in use since before deinit are skipped */
+	for (i = 0; i < CTRL_MSG_POOL_SIZE; i++)
+		ctrl_msg_pool_put(i);
+
+	for (i = 0; i < CTRL_MAX_PENDING_REQ; i++) {
+		pending_reqs[i].wait_sem = hosted_create_semaphore(0);
+		if (!pending_reqs[i].wait_sem) {
+			printf("sem init failed, exiting\n");
+			goto free_bufs;
+		}
 	}
 
-	/* Get read semaphore for first time */
-	hosted_get_semaphore(read_sem, HOSTED_SEM_BLOCKING);
+	/* serial init */
+	if (serial_init()) {
+		printf("Failed to serial_init\n");
+		goto free_bufs;
+	}
 
 	/* thread init */
 	if (spawn_ctrl_rx_thread())
@@ -59,7 +59,7 @@
         msg->free_buffer_handle = NULL;                   \
       }                                                   \
     }                                                     \
-    free(msg);                                            \
+    free_ctrl_msg(msg);                                   \
     msg = NULL;                                           \
   }                                                       \
 } while(0);
@@ -26,11 +26,18 @@
 #include <linux/netdevice.h>
 #include <net/bluetooth/bluetooth.h>
 #include <net/bluetooth/hci_core.h>
+#include <linux/version.h>
+#if (LINUX_VERSION_CODE >= KERNEL_VERSION(5, 13, 0)) && defined(CONFIG_BPF_SYSCALL)
+/* Native XDP on network interfaces */
+#define ESP_XDP_SUPPORT
+#include <net/xdp.h>
+#endif
 #include "esp_kernel_port.h"
 #include "adapter.h"
 
 #define ESP_IF_TYPE_SDIO        1
 #define ESP_IF_TYPE_SPI         2
+#define ESP_IF_TYPE_LOOPBACK    3
 
 /* Network link status */
 #define ESP_LINK_DOWN           0
@@ -39,6 +46,13 @@
 #define ESP_MAX_INTERFACE       2
 
 #define ESP_PAYLOAD_HEADER      8
+
+/* Extended capabilities supported by host driver */
+#define ESP_HOST_EXT_CAPABILITIES (ESP_TRANSPORT_AGGREGATION | \
+                                   ESP_TRANSPORT_SPI_VAR_LEN | \
+                                   ESP_TRANSPORT_CREDITS | \
+                                   ESP_TRANSPORT_CRC32 | \
+                                   ESP_TRANSPORT_SDIO_BATCH)
 struct esp_private;
 struct esp_adapter;
 
@@ -48,6 +62,25 @@ struct esp_adapter;
 #define SKB_DATA_ADDR_ALIGNMENT 4
 #define INTERFACE_HEADER_PADDING (SKB_DATA_ADDR_ALIGNMENT*3)
 
+/* Room requested from stack on TX, so that interface header can be pushed
+ * at aligned address and frame length padded without copying the skb */
+#define ESP_TX_HEADROOM         (sizeof(struct esp_payload_header) + \
+                                 SKB_DATA_ADDR_ALIGNMENT - 1)
+#define ESP_TX_TAILROOM         (SKB_DATA_ADDR_ALIGNMENT - 1)
+
+/* Network TX queues of each interface, mapped to transport priority queues */
+#define ESP_NDEV_Q_NORMAL       0       /* PRIO_Q_OTHERS */
+#define ESP_NDEV_Q_HIGH         1       /* PRIO_Q_DATA_HI */
+#define ESP_NDEV_TX_QUEUES      2
+
+/* Frames of one network TX queue waiting in transport queue, at which
+ * that queue alone is stopped, and woken again */
+#define ESP_NDEV_Q_STOP_THRESHOLD 40
+#define ESP_NDEV_Q_WAKE_THRESHOLD (ESP_NDEV_Q_STOP_THRESHOLD / 2)
+
+#define ESP_XDP_FLUSH_TX        BIT(0)
+#define ESP_XDP_FLUSH_REDIRECT  BIT(1)
+
 enum context_state {
 	ESP_CONTEXT_DISABLED = 0,
 	ESP_CONTEXT_RX_READY,
@@ -76,14 +109,42 @@ struct module_params {
 	int spi_cs;
 	int spi_handshake;
 	int spi_dataready;
+	int spi_poll_us;
 };
 
+/* Transport counters, reported by ethtool. Shared by network interfaces */
+struct esp_if_q_stats {
+	atomic64_t              tx_enqueued;
+	atomic64_t              tx_dequeued;
+	atomic64_t              tx_dropped;
+	atomic64_t              rx_enqueued;
+	atomic64_t              rx_dequeued;
+};
+
+struct esp_if_stats {
+	struct esp_if_q_stats   q[MAX_PRIORITY_QUEUES];
+	atomic64_t              tx_errors;
+	atomic64_t              rx_errors;
+	atomic64_t              rx_checksum_errors;
+	atomic64_t              tx_pause_events;
+	/* Bus transactions, and those with no data in either direction */
+	atomic64_t              xfers;
+	atomic64_t              xfers_dummy;
+};
+
+#define ESP_IF_STATS_INC(adapter, field) \
+	atomic64_inc(&(adapter)->if_stats.field)
+#define ESP_IF_STATS_ADD(adapter, field, n) \
+	atomic64_add((n), &(adapter)->if_stats.field)
+
 struct esp_adapter {
 	struct hci_dev          *hcidev;
 	struct device           *dev;
 	u8                      if_type;
 	enum context_state      state;
 	u32                     capabilities;
+	/* Extended capabilities enabled on both, host and ESP */
+	u32                     ext_capabilities;
 
 	/* Possible types:
 	 * struct esp_sdio_context */
@@ -94,6 +155,10 @@ struct esp_adapter {
 	/* Private for each interface */
 	struct esp_private      *priv[ESP_MAX_INTERFACE];
 
+	/* RX: NAPI polls transport, serial data is passed on by work */
+	struct net_device       *napi_dev;
+	struct napi_struct      napi;
+	struct sk_buff_head     serial_rx_skb_q;
 	struct workqueue_struct *if_rx_workqueue;
 	struct work_struct       if_rx_work;
 
@@ -104,6 +169,19 @@ struct esp_adapter {
 	/* Process TX work */
 	struct workqueue_struct *tx_workqueue;
 	struct work_struct      tx_work;
+	/* TX skbs which had to be reallocated to fit interface header */
+	atomic_t                tx_realloc_count;
+	struct esp_if_stats     if_stats;
+	/* Transport queue limits, ethtool ring parameters. Max of 0 means
+	 * transport has no such limit to tune */
+	u32                     tx_q_limit;
+	u32                     tx_q_limit_max;
+	u32                     rx_q_limit;
+	u32                     rx_q_limit_max;
+#ifdef ESP_XDP_SUPPORT
+	/* XDP work to be flushed at end of NAPI poll, ESP_XDP_FLUSH_* */
+	u8                      xdp_flush;
+#endif
 	struct module_params    mod_param;
 };
 
@@ -116,9 +194,20 @@ struct esp_private {
 	u8                      mac_address[6];
 	u8                      if_type;
 	u8                      if_num;
+	/* Frames in transport queue, per network TX queue */
+	atomic_t                tx_pending[ESP_NDEV_TX_QUEUES];
+	/* Serializes BQL completions, which come from transport threads
+	 * and from xmit on failure */
+	spinlock_t              tx_done_lock;
+#ifdef ESP_XDP_SUPPORT
+	struct bpf_prog __rcu   *xdp_prog;
+	struct xdp_rxq_info     xdp_rxq;
+#endif
 };
 
 struct esp_skb_cb {
 	struct esp_private      *priv;
+	/* When queued in transport TX queue */
+	ktime_t                 enq_time;
 };
 #endif
@@ -33,8 +33,15 @@ u8 esp_is_bt_supported_over_sdio(u32 cap);
 int esp_is_tx_queue_paused(void);
 void esp_tx_pause(void);
 void esp_tx_resume(void);
+void esp_tx_dequeued(struct sk_buff *skb);
 int process_init_event(u8 *evt_buf, u8 len);
 void process_capabilities(u8 cap);
 void process_test_capabilities(u8 cap);
+u16 esp_frame_checksum(u8 *frame, u16 len);
+void esp_set_frame_checksum(u8 *frame, u16 len);
+int esp_tx_push_header(struct esp_adapter *adapter, struct sk_buff *skb);
+struct sk_buff * esp_aggregate_tx_skb(struct sk_buff *skb,
+		struct sk_buff_head *tx_q, u32 max_len, u8 *aggr_cnt);
+void esp_set_ethtool_ops(struct net_device *ndev);
 
 #endif
@@ -119,14 +119,13 @@ static int esp_bt_flush(struct hci_dev *hdev)
 static ESP_BT_SEND_FRAME_PROTOTYPE()
 {
 	struct esp_payload_header *hdr;
-	size_t total_len, len = skb->len;
+	size_t len = skb->len;
 	int ret = 0;
 #if (LINUX_VERSION_CODE < KERNEL_VERSION(3, 13, 0))
     struct hci_dev * hdev = (struct hci_dev *)(skb->dev);
 #endif
 	struct esp_adapter *adapter = hci_get_drvdata(hdev);
-	struct sk_buff *new_skb;
-	u8 pad_len = 0, realloc_skb = 0;
+	int pad_len = 0;
 	u8 *pos = NULL;
 	u8 pkt_type;
 
@@ -136,55 +135,17 @@ static ESP_BT_SEND_FRAME_PROTOTYPE()
 	}
 	esp_hex_dump_dbg("bt_tx: ", skb->data, len);
 
-	/* Create space for payload header */
-	pad_len = sizeof(struct esp_payload_header);
-	total_len = len + sizeof(struct esp_payload_header);
-
-	/* Align buffer len */
-	pad_len += SKB_DATA_ADDR_ALIGNMENT - (total_len % SKB_DATA_ADDR_ALIGNMENT);
-
 	pkt_type = hci_skb_pkt_type(skb);
 
-	if (skb_headroom(skb) < pad_len) {
-		/* Headroom is not sufficient */
-		realloc_skb = 1;
-	}
-
-	if (realloc_skb || !IS_ALIGNED((unsigned long) skb->data, SKB_DATA_ADDR_ALIGNMENT)) {
-		/* Realloc SKB */
-		if (skb_linearize(skb)) {
-			hdev->stat.err_tx++;
-			return -EINVAL;
-		}
-
-		new_skb = esp_alloc_skb(skb->len + pad_len);
-
-		if (!new_skb) {
-			esp_err("Failed to allocate SKB\n");
-			hdev->stat.err_tx++;
-			return -ENOMEM;
-		}
-
-		pos = new_skb->data;
-
-		pos += pad_len;
-
-		/* Populate new SKB */
-		skb_copy_from_linear_data(skb, pos, skb->len);
-		skb_put(new_skb, skb->len);
-
-		/* Replace old SKB */
-		dev_kfree_skb_any(skb);
-		skb = new_skb;
-	} else {
-		/* Realloc is not needed, Make space for interface header */
-		skb_push(skb, pad_len);
+	/* Make space for interface header, skb is normally not copied */
+	pad_len = esp_tx_push_header(adapter, skb);
+	if (pad_len < 0) {
+		hdev->stat.err_tx++;
+		return pad_len;
 	}
 
 	hdr = (struct esp_payload_header *) skb->data;
 
-	memset (hdr, 0, sizeof(struct esp_payload_header));
-
 	hdr->if_type = ESP_HCI_IF;
 	hdr->if_num = 0;
 	hdr->len = cpu_to_le16(len);
@@ -194,7 +155,7 @@ static ESP_BT_SEND_FRAME_PROTOTYPE()
 	/* set HCI packet type */
 	*(pos + pad_len - 1) = pkt_type;
 
-	hdr->checksum = cpu_to_le16(compute_checksum(skb->data, (len + pad_len)));
+	esp_set_frame_checksum(skb->data, (len + pad_len));
 
 	ret = esp_send_packet(adapter, skb);
 
@@ -0,0 +1,199 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * Espressif Systems Wireless LAN device driver
+ *
+ * Copyright (C) 2015-2021 Espressif Systems (Shanghai) PTE LTD
+ *
+ * This software file (the "File") is distributed by Espressif Systems (Shanghai)
+ * PTE LTD under the terms of the GNU General Public License Version 2, June 1991
+ * (the "License").  You may use, redistribute and/or modify this File in
+ * accordance with the terms and conditions of the License, a copy of which
+ * is available by writing to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA or on the
+ * worldwide web at http://www.gnu.org/licenses/old-licenses/gpl-2.0.txt.
+ *
+ * THE FILE IS DISTRIBUTED AS-IS, WITHOUT WARRANTY OF ANY KIND, AND THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY OR FITNESS FOR A PARTICULAR PURPOSE
+ * ARE EXPRESSLY DISCLAIMED.  The License provides additional details about
+ * this warranty disclaimer.
+ */
+
+
+#include "esp_utils.h"
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/percpu.h>
+#include <linux/fs.h>
+#include "esp_debugfs.h"
+#include "esp_stats.h"
+
+/* Histograms use log2 buckets: bucket 0 counts value 0, bucket n counts
+ * [2^(n-1), 2^n) and the last one everything above. Each CPU updates
+ * its own buckets, these are summed up only when read */
+#define ESP_HIST_BUCKETS        24
+
+struct esp_hist_cpu {
+	u64 bucket[ESP_HIST_MAX][ESP_HIST_BUCKETS];
+};
+
+static DEFINE_PER_CPU(struct esp_hist_cpu, esp_hist);
+
+static struct dentry *esp_debugfs_dir;
+
+static const char * const esp_hist_names[ESP_HIST_MAX] = {
+	[ESP_HIST_XFER_US]        = "xfer_us",
+	[ESP_HIST_TX_SIZE]        = "tx_size",
+	[ESP_HIST_RX_SIZE]        = "rx_size",
+	[ESP_HIST_TX_WAIT_US]     = "tx_wait_us",
+	[ESP_HIST_IRQ_TO_READ_US] = "irq_to_read_us",
+	[ESP_HIST_TX_Q_DEPTH]     = "tx_q_depth",
+};
+
+void esp_hist_add(enum esp_hist_id id, u64 val)
+{
+	u32 idx = val ? min_t(u32, fls64(val), ESP_HIST_BUCKETS - 1) : 0;
+
+	this_cpu_inc(esp_hist.bucket[id][idx]);
+}
+
+static int esp_hist_show(struct seq_file *s, void *data)
+{
+	enum esp_hist_id id = (uintptr_t) s->private;
+	u64 count = 0, total = 0;
+	int cpu = 0;
+	u32 idx = 0;
+
+	for (idx = 0; idx < ESP_HIST_BUCKETS; idx++) {
+		count = 0;
+		for_each_possible_cpu(cpu)
+			count += per_cpu(esp_hist, cpu).bucket[id][idx];
+
+		total += count;
+
+		if (!idx)
+			seq_printf(s, "%10u             : %llu\n", 0, count);
+		else if (idx < ESP_HIST_BUCKETS - 1)
+			seq_printf(s, "%10llu - %-10llu: %llu\n",
+					1ULL << (idx - 1), (1ULL << idx) - 1, count);
+		else
+			seq_printf(s, "%10llu -           : %llu\n",
+					1ULL << (idx - 1), count);
+	}
+
+	seq_printf(s, "samples: %llu\n", total);
+
+	return 0;
+}
+
+static int esp_hist_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, esp_hist_show, inode->i_private);
+}
+
+/* Any write resets the histogram */
+static ssize_t esp_hist_write(struct file *file, const char __user *buf,
+		size_t count, loff_t *ppos)
+{
+	enum esp_hist_id id = (uintptr_t) file_inode(file)->i_private;
+	int cpu = 0;
+
+	for_each_possible_cpu(cpu)
+		memset(per_cpu(esp_hist, cpu).bucket[id], 0,
+				sizeof(per_cpu(esp_hist, cpu).bucket[id]));
+
+	return count;
+}
+
+static const struct file_operations esp_hist_ops = {
+	.owner = THIS_MODULE,
+	.open = esp_hist_open,
+	.read = seq_read,
+	.write = esp_hist_write,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
+static int esp_raw_tp_show_file(struct seq_file *s, void *data)
+{
+	esp_raw_tp_show(s);
+	return 0;
+}
+
+static int esp_raw_tp_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, esp_raw_tp_show_file, NULL);
+}
+
+/* "start [mode=tx|rx|bidir|ping] [len=<bytes>] [duration=<msec>]" or "stop" */
+static ssize_t esp_raw_tp_write(struct file *file, const char __user *buf,
+		size_t count, loff_t *ppos)
+{
+	char cmd[128];
+	int ret = 0;
+
+	if (count >= sizeof(cmd))
+		return -EINVAL;
+
+	if (copy_from_user(cmd, buf, count))
+		return -EFAULT;
+
+	cmd[count] = '\0';
+
+	if (!strncmp(cmd, "start", 5))
+		ret = esp_raw_tp_start(cmd + 5);
+	else if (!strncmp(cmd, "stop", 4))
+		esp_raw_tp_stop();
+	else
+		ret = -EINVAL;
+
+	return ret ? ret : count;
+}
+
+static const struct file_operations esp_raw_tp_ops = {
+	.owner = THIS_MODULE,
+	.open = esp_raw_tp_open,
+	.read = seq_read,
+	.write = esp_raw_tp_write,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
+int esp_debugfs_init(void)
+{
+	struct dentry *hist_dir = NULL;
+	int id = 0;
+
+	esp_debugfs_dir = debugfs_create_dir(KBUILD_MODNAME, NULL);
+	if (IS_ERR_OR_NULL(esp_debugfs_dir)) {
+		esp_err("Failed to create debugfs directory\n");
+		esp_debugfs_dir = NULL;
+		return -ENODEV;
+	}
+
+	if (IS_ERR_OR_NULL(debugfs_create_file("raw_tp", 0644, esp_debugfs_dir,
+			NULL, &esp_raw_tp_ops)))
+		goto cleanup;
+
+	hist_dir = debugfs_create_dir("hist", esp_debugfs_dir);
+	if (IS_ERR_OR_NULL(hist_dir))
+		goto cleanup;
+
+	for (id = 0; id < ESP_HIST_MAX; id++) {
+		if (IS_ERR_OR_NULL(debugfs_create_file(esp_hist_names[id], 0644,
+				hist_dir, (void *)(uintptr_t) id, &esp_hist_ops)))
+			goto cleanup;
+	}
+
+	return 0;
+
+cleanup:
+	esp_err("Failed to create debugfs files\n");
+	esp_debugfs_deinit();
+	return -ENODEV;
+}
+
+void esp_debugfs_deinit(void)
+{
+	debugfs_remove_recursive(esp_debugfs_dir);
+	esp_debugfs_dir = NULL;
+}
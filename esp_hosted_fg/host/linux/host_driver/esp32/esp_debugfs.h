@@ -0,0 +1,50 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+/*
+ * Espressif Systems Wireless LAN device driver
+ *
+ * Copyright (C) 2015-2021 Espressif Systems (Shanghai) PTE LTD
+ *
+ * This software file (the "File") is distributed by Espressif Systems (Shanghai)
+ * PTE LTD under the terms of the GNU General Public License Version 2, June 1991
+ * (the "License").  You may use, redistribute and/or modify this File in
+ * accordance with the terms and conditions of the License, a copy of which
+ * is available by writing to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA or on the
+ * worldwide web at http://www.gnu.org/licenses/old-licenses/gpl-2.0.txt.
+ *
+ * THE FILE IS DISTRIBUTED AS-IS, WITHOUT WARRANTY OF ANY KIND, AND THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY OR FITNESS FOR A PARTICULAR PURPOSE
+ * ARE EXPRESSLY DISCLAIMED.  The License provides additional details about
+ * this warranty disclaimer.
+ */
+
+
+#ifndef __ESP_DEBUGFS__H__
+#define __ESP_DEBUGFS__H__
+
+#include <linux/types.h>
+#include <linux/ktime.h>
+
+/* Datapath histograms, under <debugfs>/<module name>/hist */
+enum esp_hist_id {
+	ESP_HIST_XFER_US,		/* SPI/SDIO transaction duration */
+	ESP_HIST_TX_SIZE,		/* Frame size */
+	ESP_HIST_RX_SIZE,
+	ESP_HIST_TX_WAIT_US,		/* Host enqueue to bus transmission */
+	ESP_HIST_IRQ_TO_READ_US,	/* Interrupt to start of read */
+	ESP_HIST_TX_Q_DEPTH,		/* TX queue occupancy, per transaction */
+	ESP_HIST_MAX,
+};
+
+void esp_hist_add(enum esp_hist_id id, u64 val);
+
+static inline void esp_hist_add_us_since(enum esp_hist_id id, ktime_t start)
+{
+	if (ktime_to_ns(start))
+		esp_hist_add(id, ktime_us_delta(ktime_get(), start));
+}
+
+int esp_debugfs_init(void);
+void esp_debugfs_deinit(void);
+
+#endif
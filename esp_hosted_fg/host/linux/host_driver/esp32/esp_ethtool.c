@@ -0,0 +1,188 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * Espressif Systems Wireless LAN device driver
+ *
+ * Copyright (C) 2015-2021 Espressif Systems (Shanghai) PTE LTD
+ *
+ * This software file (the "File") is distributed by Espressif Systems (Shanghai)
+ * PTE LTD under the terms of the GNU General Public License Version 2, June 1991
+ * (the "License").  You may use, redistribute and/or modify this File in
+ * accordance with the terms and conditions of the License, a copy of which
+ * is available by writing to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA or on the
+ * worldwide web at http://www.gnu.org/licenses/old-licenses/gpl-2.0.txt.
+ *
+ * THE FILE IS DISTRIBUTED AS-IS, WITHOUT WARRANTY OF ANY KIND, AND THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY OR FITNESS FOR A PARTICULAR PURPOSE
+ * ARE EXPRESSLY DISCLAIMED.  The License provides additional details about
+ * this warranty disclaimer.
+ */
+
+#include "esp_utils.h"
+#include <linux/ethtool.h>
+#include <linux/netdevice.h>
+#include "esp.h"
+#include "esp_api.h"
+#include "esp_kernel_port.h"
+
+/* Transport queues, in order of priority */
+static const char * const esp_q_names[MAX_PRIORITY_QUEUES] = {
+	[PRIO_Q_SERIAL]  = "serial",
+	[PRIO_Q_BT]      = "bt",
+	[PRIO_Q_DATA_HI] = "data_hi",
+	[PRIO_Q_OTHERS]  = "others",
+};
+
+static const char * const esp_q_stat_names[] = {
+	"tx_enqueued",
+	"tx_dequeued",
+	"tx_dropped",
+	"rx_enqueued",
+	"rx_dequeued",
+};
+
+#define ESP_Q_STATS_LEN         ARRAY_SIZE(esp_q_stat_names)
+
+static const char esp_gstrings_stats[][ETH_GSTRING_LEN] = {
+	"if_tx_errors",
+	"if_rx_errors",
+	"if_rx_checksum_errors",
+	"if_tx_pause_events",
+	"if_tx_realloc_copies",
+	"if_xfers",
+	"if_xfers_dummy",
+	"if_xfers_dummy_pct",
+};
+
+#define ESP_GSTRINGS_STATS_LEN  ARRAY_SIZE(esp_gstrings_stats)
+#define ESP_STATS_LEN           (MAX_PRIORITY_QUEUES * ESP_Q_STATS_LEN + \
+                                 ESP_GSTRINGS_STATS_LEN)
+
+static void esp_get_drvinfo(struct net_device *ndev,
+		struct ethtool_drvinfo *info)
+{
+	struct esp_private *priv = netdev_priv(ndev);
+
+	strscpy(info->driver, KBUILD_MODNAME, sizeof(info->driver));
+
+	if (priv->adapter && priv->adapter->dev)
+		strscpy(info->bus_info, dev_name(priv->adapter->dev),
+				sizeof(info->bus_info));
+}
+
+static int esp_get_sset_count(struct net_device *ndev, int sset)
+{
+	switch (sset) {
+	case ETH_SS_STATS:
+		return ESP_STATS_LEN;
+	default:
+		return -EOPNOTSUPP;
+	}
+}
+
+static void esp_get_strings(struct net_device *ndev, u32 sset, u8 *data)
+{
+	u8 q = 0, i = 0;
+
+	if (sset != ETH_SS_STATS)
+		return;
+
+	for (q = 0; q < MAX_PRIORITY_QUEUES; q++) {
+		for (i = 0; i < ESP_Q_STATS_LEN; i++) {
+			snprintf(data, ETH_GSTRING_LEN, "q_%s_%s",
+					esp_q_names[q], esp_q_stat_names[i]);
+			data += ETH_GSTRING_LEN;
+		}
+	}
+
+	memcpy(data, esp_gstrings_stats, sizeof(esp_gstrings_stats));
+}
+
+static void esp_get_ethtool_stats(struct net_device *ndev,
+		struct ethtool_stats *stats, u64 *data)
+{
+	struct esp_private *priv = netdev_priv(ndev);
+	struct esp_if_stats *if_stats = NULL;
+	struct esp_if_q_stats *q_stats = NULL;
+	u64 xfers = 0, xfers_dummy = 0;
+	u8 q = 0;
+
+	if_stats = &priv->adapter->if_stats;
+
+	for (q = 0; q < MAX_PRIORITY_QUEUES; q++) {
+		q_stats = &if_stats->q[q];
+
+		*data++ = atomic64_read(&q_stats->tx_enqueued);
+		*data++ = atomic64_read(&q_stats->tx_dequeued);
+		*data++ = atomic64_read(&q_stats->tx_dropped);
+		*data++ = atomic64_read(&q_stats->rx_enqueued);
+		*data++ = atomic64_read(&q_stats->rx_dequeued);
+	}
+
+	xfers = atomic64_read(&if_stats->xfers);
+	xfers_dummy = atomic64_read(&if_stats->xfers_dummy);
+
+	*data++ = atomic64_read(&if_stats->tx_errors);
+	*data++ = atomic64_read(&if_stats->rx_errors);
+	*data++ = atomic64_read(&if_stats->rx_checksum_errors);
+	*data++ = atomic64_read(&if_stats->tx_pause_events);
+	*data++ = atomic_read(&priv->adapter->tx_realloc_count);
+	*data++ = xfers;
+	*data++ = xfers_dummy;
+	*data++ = xfers ? div64_u64(xfers_dummy * 100, xfers) : 0;
+}
+
+/* TX pending is limit of frames in transport TX queues, at which network
+ * TX is paused. RX pending is number of RX buffers kept by transport */
+static ETHTOOL_GET_RINGPARAM_PROTOTYPE()
+{
+	struct esp_adapter *adapter = ((struct esp_private *) netdev_priv(ndev))->adapter;
+
+	ring->tx_max_pending = adapter->tx_q_limit_max;
+	ring->tx_pending = READ_ONCE(adapter->tx_q_limit);
+	ring->rx_max_pending = adapter->rx_q_limit_max;
+	ring->rx_pending = READ_ONCE(adapter->rx_q_limit);
+}
+
+static ETHTOOL_SET_RINGPARAM_PROTOTYPE()
+{
+	struct esp_adapter *adapter = ((struct esp_private *) netdev_priv(ndev))->adapter;
+
+	if (ring->rx_mini_pending || ring->rx_jumbo_pending)
+		return -EINVAL;
+
+	if (!ring->tx_pending || (ring->tx_pending > adapter->tx_q_limit_max))
+		return -EINVAL;
+
+	if (ring->rx_pending > adapter->rx_q_limit_max)
+		return -EINVAL;
+
+	if (adapter->rx_q_limit_max && !ring->rx_pending)
+		return -EINVAL;
+
+	/* Applies to both network interfaces, transport is shared */
+	WRITE_ONCE(adapter->tx_q_limit, ring->tx_pending);
+
+	if (adapter->rx_q_limit_max)
+		WRITE_ONCE(adapter->rx_q_limit, ring->rx_pending);
+
+	esp_info("Transport queue limits: tx[%u] rx[%u]\n",
+			adapter->tx_q_limit, adapter->rx_q_limit);
+
+	return 0;
+}
+
+static const struct ethtool_ops esp_ethtool_ops = {
+	.get_drvinfo = esp_get_drvinfo,
+	.get_link = ethtool_op_get_link,
+	.get_sset_count = esp_get_sset_count,
+	.get_strings = esp_get_strings,
+	.get_ethtool_stats = esp_get_ethtool_stats,
+	.get_ringparam = esp_get_ringparam,
+	.set_ringparam = esp_set_ringparam,
+};
+
+void esp_set_ethtool_ops(struct net_device *ndev)
+{
+	ndev->ethtool_ops = &esp_ethtool_ops;
+}
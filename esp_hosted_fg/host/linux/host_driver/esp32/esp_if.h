@@ -27,6 +27,9 @@ struct esp_if_ops {
 	int (*init)(struct esp_adapter *adapter);
 	struct sk_buff* (*read)(struct esp_adapter *adapter);
 	int (*write)(struct esp_adapter *adapter, struct sk_buff *skb);
+	/* Optional: queue skb like write, but leave TX to next kick */
+	int (*queue)(struct esp_adapter *adapter, struct sk_buff *skb);
+	void (*kick)(struct esp_adapter *adapter);
 	int (*deinit)(struct esp_adapter *adapter);
 };
 
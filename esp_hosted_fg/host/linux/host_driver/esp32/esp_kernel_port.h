@@ -23,6 +23,7 @@
 
 #include "esp.h"
 #include <linux/version.h>
+#include <linux/slab.h>
 
 #if (LINUX_VERSION_CODE < KERNEL_VERSION(3, 13, 0))
     #define ESP_BT_SEND_FRAME_PROTOTYPE() \
@@ -94,6 +95,35 @@ static inline void *skb_put_data(struct sk_buff *skb, const void *data,
         void esp_tx_timeout(struct net_device *ndev, unsigned int txqueue)
 #endif
 
+#if (LINUX_VERSION_CODE < KERNEL_VERSION(3, 13, 0))
+    #define NDO_SELECT_QUEUE_PROTOTYPE() \
+        u16 esp_select_queue(struct net_device *ndev, struct sk_buff *skb)
+#elif (LINUX_VERSION_CODE < KERNEL_VERSION(3, 14, 0))
+    #define NDO_SELECT_QUEUE_PROTOTYPE() \
+        u16 esp_select_queue(struct net_device *ndev, struct sk_buff *skb, \
+                void *accel_priv)
+#elif (LINUX_VERSION_CODE < KERNEL_VERSION(4, 19, 0))
+    #define NDO_SELECT_QUEUE_PROTOTYPE() \
+        u16 esp_select_queue(struct net_device *ndev, struct sk_buff *skb, \
+                void *accel_priv, select_queue_fallback_t fallback)
+#elif (LINUX_VERSION_CODE < KERNEL_VERSION(5, 2, 0))
+    #define NDO_SELECT_QUEUE_PROTOTYPE() \
+        u16 esp_select_queue(struct net_device *ndev, struct sk_buff *skb, \
+                struct net_device *sb_dev, select_queue_fallback_t fallback)
+#else
+    #define NDO_SELECT_QUEUE_PROTOTYPE() \
+        u16 esp_select_queue(struct net_device *ndev, struct sk_buff *skb, \
+                struct net_device *sb_dev)
+#endif
+
+#if (LINUX_VERSION_CODE < KERNEL_VERSION(3, 18, 0))
+    #define ESP_XMIT_MORE(skb)  false
+#elif (LINUX_VERSION_CODE < KERNEL_VERSION(5, 2, 0))
+    #define ESP_XMIT_MORE(skb)  ((skb)->xmit_more)
+#else
+    #define ESP_XMIT_MORE(skb)  netdev_xmit_more()
+#endif
+
 #if (LINUX_VERSION_CODE < KERNEL_VERSION(5, 15, 0))
 static inline void eth_hw_addr_set(struct net_device *dev, const u8 *addr)
 {
@@ -105,6 +135,30 @@ static inline void eth_hw_addr_set(struct net_device *dev, const u8 *addr)
     #define netif_rx_ni(skb)    netif_rx(skb)
 #endif
 
+#if (LINUX_VERSION_CODE < KERNEL_VERSION(6, 1, 0))
+    #define NETIF_NAPI_ADD(dev, napi, poll) \
+        netif_napi_add(dev, napi, poll, NAPI_POLL_WEIGHT)
+#else
+    #define NETIF_NAPI_ADD(dev, napi, poll) \
+        netif_napi_add(dev, napi, poll)
+#endif
+
+#if (LINUX_VERSION_CODE < KERNEL_VERSION(6, 10, 0))
+static inline struct net_device * ALLOC_NETDEV_DUMMY(void)
+{
+	struct net_device *dev = kzalloc(sizeof(*dev), GFP_KERNEL);
+
+	if (dev)
+		init_dummy_netdev(dev);
+
+	return dev;
+}
+#define FREE_NETDEV_DUMMY(dev)	kfree(dev)
+#else
+#define ALLOC_NETDEV_DUMMY()	alloc_netdev_dummy(0)
+#define FREE_NETDEV_DUMMY(dev)	free_netdev(dev)
+#endif
+
 #if (LINUX_VERSION_CODE >= KERNEL_VERSION(5, 17, 0))
 #define do_exit(code)	kthread_complete_and_exit(NULL, code)
 #endif
@@ -115,4 +169,42 @@ static inline void eth_hw_addr_set(struct net_device *dev, const u8 *addr)
 #define CLASS_CREATE(x)	class_create(x);
 #endif
 
+#if (LINUX_VERSION_CODE < KERNEL_VERSION(5, 17, 0))
+    #define ETHTOOL_GET_RINGPARAM_PROTOTYPE() \
+        void esp_get_ringparam(struct net_device *ndev, \
+                struct ethtool_ringparam *ring)
+    #define ETHTOOL_SET_RINGPARAM_PROTOTYPE() \
+        int esp_set_ringparam(struct net_device *ndev, \
+                struct ethtool_ringparam *ring)
+#else
+    #define ETHTOOL_GET_RINGPARAM_PROTOTYPE() \
+        void esp_get_ringparam(struct net_device *ndev, \
+                struct ethtool_ringparam *ring, \
+                struct kernel_ethtool_ringparam *kernel_ring, \
+                struct netlink_ext_ack *extack)
+    #define ETHTOOL_SET_RINGPARAM_PROTOTYPE() \
+        int esp_set_ringparam(struct net_device *ndev, \
+                struct ethtool_ringparam *ring, \
+                struct kernel_ethtool_ringparam *kernel_ring, \
+                struct netlink_ext_ack *extack)
+#endif
+
+#ifdef ESP_XDP_SUPPORT
+  #if (LINUX_VERSION_CODE < KERNEL_VERSION(5, 17, 0))
+    #define ESP_XDP_WARN_INVALID_ACTION(ndev, prog, act) \
+        bpf_warn_invalid_xdp_action(act)
+  #else
+    #define ESP_XDP_WARN_INVALID_ACTION(ndev, prog, act) \
+        bpf_warn_invalid_xdp_action(ndev, prog, act)
+  #endif
+
+  #if (LINUX_VERSION_CODE < KERNEL_VERSION(6, 3, 0))
+    #define ESP_XDP_SET_FEATURES(ndev)
+  #else
+    #define ESP_XDP_SET_FEATURES(ndev) \
+        xdp_set_features_flag(ndev, NETDEV_XDP_ACT_BASIC | \
+                NETDEV_XDP_ACT_REDIRECT | NETDEV_XDP_ACT_NDO_XMIT)
+  #endif
+#endif
+
 #endif
@@ -20,12 +20,15 @@
 
 #include "esp_utils.h"
 #include "esp_stats.h"
+#include "esp_api.h"
+#include <linux/kthread.h>
+#include <linux/sort.h>
+#include <linux/vmalloc.h>
+#include <linux/seq_file.h>
 
 #if TEST_RAW_TP
 
-#include "esp_api.h"
 #include <linux/timer.h>
-#include <linux/kthread.h>
 
 #define BYTES_TO_KBITS(x)    ((x*8)/1024)
 
@@ -90,9 +93,8 @@ static int raw_tp_tx_process(void *data)
 			payload_header->offset = cpu_to_le16(pad_len);
 
 			if (adapter->capabilities & ESP_CHECKSUM_ENABLED) {
-				payload_header->checksum =
-					cpu_to_le16(compute_checksum(tx_skb->data,
-								(TEST_RAW_TP__BUF_SIZE + pad_len)));
+				esp_set_frame_checksum(tx_skb->data,
+						(TEST_RAW_TP__BUF_SIZE + pad_len));
 			}
 			ret = esp_send_packet(esp_get_adapter(), tx_skb);
 			if(!ret)
@@ -144,13 +146,6 @@ static void stop_test_raw_tp(void)
 	test_raw_tp__host_to_esp = 0;
 }
 
-void esp_raw_tp_queue_resume(void)
-{
-	if (traffic_open_init_done)
-		if (!completion_done(&traffic_open))
-			complete_all(&traffic_open);
-}
-
 void test_raw_tp_cleanup(void)
 {
 	int ret = 0;
@@ -188,6 +183,477 @@ void update_test_raw_tp_rx_stats(u16 len)
 }
 #endif
 
+/* Raw throughput benchmark, started through debugfs, see adapter.h */
+#define ESP_RAW_TP_FRAME_LEN_DEFAULT    1460
+#define ESP_RAW_TP_DURATION_DEFAULT_MS  10000
+#define ESP_RAW_TP_DURATION_MAX_MS      (3600 * 1000)
+#define ESP_RAW_TP_RTT_SAMPLES_MAX      100000
+#define ESP_RAW_TP_PING_TIMEOUT_MS      100
+#define ESP_RAW_TP_REPORT_TIMEOUT_MS    1000
+
+enum {
+	ESP_RAW_TP_MODE_TX,
+	ESP_RAW_TP_MODE_RX,
+	ESP_RAW_TP_MODE_BIDIR,
+	ESP_RAW_TP_MODE_PING,
+	ESP_RAW_TP_MODE_MAX,
+};
+
+static const char * const esp_raw_tp_mode_names[ESP_RAW_TP_MODE_MAX] = {
+	[ESP_RAW_TP_MODE_TX]    = "tx",
+	[ESP_RAW_TP_MODE_RX]    = "rx",
+	[ESP_RAW_TP_MODE_BIDIR] = "bidir",
+	[ESP_RAW_TP_MODE_PING]  = "ping",
+};
+
+enum {
+	ESP_RAW_TP_IDLE,
+	ESP_RAW_TP_RUNNING,
+	/* Result is being prepared */
+	ESP_RAW_TP_STOPPING,
+	ESP_RAW_TP_DONE,
+};
+
+static const char * const esp_raw_tp_state_names[] = {
+	[ESP_RAW_TP_IDLE]    = "idle",
+	[ESP_RAW_TP_RUNNING] = "running",
+	[ESP_RAW_TP_STOPPING] = "stopping",
+	[ESP_RAW_TP_DONE]    = "done",
+};
+
+struct esp_raw_tp_bench {
+	u8 state;
+	u8 mode;
+	u16 frame_len;
+	u32 duration_ms;
+	u64 elapsed_ns;
+	/* Host side, RX updated in NAPI poll */
+	u64 tx_frames;
+	u64 tx_bytes;
+	atomic64_t rx_frames;
+	atomic64_t rx_bytes;
+	/* ESP side, from REPORT */
+	struct esp_test_hdr report;
+	u8 report_valid;
+	/* Ping pong, one PING outstanding at a time */
+	u32 ping_seq;
+	u64 ping_sent;
+	u64 ping_lost;
+	u32 *rtt_ns;
+	u32 rtt_cnt;
+};
+
+static struct esp_raw_tp_bench bench;
+static struct task_struct *bench_thread;
+static DEFINE_MUTEX(bench_lock);
+/* Serialises RTT samples of RX path with end of run */
+static DEFINE_SPINLOCK(bench_rtt_lock);
+static DECLARE_WAIT_QUEUE_HEAD(bench_tx_wait);
+static DECLARE_COMPLETION(bench_pong);
+static DECLARE_COMPLETION(bench_report);
+
+static int esp_raw_tp_send(struct esp_test_hdr *test_hdr, u16 len)
+{
+	struct esp_adapter *adapter = esp_get_adapter();
+	struct esp_payload_header *payload_header = NULL;
+	struct sk_buff *skb = NULL;
+	u16 offset = sizeof(struct esp_payload_header);
+
+	skb = esp_alloc_skb(offset + len);
+	if (!skb)
+		return -ENOMEM;
+
+	payload_header = (struct esp_payload_header *) skb_put(skb, offset + len);
+	memset(payload_header, 0, offset + len);
+
+	payload_header->if_type = ESP_TEST_IF;
+	payload_header->len = cpu_to_le16(len);
+	payload_header->offset = cpu_to_le16(offset);
+
+	test_hdr->magic = cpu_to_le16(ESP_TEST_MAGIC);
+	memcpy(skb->data + offset, test_hdr, sizeof(struct esp_test_hdr));
+
+	if (adapter->capabilities & ESP_CHECKSUM_ENABLED)
+		esp_set_frame_checksum(skb->data, offset + len);
+
+	return esp_send_packet(adapter, skb);
+}
+
+static void esp_raw_tp_ping(void)
+{
+	struct esp_test_hdr test_hdr = {0};
+	u32 seq = bench.ping_seq + 1;
+
+	/* Late PONG of earlier PING is ignored */
+	WRITE_ONCE(bench.ping_seq, seq);
+	reinit_completion(&bench_pong);
+
+	test_hdr.cmd = ESP_TEST_CMD_PING;
+	test_hdr.seq = cpu_to_le32(seq);
+	test_hdr.timestamp = cpu_to_le64(ktime_get_ns());
+
+	if (esp_raw_tp_send(&test_hdr, bench.frame_len)) {
+		msleep(1);
+		return;
+	}
+
+	bench.ping_sent++;
+
+	if (!wait_for_completion_timeout(&bench_pong,
+				msecs_to_jiffies(ESP_RAW_TP_PING_TIMEOUT_MS)))
+		bench.ping_lost++;
+}
+
+static void esp_raw_tp_send_data(void)
+{
+	struct esp_test_hdr test_hdr = {0};
+
+	/* Wait for transport queue to drain, as network TX does */
+	if (!esp_is_tx_queue_paused()) {
+		wait_event_interruptible_timeout(bench_tx_wait,
+				esp_is_tx_queue_paused() || kthread_should_stop(),
+				msecs_to_jiffies(10));
+		return;
+	}
+
+	test_hdr.cmd = ESP_TEST_CMD_DATA;
+	test_hdr.seq = cpu_to_le32(bench.tx_frames);
+
+	if (esp_raw_tp_send(&test_hdr, bench.frame_len)) {
+		/* e.g. data path closed */
+		msleep(1);
+		return;
+	}
+
+	bench.tx_frames++;
+	bench.tx_bytes += bench.frame_len;
+}
+
+static int esp_raw_tp_cmp_u32(const void *a, const void *b)
+{
+	u32 x = *(const u32 *) a, y = *(const u32 *) b;
+
+	return (x > y) - (x < y);
+}
+
+/* Percentile in per mille, of sorted samples */
+static u32 esp_raw_tp_rtt_pct(u32 per_mille)
+{
+	return bench.rtt_ns[div_u64((u64)(bench.rtt_cnt - 1) * per_mille, 1000)];
+}
+
+static u64 esp_raw_tp_kbps(u64 bytes)
+{
+	u64 elapsed_ms = div_u64(bench.elapsed_ns, NSEC_PER_MSEC);
+
+	/* bits per msec is kbits per sec */
+	return elapsed_ms ? div64_u64(bytes * 8, elapsed_ms) : 0;
+}
+
+static void esp_raw_tp_finish(void)
+{
+	/* Late PONG is not to add samples while these are sorted */
+	spin_lock_bh(&bench_rtt_lock);
+	WRITE_ONCE(bench.state, ESP_RAW_TP_STOPPING);
+	WRITE_ONCE(bench.ping_seq, 0);
+	spin_unlock_bh(&bench_rtt_lock);
+
+	if (bench.rtt_cnt)
+		sort(bench.rtt_ns, bench.rtt_cnt, sizeof(u32), esp_raw_tp_cmp_u32, NULL);
+
+	WRITE_ONCE(bench.state, ESP_RAW_TP_DONE);
+
+	esp_info("raw_tp done: mode=%s frame_len=%u elapsed_ms=%llu host_to_esp_kbps=%llu esp_to_host_kbps=%llu rtt_p50_ns=%u rtt_p99_ns=%u\n",
+			esp_raw_tp_mode_names[bench.mode], bench.frame_len,
+			div_u64(bench.elapsed_ns, NSEC_PER_MSEC),
+			bench.report_valid ? esp_raw_tp_kbps(le64_to_cpu(bench.report.rx_bytes)) : 0,
+			esp_raw_tp_kbps(atomic64_read(&bench.rx_bytes)),
+			bench.rtt_cnt ? esp_raw_tp_rtt_pct(500) : 0,
+			bench.rtt_cnt ? esp_raw_tp_rtt_pct(990) : 0);
+}
+
+static int esp_raw_tp_bench_thread(void *data)
+{
+	struct esp_test_hdr test_hdr = {0};
+	ktime_t start_time, end_time;
+	u8 host_tx = (bench.mode == ESP_RAW_TP_MODE_TX) ||
+		(bench.mode == ESP_RAW_TP_MODE_BIDIR);
+
+	test_hdr.cmd = ESP_TEST_CMD_START;
+	if ((bench.mode == ESP_RAW_TP_MODE_RX) || (bench.mode == ESP_RAW_TP_MODE_BIDIR))
+		test_hdr.flags = ESP_TEST_START_ESP_TO_HOST;
+	test_hdr.frame_len = cpu_to_le16(bench.frame_len);
+	test_hdr.duration_ms = cpu_to_le32(bench.duration_ms);
+
+	if (esp_raw_tp_send(&test_hdr, sizeof(test_hdr)))
+		esp_err("Failed to send raw_tp start\n");
+
+	start_time = ktime_get();
+	end_time = ktime_add_ms(start_time, bench.duration_ms);
+
+	while (!kthread_should_stop() && ktime_before(ktime_get(), end_time)) {
+		if (bench.mode == ESP_RAW_TP_MODE_PING)
+			esp_raw_tp_ping();
+		else if (host_tx)
+			esp_raw_tp_send_data();
+		else
+			msleep_interruptible(10);
+	}
+
+	bench.elapsed_ns = ktime_to_ns(ktime_sub(ktime_get(), start_time));
+
+	/* REPORT follows any DATA queued by ESP, so RX counters are final */
+	memset(&test_hdr, 0, sizeof(test_hdr));
+	test_hdr.cmd = ESP_TEST_CMD_STOP;
+
+	if (!esp_raw_tp_send(&test_hdr, sizeof(test_hdr)) &&
+	    wait_for_completion_timeout(&bench_report,
+			msecs_to_jiffies(ESP_RAW_TP_REPORT_TIMEOUT_MS)))
+		bench.report_valid = 1;
+	else
+		esp_err("No raw_tp report from ESP\n");
+
+	esp_raw_tp_finish();
+
+	/* Result stays till next start, thread is reaped by kthread_stop() */
+	set_current_state(TASK_INTERRUPTIBLE);
+	while (!kthread_should_stop()) {
+		schedule();
+		set_current_state(TASK_INTERRUPTIBLE);
+	}
+	__set_current_state(TASK_RUNNING);
+
+	return 0;
+}
+
+static void esp_raw_tp_reap_thread(void)
+{
+	if (bench_thread) {
+		kthread_stop(bench_thread);
+		bench_thread = NULL;
+	}
+
+	/* Stopped before it could run */
+	if (READ_ONCE(bench.state) == ESP_RAW_TP_RUNNING)
+		WRITE_ONCE(bench.state, ESP_RAW_TP_IDLE);
+}
+
+/* Args: mode=tx|rx|bidir|ping len=<frame len> duration=<msec> */
+int esp_raw_tp_start(char *args)
+{
+	u32 frame_len = ESP_RAW_TP_FRAME_LEN_DEFAULT;
+	u32 duration_ms = ESP_RAW_TP_DURATION_DEFAULT_MS;
+	u8 mode = ESP_RAW_TP_MODE_TX;
+	char *token = NULL;
+	int ret = 0;
+
+	while ((token = strsep(&args, " \t\n")) != NULL) {
+		if (!*token)
+			continue;
+
+		if (!strncmp(token, "mode=", 5)) {
+			ret = match_string(esp_raw_tp_mode_names, ESP_RAW_TP_MODE_MAX, token + 5);
+			if (ret < 0)
+				return -EINVAL;
+			mode = ret;
+		} else if (!strncmp(token, "len=", 4)) {
+			if (kstrtou32(token + 4, 0, &frame_len))
+				return -EINVAL;
+		} else if (!strncmp(token, "duration=", 9)) {
+			if (kstrtou32(token + 9, 0, &duration_ms))
+				return -EINVAL;
+		} else {
+			return -EINVAL;
+		}
+	}
+
+	if ((frame_len < sizeof(struct esp_test_hdr)) || (frame_len > ESP_TEST_FRAME_LEN_MAX) ||
+	    !duration_ms || (duration_ms > ESP_RAW_TP_DURATION_MAX_MS))
+		return -EINVAL;
+
+	mutex_lock(&bench_lock);
+
+	if ((READ_ONCE(bench.state) == ESP_RAW_TP_RUNNING) ||
+	    (READ_ONCE(bench.state) == ESP_RAW_TP_STOPPING)) {
+		mutex_unlock(&bench_lock);
+		return -EBUSY;
+	}
+
+	esp_raw_tp_reap_thread();
+	vfree(bench.rtt_ns);
+
+	memset(&bench, 0, sizeof(bench));
+	bench.mode = mode;
+	bench.frame_len = frame_len;
+	bench.duration_ms = duration_ms;
+
+	if (mode == ESP_RAW_TP_MODE_PING) {
+		bench.rtt_ns = vmalloc(ESP_RAW_TP_RTT_SAMPLES_MAX * sizeof(u32));
+		if (!bench.rtt_ns) {
+			mutex_unlock(&bench_lock);
+			return -ENOMEM;
+		}
+	}
+
+	reinit_completion(&bench_report);
+	WRITE_ONCE(bench.state, ESP_RAW_TP_RUNNING);
+
+	bench_thread = kthread_run(esp_raw_tp_bench_thread, NULL, "esp_raw_tp");
+	if (IS_ERR(bench_thread)) {
+		ret = PTR_ERR(bench_thread);
+		bench_thread = NULL;
+		WRITE_ONCE(bench.state, ESP_RAW_TP_IDLE);
+		mutex_unlock(&bench_lock);
+		return ret;
+	}
+
+	esp_info("raw_tp start: mode=%s frame_len=%u duration_ms=%u\n",
+			esp_raw_tp_mode_names[mode], frame_len, duration_ms);
+
+	mutex_unlock(&bench_lock);
+
+	return 0;
+}
+
+/* Ends running test early, result is still reported */
+void esp_raw_tp_stop(void)
+{
+	mutex_lock(&bench_lock);
+	esp_raw_tp_reap_thread();
+	mutex_unlock(&bench_lock);
+}
+
+void esp_raw_tp_cleanup(void)
+{
+	esp_raw_tp_stop();
+	vfree(bench.rtt_ns);
+	bench.rtt_ns = NULL;
+	bench.rtt_cnt = 0;
+}
+
+/* Summary as key=value lines */
+void esp_raw_tp_show(struct seq_file *s)
+{
+	struct esp_test_hdr *report = &bench.report;
+	u64 rx_frames = 0, rx_bytes = 0;
+
+	mutex_lock(&bench_lock);
+
+	seq_printf(s, "state=%s\n", esp_raw_tp_state_names[READ_ONCE(bench.state)]);
+
+	if (bench.state == ESP_RAW_TP_IDLE)
+		goto unlock;
+
+	rx_frames = atomic64_read(&bench.rx_frames);
+	rx_bytes = atomic64_read(&bench.rx_bytes);
+
+	seq_printf(s, "mode=%s\n", esp_raw_tp_mode_names[bench.mode]);
+	seq_printf(s, "frame_len=%u\n", bench.frame_len);
+	seq_printf(s, "duration_ms=%u\n", bench.duration_ms);
+
+	if (bench.state != ESP_RAW_TP_DONE)
+		goto unlock;
+
+	seq_printf(s, "elapsed_ms=%llu\n", div_u64(bench.elapsed_ns, NSEC_PER_MSEC));
+	seq_printf(s, "report=%s\n", bench.report_valid ? "ok" : "missing");
+
+	seq_printf(s, "host_tx_frames=%llu\n", bench.tx_frames);
+	seq_printf(s, "host_tx_bytes=%llu\n", bench.tx_bytes);
+	seq_printf(s, "host_rx_frames=%llu\n", rx_frames);
+	seq_printf(s, "host_rx_bytes=%llu\n", rx_bytes);
+
+	if (bench.report_valid) {
+		seq_printf(s, "esp_tx_frames=%llu\n", le64_to_cpu(report->tx_frames));
+		seq_printf(s, "esp_tx_bytes=%llu\n", le64_to_cpu(report->tx_bytes));
+		seq_printf(s, "esp_rx_frames=%llu\n", le64_to_cpu(report->rx_frames));
+		seq_printf(s, "esp_rx_bytes=%llu\n", le64_to_cpu(report->rx_bytes));
+		seq_printf(s, "host_to_esp_kbps=%llu\n",
+				esp_raw_tp_kbps(le64_to_cpu(report->rx_bytes)));
+		seq_printf(s, "host_to_esp_lost=%lld\n",
+				(s64)(bench.tx_frames - le64_to_cpu(report->rx_frames)));
+		seq_printf(s, "esp_to_host_lost=%lld\n",
+				(s64)(le64_to_cpu(report->tx_frames) - rx_frames));
+	}
+
+	seq_printf(s, "esp_to_host_kbps=%llu\n", esp_raw_tp_kbps(rx_bytes));
+
+	if (bench.mode != ESP_RAW_TP_MODE_PING)
+		goto unlock;
+
+	seq_printf(s, "ping_sent=%llu\n", bench.ping_sent);
+	seq_printf(s, "ping_lost=%llu\n", bench.ping_lost);
+	seq_printf(s, "rtt_samples=%u\n", bench.rtt_cnt);
+
+	if (bench.rtt_cnt) {
+		seq_printf(s, "rtt_min_ns=%u\n", bench.rtt_ns[0]);
+		seq_printf(s, "rtt_p50_ns=%u\n", esp_raw_tp_rtt_pct(500));
+		seq_printf(s, "rtt_p90_ns=%u\n", esp_raw_tp_rtt_pct(900));
+		seq_printf(s, "rtt_p99_ns=%u\n", esp_raw_tp_rtt_pct(990));
+		seq_printf(s, "rtt_p999_ns=%u\n", esp_raw_tp_rtt_pct(999));
+		seq_printf(s, "rtt_max_ns=%u\n", bench.rtt_ns[bench.rtt_cnt - 1]);
+	}
+
+unlock:
+	mutex_unlock(&bench_lock);
+}
+
+/* Called from NAPI poll, for each ESP_TEST_IF frame */
+void esp_raw_tp_rx(const u8 *payload, u16 len)
+{
+	const struct esp_test_hdr *test_hdr = (const struct esp_test_hdr *) payload;
+	u64 rtt = 0;
+
+	if ((len < sizeof(struct esp_test_hdr)) ||
+	    (le16_to_cpu(test_hdr->magic) != ESP_TEST_MAGIC))
+		return;
+
+	if (READ_ONCE(bench.state) != ESP_RAW_TP_RUNNING)
+		return;
+
+	switch (test_hdr->cmd) {
+	case ESP_TEST_CMD_DATA:
+		atomic64_inc(&bench.rx_frames);
+		atomic64_add(len, &bench.rx_bytes);
+		break;
+
+	case ESP_TEST_CMD_PONG:
+		spin_lock_bh(&bench_rtt_lock);
+
+		if ((READ_ONCE(bench.state) != ESP_RAW_TP_RUNNING) ||
+		    (le32_to_cpu(test_hdr->seq) != bench.ping_seq)) {
+			spin_unlock_bh(&bench_rtt_lock);
+			break;
+		}
+
+		rtt = ktime_get_ns() - le64_to_cpu(test_hdr->timestamp);
+		if (bench.rtt_ns && (bench.rtt_cnt < ESP_RAW_TP_RTT_SAMPLES_MAX))
+			bench.rtt_ns[bench.rtt_cnt++] = min_t(u64, rtt, U32_MAX);
+
+		spin_unlock_bh(&bench_rtt_lock);
+
+		complete(&bench_pong);
+		break;
+
+	case ESP_TEST_CMD_REPORT:
+		memcpy(&bench.report, test_hdr, sizeof(struct esp_test_hdr));
+		complete(&bench_report);
+		break;
+
+	default:
+		break;
+	}
+}
+
+void esp_raw_tp_queue_resume(void)
+{
+#if TEST_RAW_TP
+	if (traffic_open_init_done)
+		if (!completion_done(&traffic_open))
+			complete_all(&traffic_open);
+#endif
+	wake_up_interruptible(&bench_tx_wait);
+}
+
 void process_test_capabilities(u8 cap)
 {
 #if TEST_RAW_TP
@@ -36,9 +36,17 @@
 #define ESP_TEST_RAW_TP__RX      0
 #define ESP_TEST_RAW_TP__TX      1
 
-void esp_raw_tp_queue_resume(void);
 #endif
 
+struct seq_file;
+
+void esp_raw_tp_queue_resume(void);
+int esp_raw_tp_start(char *args);
+void esp_raw_tp_stop(void);
+void esp_raw_tp_cleanup(void);
+void esp_raw_tp_show(struct seq_file *s);
+void esp_raw_tp_rx(const u8 *payload, u16 len);
+
 void test_raw_tp_cleanup(void);
 void update_test_raw_tp_rx_stats(u16 len);
 
@@ -0,0 +1,199 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+/*
+ * Espressif Systems Wireless LAN device driver
+ *
+ * Copyright (C) 2015-2021 Espressif Systems (Shanghai) PTE LTD
+ *
+ * This software file (the "File") is distributed by Espressif Systems (Shanghai)
+ * PTE LTD under the terms of the GNU General Public License Version 2, June 1991
+ * (the "License").  You may use, redistribute and/or modify this File in
+ * accordance with the terms and conditions of the License, a copy of which
+ * is available by writing to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA or on the
+ * worldwide web at http://www.gnu.org/licenses/old-licenses/gpl-2.0.txt.
+ *
+ * THE FILE IS DISTRIBUTED AS-IS, WITHOUT WARRANTY OF ANY KIND, AND THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY OR FITNESS FOR A PARTICULAR PURPOSE
+ * ARE EXPRESSLY DISCLAIMED.  The License provides additional details about
+ * this warranty disclaimer.
+ */
+
+/* Datapath tracepoints, under events/esp_hosted in tracefs.
+ * Each record is timestamped by trace buffer. Besides, dequeue and
+ * transfer end carry time spent in transport queue and on bus */
+
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM esp_hosted
+
+#if !defined(_ESP_TRACE_H_) || defined(TRACE_HEADER_MULTI_READ)
+#define _ESP_TRACE_H_
+
+#include <linux/tracepoint.h>
+#include <linux/ktime.h>
+
+/* Network frame passed from stack to transport */
+TRACE_EVENT(esp_tx_enqueue,
+
+	TP_PROTO(u8 if_type, u8 if_num, u32 len, u16 ndev_q, u32 q_depth),
+
+	TP_ARGS(if_type, if_num, len, ndev_q, q_depth),
+
+	TP_STRUCT__entry(
+		__field(u8,  if_type)
+		__field(u8,  if_num)
+		__field(u32, len)
+		__field(u16, ndev_q)
+		__field(u32, q_depth)
+	),
+
+	TP_fast_assign(
+		__entry->if_type = if_type;
+		__entry->if_num = if_num;
+		__entry->len = len;
+		__entry->ndev_q = ndev_q;
+		__entry->q_depth = q_depth;
+	),
+
+	TP_printk("if_type=%u if_num=%u len=%u ndev_q=%u q_depth=%u",
+		__entry->if_type, __entry->if_num, __entry->len,
+		__entry->ndev_q, __entry->q_depth)
+);
+
+/* Frame taken out of transport TX queue, to be sent on bus */
+TRACE_EVENT(esp_tx_dequeue,
+
+	TP_PROTO(u8 if_type, u32 len, u8 prio_q, u32 q_depth, ktime_t enq_time),
+
+	TP_ARGS(if_type, len, prio_q, q_depth, enq_time),
+
+	TP_STRUCT__entry(
+		__field(u8,  if_type)
+		__field(u32, len)
+		__field(u8,  prio_q)
+		__field(u32, q_depth)
+		__field(s64, wait_ns)
+	),
+
+	TP_fast_assign(
+		__entry->if_type = if_type;
+		__entry->len = len;
+		__entry->prio_q = prio_q;
+		__entry->q_depth = q_depth;
+		__entry->wait_ns = ktime_to_ns(enq_time) ?
+			ktime_to_ns(ktime_sub(ktime_get(), enq_time)) : 0;
+	),
+
+	TP_printk("if_type=%u len=%u prio_q=%u q_depth=%u wait_ns=%lld",
+		__entry->if_type, __entry->len, __entry->prio_q,
+		__entry->q_depth, __entry->wait_ns)
+);
+
+/* Bus transaction. SPI is full duplex, SDIO transfers one way at a time */
+TRACE_EVENT(esp_xfer_start,
+
+	TP_PROTO(u32 tx_len, u32 rx_len),
+
+	TP_ARGS(tx_len, rx_len),
+
+	TP_STRUCT__entry(
+		__field(u32, tx_len)
+		__field(u32, rx_len)
+	),
+
+	TP_fast_assign(
+		__entry->tx_len = tx_len;
+		__entry->rx_len = rx_len;
+	),
+
+	TP_printk("tx_len=%u rx_len=%u", __entry->tx_len, __entry->rx_len)
+);
+
+TRACE_EVENT(esp_xfer_end,
+
+	TP_PROTO(u32 tx_len, u32 rx_len, int status, ktime_t start_time),
+
+	TP_ARGS(tx_len, rx_len, status, start_time),
+
+	TP_STRUCT__entry(
+		__field(u32, tx_len)
+		__field(u32, rx_len)
+		__field(int, status)
+		__field(s64, duration_ns)
+	),
+
+	TP_fast_assign(
+		__entry->tx_len = tx_len;
+		__entry->rx_len = rx_len;
+		__entry->status = status;
+		__entry->duration_ns = ktime_to_ns(ktime_sub(ktime_get(), start_time));
+	),
+
+	TP_printk("tx_len=%u rx_len=%u status=%d duration_ns=%lld",
+		__entry->tx_len, __entry->rx_len, __entry->status,
+		__entry->duration_ns)
+);
+
+/* Received frame, as per its interface header */
+TRACE_EVENT(esp_rx_parse,
+
+	TP_PROTO(u8 if_type, u8 if_num, u32 len, u16 offset, u8 flags, u32 q_depth),
+
+	TP_ARGS(if_type, if_num, len, offset, flags, q_depth),
+
+	TP_STRUCT__entry(
+		__field(u8,  if_type)
+		__field(u8,  if_num)
+		__field(u32, len)
+		__field(u16, offset)
+		__field(u8,  flags)
+		__field(u32, q_depth)
+	),
+
+	TP_fast_assign(
+		__entry->if_type = if_type;
+		__entry->if_num = if_num;
+		__entry->len = len;
+		__entry->offset = offset;
+		__entry->flags = flags;
+		__entry->q_depth = q_depth;
+	),
+
+	TP_printk("if_type=%u if_num=%u len=%u offset=%u flags=0x%x q_depth=%u",
+		__entry->if_type, __entry->if_num, __entry->len,
+		__entry->offset, __entry->flags, __entry->q_depth)
+);
+
+/* Network frame passed up to stack */
+TRACE_EVENT(esp_rx_deliver,
+
+	TP_PROTO(u8 if_type, u8 if_num, u32 len, u16 protocol),
+
+	TP_ARGS(if_type, if_num, len, protocol),
+
+	TP_STRUCT__entry(
+		__field(u8,  if_type)
+		__field(u8,  if_num)
+		__field(u32, len)
+		__field(u16, protocol)
+	),
+
+	TP_fast_assign(
+		__entry->if_type = if_type;
+		__entry->if_num = if_num;
+		__entry->len = len;
+		__entry->protocol = protocol;
+	),
+
+	TP_printk("if_type=%u if_num=%u len=%u protocol=0x%04x",
+		__entry->if_type, __entry->if_num, __entry->len,
+		__entry->protocol)
+);
+
+#endif /* _ESP_TRACE_H_ */
+
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE esp_trace
+
+#include <trace/define_trace.h>
@@ -0,0 +1,653 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * Copyright (C) 2015-2021 Espressif Systems (Shanghai) PTE LTD
+ *
+ * This software file (the "File") is distributed by Espressif Systems (Shanghai)
+ * PTE LTD under the terms of the GNU General Public License Version 2, June 1991
+ * (the "License").  You may use, redistribute and/or modify this File in
+ * accordance with the terms and conditions of the License, a copy of which
+ * is available by writing to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA or on the
+ * worldwide web at http://www.gnu.org/licenses/old-licenses/gpl-2.0.txt.
+ *
+ * THE FILE IS DISTRIBUTED AS-IS, WITHOUT WARRANTY OF ANY KIND, AND THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY OR FITNESS FOR A PARTICULAR PURPOSE
+ * ARE EXPRESSLY DISCLAIMED.  The License provides additional details about
+ * this warranty disclaimer.
+ */
+#include "esp_utils.h"
+#include <linux/module.h>
+#include <linux/kthread.h>
+#include <linux/delay.h>
+#include <linux/etherdevice.h>
+#include <linux/rtnetlink.h>
+#include "esp_loopback.h"
+#include "esp_if.h"
+#include "esp_api.h"
+#include "esp_serial.h"
+#include "esp_stats.h"
+#include "esp_fw_verify.h"
+#include "esp_trace.h"
+#include "esp_debugfs.h"
+
+#define TX_MAX_PENDING_COUNT    200
+#define TX_MAX_PENDING_LIMIT    2000
+#define TX_RESUME_THRESHOLD(limit) ((limit)/5)
+/* ESP has few RX buffers, host is not to be flooded either */
+#define RX_MAX_PENDING_COUNT    256
+
+/* Extended capabilities, which make sense without a bus */
+#define LOOPBACK_EXT_CAPABILITIES (ESP_TRANSPORT_AGGREGATION | ESP_TRANSPORT_CRC32)
+
+static unsigned int latency_us;
+module_param(latency_us, uint, 0644);
+MODULE_PARM_DESC(latency_us, "Loopback: min time from host TX to frame echoed back");
+
+static unsigned int bandwidth_kbps;
+module_param(bandwidth_kbps, uint, 0644);
+MODULE_PARM_DESC(bandwidth_kbps, "Loopback: emulated bus bandwidth, shared by both directions (0: unlimited)");
+
+static bool checksum = true;
+module_param(checksum, bool, 0444);
+MODULE_PARM_DESC(checksum, "Loopback: advertise frame checksum, as ESP firmware does by default");
+
+static unsigned int ext_caps = LOOPBACK_EXT_CAPABILITIES;
+module_param(ext_caps, uint, 0444);
+MODULE_PARM_DESC(ext_caps, "Loopback: extended capabilities to advertise, from ESP_EXT_CAPABILITIES");
+
+static struct sk_buff * read_packet(struct esp_adapter *adapter);
+static int write_packet(struct esp_adapter *adapter, struct sk_buff *skb);
+static int queue_packet(struct esp_adapter *adapter, struct sk_buff *skb);
+static void kick_tx(struct esp_adapter *adapter);
+
+static struct esp_loopback_context loopback_context;
+static atomic_t tx_pending;
+
+static struct esp_if_ops if_ops = {
+	.read		= read_packet,
+	.write		= write_packet,
+	.queue		= queue_packet,
+	.kick		= kick_tx,
+};
+
+static struct sk_buff * read_packet(struct esp_adapter *adapter)
+{
+	struct sk_buff *skb = NULL;
+	u8 prio_q_idx = 0;
+
+	if (adapter->state < ESP_CONTEXT_RX_READY)
+		return NULL;
+
+	for (prio_q_idx = 0; prio_q_idx < MAX_PRIORITY_QUEUES; prio_q_idx++) {
+		skb = skb_dequeue(&loopback_context.rx_q[prio_q_idx]);
+		if (skb) {
+			ESP_IF_STATS_INC(adapter, q[prio_q_idx].rx_dequeued);
+			break;
+		}
+	}
+
+	return skb;
+}
+
+static int queue_packet(struct esp_adapter *adapter, struct sk_buff *skb)
+{
+	struct esp_payload_header *payload_header = (struct esp_payload_header *) skb->data;
+	u8 prio_q_idx = ESP_PRIO_Q(payload_header->if_type, payload_header->flags);
+
+	if ((skb->len > LOOPBACK_BUF_SIZE) || (adapter->state < ESP_CONTEXT_RX_READY)) {
+		ESP_IF_STATS_INC(adapter, q[prio_q_idx].tx_dropped);
+		dev_kfree_skb_any(skb);
+		return -EPERM;
+	}
+
+	if (prio_q_idx >= PRIO_Q_DATA_HI) {
+		if (atomic_read(&tx_pending) >= READ_ONCE(adapter->tx_q_limit))
+			esp_tx_pause();
+		atomic_inc(&tx_pending);
+	}
+
+	ESP_IF_STATS_INC(adapter, q[prio_q_idx].tx_enqueued);
+	((struct esp_skb_cb *) skb->cb)->enq_time = ktime_get();
+	skb_queue_tail(&loopback_context.tx_q[prio_q_idx], skb);
+
+	return 0;
+}
+
+static void kick_tx(struct esp_adapter *adapter)
+{
+	wake_up_interruptible(&loopback_context.wait);
+}
+
+static int write_packet(struct esp_adapter *adapter, struct sk_buff *skb)
+{
+	int ret = queue_packet(adapter, skb);
+
+	kick_tx(adapter);
+
+	return ret;
+}
+
+/* Sleep till emulated bus would have moved 'len' bytes, and at least
+ * latency_us passed since 'enq_time' */
+static void loopback_bus_wait(u32 len, ktime_t enq_time)
+{
+	struct esp_loopback_context *context = &loopback_context;
+	unsigned int kbps = READ_ONCE(bandwidth_kbps);
+	unsigned int lat_us = READ_ONCE(latency_us);
+	ktime_t now = ktime_get(), due = now;
+	s64 wait_us = 0;
+
+	if (lat_us && ktime_to_ns(enq_time))
+		due = ktime_add_us(enq_time, lat_us);
+
+	if (kbps) {
+		if (ktime_before(context->bus_free_time, now))
+			context->bus_free_time = now;
+
+		/* bits per kbps is msec */
+		context->bus_free_time = ktime_add_ns(context->bus_free_time,
+				div_u64((u64)len * 8 * NSEC_PER_MSEC, kbps));
+
+		if (ktime_after(context->bus_free_time, due))
+			due = context->bus_free_time;
+	}
+
+	wait_us = ktime_us_delta(due, now);
+	if (wait_us > 0)
+		usleep_range(wait_us, wait_us + 10);
+}
+
+/* Queue frame for host, as read from bus */
+static void loopback_queue_rx(struct sk_buff *skb)
+{
+	struct esp_adapter *adapter = loopback_context.adapter;
+	struct esp_payload_header *header = (struct esp_payload_header *) skb->data;
+	u16 len = le16_to_cpu(header->offset) + le16_to_cpu(header->len);
+	u8 prio_q_idx = ESP_PRIO_Q(header->if_type, header->flags);
+
+	if (adapter->capabilities & ESP_CHECKSUM_ENABLED)
+		esp_set_frame_checksum(skb->data, len);
+
+	ESP_IF_STATS_INC(adapter, xfers);
+	ESP_IF_STATS_INC(adapter, q[prio_q_idx].rx_enqueued);
+	trace_esp_rx_parse(header->if_type, header->if_num, le16_to_cpu(header->len),
+			le16_to_cpu(header->offset), header->flags,
+			skb_queue_len(&loopback_context.rx_q[prio_q_idx]));
+	esp_hist_add(ESP_HIST_RX_SIZE, len);
+
+	skb_queue_tail(&loopback_context.rx_q[prio_q_idx], skb);
+}
+
+/* New frame to host, with 'payload' copied after interface header */
+static struct sk_buff * loopback_alloc_rx(u8 if_type, const void *payload, u16 len)
+{
+	struct esp_payload_header *header = NULL;
+	struct sk_buff *skb = NULL;
+	u16 offset = sizeof(struct esp_payload_header);
+
+	skb = esp_alloc_skb(offset + len);
+	if (!skb)
+		return NULL;
+
+	header = (struct esp_payload_header *) skb_put(skb, offset + len);
+	memset(header, 0, offset);
+
+	header->if_type = if_type;
+	header->len = cpu_to_le16(len);
+	header->offset = cpu_to_le16(offset);
+
+	if (payload)
+		memcpy(skb->data + offset, payload, len);
+
+	return skb;
+}
+
+static void loopback_send_init_event(void)
+{
+	struct esp_payload_header *header = NULL;
+	struct esp_priv_event *event = NULL;
+	struct fw_version fw_ver = {0};
+	struct sk_buff *skb = NULL;
+	u8 *pos = NULL;
+	u32 caps = 0;
+	u8 len = 0;
+
+	skb = loopback_alloc_rx(ESP_PRIV_IF, NULL, 64);
+	if (!skb) {
+		esp_err("Failed to allocate SKB\n");
+		return;
+	}
+
+	header = (struct esp_payload_header *) skb->data;
+	header->priv_pkt_type = ESP_PACKET_TYPE_EVENT;
+
+	event = (struct esp_priv_event *) (skb->data + sizeof(struct esp_payload_header));
+	event->event_type = ESP_PRIV_EVENT_INIT;
+
+	/* TLVs, as ESP firmware sends */
+	pos = event->event_data;
+
+	*pos++ = ESP_PRIV_FIRMWARE_CHIP_ID;
+	*pos++ = 1;
+	*pos++ = ESP_FIRMWARE_CHIP_ESP32;
+
+	*pos++ = ESP_PRIV_CAPABILITY;
+	*pos++ = 1;
+	*pos++ = checksum ? ESP_CHECKSUM_ENABLED : 0;
+
+	*pos++ = ESP_PRIV_CAPABILITY_EXT;
+	*pos++ = 4;
+	caps = ext_caps & LOOPBACK_EXT_CAPABILITIES;
+	*pos++ = caps & 0xff;
+	*pos++ = (caps >> 8) & 0xff;
+	*pos++ = (caps >> 16) & 0xff;
+	*pos++ = (caps >> 24) & 0xff;
+
+	memcpy(fw_ver.project_name, PROJECT_NAME, sizeof(fw_ver.project_name) - 1);
+	fw_ver.major1 = PROJECT_VERSION_MAJOR_1;
+	fw_ver.major2 = PROJECT_VERSION_MAJOR_2;
+	fw_ver.minor = PROJECT_VERSION_MINOR;
+	fw_ver.revision_patch_1 = PROJECT_REVISION_PATCH_1;
+	fw_ver.revision_patch_2 = PROJECT_REVISION_PATCH_2;
+
+	*pos++ = ESP_PRIV_FW_DATA;
+	*pos++ = sizeof(fw_ver);
+	memcpy(pos, &fw_ver, sizeof(fw_ver));
+	pos += sizeof(fw_ver);
+
+	len = pos - event->event_data;
+	event->event_len = len;
+
+	/* payload len = Event len + sizeof(event type) + sizeof(event len) */
+	header->len = cpu_to_le16(len + 2);
+	skb_trim(skb, sizeof(struct esp_payload_header) + len + 2);
+
+	/* Not checksummed by host till capabilities are known */
+	skb_queue_tail(&loopback_context.rx_q[PRIO_Q_OTHERS], skb);
+	esp_process_new_packet_intr(loopback_context.adapter);
+}
+
+/* Sends copy of test frame back, with new command */
+static void loopback_test_reply(struct esp_test_hdr *test_hdr, u16 len, u8 cmd)
+{
+	struct sk_buff *skb = loopback_alloc_rx(ESP_TEST_IF, test_hdr, len);
+
+	if (!skb)
+		return;
+
+	((struct esp_test_hdr *) (skb->data + sizeof(struct esp_payload_header)))->cmd = cmd;
+	loopback_queue_rx(skb);
+}
+
+/* Raw throughput benchmark, as handled by ESP firmware */
+static void loopback_process_test(u8 *payload, u16 len)
+{
+	struct esp_loopback_test *test = &loopback_context.test;
+	struct esp_test_hdr *test_hdr = (struct esp_test_hdr *) payload;
+
+	if ((len < sizeof(struct esp_test_hdr)) ||
+	    (le16_to_cpu(test_hdr->magic) != ESP_TEST_MAGIC))
+		return;
+
+	switch (test_hdr->cmd) {
+	case ESP_TEST_CMD_DATA:
+		test->rx_frames++;
+		test->rx_bytes += len;
+		break;
+
+	case ESP_TEST_CMD_START:
+		memset(test, 0, sizeof(*test));
+		test->frame_len = le16_to_cpu(test_hdr->frame_len);
+		test->end_time = ktime_add_ms(ktime_get(), le32_to_cpu(test_hdr->duration_ms));
+		test->streaming = (test_hdr->flags & ESP_TEST_START_ESP_TO_HOST) &&
+			(test->frame_len >= sizeof(struct esp_test_hdr)) &&
+			(test->frame_len <= ESP_TEST_FRAME_LEN_MAX);
+		break;
+
+	case ESP_TEST_CMD_STOP:
+		test->streaming = 0;
+		test_hdr->tx_frames = cpu_to_le64(test->tx_frames);
+		test_hdr->tx_bytes = cpu_to_le64(test->tx_bytes);
+		test_hdr->rx_frames = cpu_to_le64(test->rx_frames);
+		test_hdr->rx_bytes = cpu_to_le64(test->rx_bytes);
+		loopback_test_reply(test_hdr, sizeof(struct esp_test_hdr), ESP_TEST_CMD_REPORT);
+		break;
+
+	case ESP_TEST_CMD_PING:
+		loopback_test_reply(test_hdr, len, ESP_TEST_CMD_PONG);
+		break;
+
+	default:
+		break;
+	}
+}
+
+/* Stream DATA frame of running benchmark */
+static void loopback_test_stream(void)
+{
+	struct esp_loopback_test *test = &loopback_context.test;
+	struct esp_test_hdr test_hdr = {0};
+	struct sk_buff *skb = NULL;
+
+	if (!ktime_before(ktime_get(), test->end_time)) {
+		test->streaming = 0;
+		return;
+	}
+
+	/* Host is behind, as if bus was held off */
+	if (skb_queue_len(&loopback_context.rx_q[PRIO_Q_OTHERS]) >= RX_MAX_PENDING_COUNT) {
+		usleep_range(50, 100);
+		return;
+	}
+
+	skb = loopback_alloc_rx(ESP_TEST_IF, NULL, test->frame_len);
+	if (!skb)
+		return;
+
+	test_hdr.magic = cpu_to_le16(ESP_TEST_MAGIC);
+	test_hdr.cmd = ESP_TEST_CMD_DATA;
+	memset(skb->data + sizeof(struct esp_payload_header), 0, test->frame_len);
+	memcpy(skb->data + sizeof(struct esp_payload_header), &test_hdr, sizeof(test_hdr));
+
+	loopback_bus_wait(skb->len, 0);
+	loopback_queue_rx(skb);
+
+	test->tx_frames++;
+	test->tx_bytes += test->frame_len;
+}
+
+/* Handle single (not aggregated) frame from host, as ESP would */
+static void loopback_process_frame(u8 *frame, u16 frame_len)
+{
+	struct esp_payload_header *header = (struct esp_payload_header *) frame;
+	u16 offset = le16_to_cpu(header->offset);
+	u16 len = le16_to_cpu(header->len);
+	struct ethhdr *eth = NULL;
+	struct sk_buff *skb = NULL;
+	u8 mac[ETH_ALEN];
+
+	if ((offset < sizeof(struct esp_payload_header)) || (offset + len > frame_len)) {
+		esp_err("Invalid frame: offset[%u] len[%u]\n", offset, len);
+		return;
+	}
+
+	switch (header->if_type) {
+	case ESP_STA_IF:
+	case ESP_AP_IF:
+	case ESP_SERIAL_IF:
+	case ESP_HCI_IF:
+		/* Copy into new skb, as transport reads into its own buffer */
+		skb = loopback_alloc_rx(header->if_type, frame + offset, len);
+		if (!skb)
+			return;
+
+		header = (struct esp_payload_header *) skb->data;
+		header->if_num = ((struct esp_payload_header *) frame)->if_num;
+		header->flags = ((struct esp_payload_header *) frame)->flags & FRAME_PRIO_HIGH;
+		header->hci_pkt_type = ((struct esp_payload_header *) frame)->hci_pkt_type;
+
+		/* Echo of network frame is addressed to host */
+		if (((header->if_type == ESP_STA_IF) || (header->if_type == ESP_AP_IF)) &&
+		    (len >= ETH_HLEN)) {
+			eth = (struct ethhdr *) (skb->data + sizeof(struct esp_payload_header));
+			memcpy(mac, eth->h_dest, ETH_ALEN);
+			memcpy(eth->h_dest, eth->h_source, ETH_ALEN);
+			memcpy(eth->h_source, mac, ETH_ALEN);
+		}
+
+		loopback_queue_rx(skb);
+		break;
+
+	case ESP_PRIV_IF:
+		esp_verbose("Host event consumed\n");
+		break;
+
+	case ESP_TEST_IF:
+		loopback_process_test(frame + offset, len);
+		break;
+
+	default:
+		break;
+	}
+}
+
+static void loopback_process_tx(struct sk_buff *skb)
+{
+	struct esp_payload_header *header = (struct esp_payload_header *) skb->data;
+	u32 pos = 0, end = 0, frame_len = 0;
+
+	if (!(header->flags & AGGREGATED_FRAME)) {
+		loopback_process_frame(skb->data, skb->len);
+		return;
+	}
+
+	pos = le16_to_cpu(header->offset);
+	end = min_t(u32, pos + le16_to_cpu(header->len), skb->len);
+
+	while (pos + sizeof(struct esp_payload_header) <= end) {
+		header = (struct esp_payload_header *) (skb->data + pos);
+		frame_len = le16_to_cpu(header->offset) + le16_to_cpu(header->len);
+
+		if (!header->len || (pos + frame_len > end))
+			break;
+
+		loopback_process_frame(skb->data + pos, frame_len);
+		pos += AGGR_FRAME_ALIGN(frame_len);
+	}
+}
+
+static struct sk_buff * loopback_dequeue_tx_skb(ktime_t *enq_time)
+{
+	struct esp_loopback_context *context = &loopback_context;
+	struct sk_buff *skb = NULL;
+	u8 prio_q_idx = 0;
+
+	for (prio_q_idx = 0; prio_q_idx < MAX_PRIORITY_QUEUES; prio_q_idx++) {
+		skb = skb_dequeue(&context->tx_q[prio_q_idx]);
+		if (skb) {
+			trace_esp_tx_dequeue(((struct esp_payload_header *) skb->data)->if_type,
+					skb->len, prio_q_idx,
+					skb_queue_len(&context->tx_q[prio_q_idx]),
+					((struct esp_skb_cb *) skb->cb)->enq_time);
+			ESP_IF_STATS_INC(context->adapter, q[prio_q_idx].tx_dequeued);
+			/* Cleared on dequeue, latency counts from it */
+			*enq_time = ((struct esp_skb_cb *) skb->cb)->enq_time;
+			esp_tx_dequeued(skb);
+			return skb;
+		}
+	}
+
+	return NULL;
+}
+
+static inline int loopback_tx_ready(void)
+{
+	u8 prio_q_idx = 0;
+
+	for (prio_q_idx = 0; prio_q_idx < MAX_PRIORITY_QUEUES; prio_q_idx++) {
+		if (!skb_queue_empty(&loopback_context.tx_q[prio_q_idx]))
+			return 1;
+	}
+
+	return 0;
+}
+
+/* ESP side: takes frames written by host, one at a time, as bus would */
+static int loopback_process(void *data)
+{
+	struct esp_loopback_context *context = &loopback_context;
+	u8 aggr_cnt[MAX_PRIORITY_QUEUES] = {0};
+	struct sk_buff *skb = NULL;
+	ktime_t enq_time = 0, start_time = 0;
+	u8 prio_q_idx = 0;
+
+	while (!kthread_should_stop()) {
+
+		wait_event_interruptible(context->wait, kthread_should_stop() ||
+				loopback_tx_ready() || context->test.streaming);
+
+		skb = loopback_dequeue_tx_skb(&enq_time);
+
+		if (skb) {
+			/* Same as SPI, as ESP takes up to a buffer per transaction */
+			memset(aggr_cnt, 0, sizeof(aggr_cnt));
+			skb = esp_aggregate_tx_skb(skb, context->tx_q,
+					LOOPBACK_BUF_SIZE, aggr_cnt);
+
+			for (prio_q_idx = 0; prio_q_idx < MAX_PRIORITY_QUEUES; prio_q_idx++)
+				ESP_IF_STATS_ADD(context->adapter,
+						q[prio_q_idx].tx_dequeued, aggr_cnt[prio_q_idx]);
+
+			if (atomic_read(&tx_pending))
+				atomic_dec(&tx_pending);
+
+			while (aggr_cnt[PRIO_Q_DATA_HI]--)
+				atomic_dec_if_positive(&tx_pending);
+			while (aggr_cnt[PRIO_Q_OTHERS]--)
+				atomic_dec_if_positive(&tx_pending);
+
+			if (atomic_read(&tx_pending) <
+			    TX_RESUME_THRESHOLD(READ_ONCE(context->adapter->tx_q_limit))) {
+				esp_tx_resume();
+				esp_raw_tp_queue_resume();
+			}
+
+			start_time = ktime_get();
+			trace_esp_xfer_start(skb->len, 0);
+			loopback_bus_wait(skb->len, enq_time);
+			trace_esp_xfer_end(skb->len, 0, 0, start_time);
+			esp_hist_add_us_since(ESP_HIST_XFER_US, start_time);
+
+			loopback_process_tx(skb);
+			dev_kfree_skb(skb);
+		} else if (context->test.streaming) {
+			loopback_test_stream();
+		}
+
+		esp_process_new_packet_intr(context->adapter);
+	}
+
+	return 0;
+}
+
+int process_init_event(u8 *evt_buf, u8 len)
+{
+	u8 len_left = len, tag_len;
+	u8 *pos;
+	int ret = 0;
+	struct esp_adapter *adapter = esp_get_adapter();
+	struct esp_private *priv = NULL;
+	u8 i = 0;
+
+	if (!evt_buf)
+		return -1;
+
+	pos = evt_buf;
+	adapter->ext_capabilities = 0;
+
+	while (len_left) {
+		tag_len = *(pos + 1);
+		if (*pos == ESP_PRIV_CAPABILITY) {
+			adapter->capabilities = *(pos + 2);
+		} else if (*pos == ESP_PRIV_CAPABILITY_EXT) {
+			adapter->ext_capabilities = (*(pos + 2) | (*(pos + 3) << 8) |
+					(*(pos + 4) << 16) | ((u32)*(pos + 5) << 24)) &
+					ESP_HOST_EXT_CAPABILITIES;
+		} else if (*pos == ESP_PRIV_FW_DATA) {
+			ret = process_fw_data((struct fw_version *)(pos + 2), tag_len);
+			if (ret) {
+				esp_err("Incompatible ESP Firmware detected\n");
+				return -1;
+			}
+		}
+		pos += (tag_len+2);
+		len_left -= (tag_len+2);
+	}
+
+	adapter->state = ESP_CONTEXT_READY;
+
+	ret = esp_add_card(adapter);
+	if (ret) {
+		esp_err("network interface init failed\n");
+		adapter->state = ESP_CONTEXT_DISABLED;
+		return ret;
+	}
+
+	/* No MAC address from ESP, without control path */
+	rtnl_lock();
+	for (i = 0; i < ESP_MAX_INTERFACE; i++) {
+		priv = adapter->priv[i];
+		if (priv && priv->ndev && is_zero_ether_addr(priv->ndev->dev_addr))
+			eth_hw_addr_random(priv->ndev);
+	}
+	rtnl_unlock();
+
+	process_capabilities(adapter->capabilities);
+	esp_info("loopback: latency_us[%u] bandwidth_kbps[%u]\n",
+			latency_us, bandwidth_kbps);
+
+	return 0;
+}
+
+int esp_init_interface_layer(struct esp_adapter *adapter)
+{
+	u8 prio_q_idx = 0;
+
+	if (!adapter)
+		return -EINVAL;
+
+	memset(&loopback_context, 0, sizeof(loopback_context));
+
+	adapter->if_context = &loopback_context;
+	adapter->if_ops = &if_ops;
+	adapter->if_type = ESP_IF_TYPE_LOOPBACK;
+	loopback_context.adapter = adapter;
+
+	adapter->tx_q_limit = TX_MAX_PENDING_COUNT;
+	adapter->tx_q_limit_max = TX_MAX_PENDING_LIMIT;
+
+	for (prio_q_idx = 0; prio_q_idx < MAX_PRIORITY_QUEUES; prio_q_idx++) {
+		skb_queue_head_init(&loopback_context.tx_q[prio_q_idx]);
+		skb_queue_head_init(&loopback_context.rx_q[prio_q_idx]);
+	}
+
+	init_waitqueue_head(&loopback_context.wait);
+	atomic_set(&tx_pending, 0);
+
+	loopback_context.thread = kthread_run(loopback_process, NULL, "esp_loopback");
+	if (IS_ERR(loopback_context.thread)) {
+		esp_err("Failed to create loopback thread\n");
+		loopback_context.thread = NULL;
+		return -EFAULT;
+	}
+
+	adapter->state = ESP_CONTEXT_RX_READY;
+
+	/* As ESP does, once it is up */
+	loopback_send_init_event();
+
+	return 0;
+}
+
+void esp_deinit_interface_layer(void)
+{
+	struct esp_loopback_context *context = &loopback_context;
+	u8 prio_q_idx = 0;
+
+	if (!context->adapter)
+		return;
+
+	context->adapter->state = ESP_CONTEXT_DISABLED;
+
+	if (context->thread) {
+		kthread_stop(context->thread);
+		context->thread = NULL;
+	}
+
+	esp_remove_card(context->adapter);
+
+	for (prio_q_idx = 0; prio_q_idx < MAX_PRIORITY_QUEUES; prio_q_idx++) {
+		skb_queue_purge(&context->tx_q[prio_q_idx]);
+		skb_queue_purge(&context->rx_q[prio_q_idx]);
+	}
+}
@@ -0,0 +1,50 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * Copyright (C) 2015-2021 Espressif Systems (Shanghai) PTE LTD
+ *
+ * This software file (the "File") is distributed by Espressif Systems (Shanghai)
+ * PTE LTD under the terms of the GNU General Public License Version 2, June 1991
+ * (the "License").  You may use, redistribute and/or modify this File in
+ * accordance with the terms and conditions of the License, a copy of which
+ * is available by writing to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA or on the
+ * worldwide web at http://www.gnu.org/licenses/old-licenses/gpl-2.0.txt.
+ *
+ * THE FILE IS DISTRIBUTED AS-IS, WITHOUT WARRANTY OF ANY KIND, AND THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY OR FITNESS FOR A PARTICULAR PURPOSE
+ * ARE EXPRESSLY DISCLAIMED.  The License provides additional details about
+ * this warranty disclaimer.
+ */
+#ifndef _ESP_LOOPBACK_H_
+#define _ESP_LOOPBACK_H_
+
+#include "esp.h"
+
+/* Largest frame accepted from host, as SPI transport */
+#define LOOPBACK_BUF_SIZE       1600
+
+/* Raw throughput benchmark, ESP side */
+struct esp_loopback_test {
+	u8                          streaming;
+	u16                         frame_len;
+	ktime_t                     end_time;
+	u64                         tx_frames;
+	u64                         tx_bytes;
+	u64                         rx_frames;
+	u64                         rx_bytes;
+};
+
+/* Emulates ESP firmware: frames written by host are echoed back, after
+ * configured latency and at configured bus bandwidth */
+struct esp_loopback_context {
+	struct esp_adapter          *adapter;
+	struct sk_buff_head         tx_q[MAX_PRIORITY_QUEUES];
+	struct sk_buff_head         rx_q[MAX_PRIORITY_QUEUES];
+	struct task_struct          *thread;
+	wait_queue_head_t           wait;
+	/* Emulated bus is busy till then */
+	ktime_t                     bus_free_time;
+	struct esp_loopback_test    test;
+};
+
+#endif
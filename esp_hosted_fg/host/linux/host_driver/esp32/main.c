@@ -27,6 +27,8 @@
 #include <linux/etherdevice.h>
 #include <linux/netdevice.h>
 #include <linux/gpio.h>
+#include <linux/crc32.h>
+#include <linux/pkt_sched.h>
 
 #include "esp.h"
 #include "esp_if.h"
@@ -35,6 +37,15 @@
 #include "esp_api.h"
 #include "esp_kernel_port.h"
 #include "esp_stats.h"
+#include "esp_debugfs.h"
+#ifdef ESP_XDP_SUPPORT
+#include <linux/filter.h>
+#include <linux/bpf_trace.h>
+#endif
+
+/* Last, as other tracepoint headers included after this are created too */
+#define CREATE_TRACE_POINTS
+#include "esp_trace.h"
 
 /* Module parameters */
 /* You can hardcode the parameters if do not wish to pass them as argument to insmod */
@@ -45,6 +56,7 @@ static int spi_cs = MOD_PARAM_UNINITIALISED;
 static int spi_mode = MOD_PARAM_UNINITIALISED; /* 1/2/3 */
 static int spi_handshake = MOD_PARAM_UNINITIALISED;
 static int spi_dataready = MOD_PARAM_UNINITIALISED;
+static int spi_poll_us = MOD_PARAM_UNINITIALISED;
 
 MODULE_LICENSE("GPL");
 MODULE_AUTHOR("Amey Inamdar <amey.inamdar@espressif.com>");
@@ -74,6 +86,9 @@ MODULE_PARM_DESC(spi_handshake, "SPI: Handshake GPIO number");
 module_param(spi_dataready, int, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
 MODULE_PARM_DESC(spi_dataready, "SPI: Data Ready GPIO number");
 
+module_param(spi_poll_us, int, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+MODULE_PARM_DESC(spi_poll_us, "SPI: idle time (usec) after which GPIO polling under load falls back to interrupts, 0 (default) to always use interrupts");
+
 struct esp_adapter adapter;
 volatile u8 stop_data = 0;
 
@@ -106,23 +121,37 @@ static inline void ether_addr_copy(u8 *dst, const u8 *src)
 static int esp_open(struct net_device *ndev);
 static int esp_stop(struct net_device *ndev);
 static int esp_hard_start_xmit(struct sk_buff *skb, struct net_device *ndev);
+static NDO_SELECT_QUEUE_PROTOTYPE();
 static int esp_set_mac_address(struct net_device *ndev, void *addr);
 static struct net_device_stats* esp_get_stats(struct net_device *ndev);
 static void esp_set_rx_mode(struct net_device *ndev);
 static int process_tx_packet (struct sk_buff *skb);
+static void esp_tx_done(struct esp_private *priv, u16 q, u32 len);
 static NDO_TX_TIMEOUT_PROTOTYPE();
 int esp_send_packet(struct esp_adapter *adapter, struct sk_buff *skb);
+static int esp_queue_packet(struct esp_adapter *adapter, struct sk_buff *skb);
+static void esp_tx_kick(struct esp_adapter *adapter);
+#ifdef ESP_XDP_SUPPORT
+static int esp_xdp(struct net_device *ndev, struct netdev_bpf *bpf);
+static int esp_xdp_xmit(struct net_device *ndev, int n,
+		struct xdp_frame **frames, u32 flags);
+#endif
 struct sk_buff * esp_alloc_skb(u32 len);
 
 static const struct net_device_ops esp_netdev_ops = {
 	.ndo_open = esp_open,
 	.ndo_stop = esp_stop,
 	.ndo_start_xmit = esp_hard_start_xmit,
+	.ndo_select_queue = esp_select_queue,
 	.ndo_set_mac_address = esp_set_mac_address,
 	.ndo_validate_addr = eth_validate_addr,
 	.ndo_tx_timeout = esp_tx_timeout,
 	.ndo_get_stats = esp_get_stats,
 	.ndo_set_rx_mode = esp_set_rx_mode,
+#ifdef ESP_XDP_SUPPORT
+	.ndo_bpf = esp_xdp,
+	.ndo_xdp_xmit = esp_xdp_xmit,
+#endif
 };
 
 struct esp_adapter * esp_get_adapter(void)
@@ -132,13 +161,21 @@ struct esp_adapter * esp_get_adapter(void)
 
 static int esp_open(struct net_device *ndev)
 {
-	netif_start_queue(ndev);
+	struct esp_private *priv = netdev_priv(ndev);
+	u8 q = 0;
+
+	for (q = 0; q < ESP_NDEV_TX_QUEUES; q++) {
+		atomic_set(&priv->tx_pending[q], 0);
+		netdev_tx_reset_queue(netdev_get_tx_queue(ndev, q));
+	}
+
+	netif_tx_start_all_queues(ndev);
 	return 0;
 }
 
 static int esp_stop(struct net_device *ndev)
 {
-	netif_stop_queue(ndev);
+	netif_tx_stop_all_queues(ndev);
 	return 0;
 }
 
@@ -169,6 +206,38 @@ static void esp_set_rx_mode(struct net_device *ndev)
 {
 }
 
+/* Latency sensitive traffic, as per DSCP or socket priority, goes to high
+ * priority queue. DSCP rule is the same as used by ESP in other direction */
+static NDO_SELECT_QUEUE_PROTOTYPE()
+{
+	u8 buf[2], *ip = NULL;
+	u8 dscp = 0;
+
+	if ((skb->priority == TC_PRIO_INTERACTIVE) ||
+	    (skb->priority == TC_PRIO_CONTROL))
+		return ESP_NDEV_Q_HIGH;
+
+	if (skb->len < ETH_HLEN)
+		return ESP_NDEV_Q_NORMAL;
+
+	ip = skb_header_pointer(skb, ETH_HLEN, sizeof(buf), buf);
+	if (!ip)
+		return ESP_NDEV_Q_NORMAL;
+
+	switch (((struct ethhdr *) skb->data)->h_proto) {
+	case htons(ETH_P_IP):
+		dscp = ESP_IPV4_DSCP(ip);
+		break;
+	case htons(ETH_P_IPV6):
+		dscp = ESP_IPV6_DSCP(ip);
+		break;
+	default:
+		break;
+	}
+
+	return (dscp >= ESP_DSCP_PRIO_HIGH_MIN) ? ESP_NDEV_Q_HIGH : ESP_NDEV_Q_NORMAL;
+}
+
 static int esp_hard_start_xmit(struct sk_buff *skb, struct net_device *ndev)
 {
 	struct esp_private *priv = netdev_priv(ndev);
@@ -240,8 +309,13 @@ static struct esp_private * get_priv_from_payload_header(struct esp_payload_head
 
 void esp_process_new_packet_intr(struct esp_adapter *adapter)
 {
-	if(adapter)
-		queue_work(adapter->if_rx_workqueue, &adapter->if_rx_work);
+	if (adapter) {
+		/* Called from transport thread, so let NET_RX softirq run
+		 * right away on local_bh_enable() */
+		local_bh_disable();
+		napi_schedule(&adapter->napi);
+		local_bh_enable();
+	}
 }
 
 static int process_tx_packet (struct sk_buff *skb)
@@ -249,12 +323,11 @@ static int process_tx_packet (struct sk_buff *skb)
 	struct esp_private *priv = NULL;
 	struct esp_skb_cb *cb = NULL;
 	struct esp_payload_header *payload_header = NULL;
-	struct sk_buff *new_skb = NULL;
 	int ret = 0;
-	u8 pad_len = 0, realloc_skb = 0;
+	int pad_len = 0;
 	u16 len = 0;
-	u16 total_len = 0;
-	u8 *pos = NULL;
+	u16 q = skb_get_queue_mapping(skb);
+	bool more = ESP_XMIT_MORE(skb);
 
 	/* Get the priv */
 	cb = (struct esp_skb_cb *) skb->cb;
@@ -265,82 +338,73 @@ static int process_tx_packet (struct sk_buff *skb)
 		return NETDEV_TX_OK;
 	}
 
-	if (netif_queue_stopped((const struct net_device *) adapter.priv[0]->ndev) ||
-			netif_queue_stopped((const struct net_device *) adapter.priv[1]->ndev)) {
+	if (__netif_subqueue_stopped(priv->ndev, q))
 		return NETDEV_TX_BUSY;
-	}
 
 	len = skb->len;
 
-	/* Create space for payload header */
-	pad_len = sizeof(struct esp_payload_header);
-
-	total_len = len + pad_len;
-
-	/* Align buffer length */
-	pad_len += SKB_DATA_ADDR_ALIGNMENT - (total_len % SKB_DATA_ADDR_ALIGNMENT);
-
-	if (skb_headroom(skb) < pad_len) {
-		/* Headroom is not sufficient */
-		realloc_skb = 1;
-	}
-
-	if (realloc_skb || !IS_ALIGNED((unsigned long) skb->data, SKB_DATA_ADDR_ALIGNMENT)) {
-		/* Realloc SKB */
-		if (skb_linearize(skb)) {
-			priv->stats.tx_errors++;
-			dev_kfree_skb(skb);
-			return NETDEV_TX_OK;
-		}
-
-		new_skb = esp_alloc_skb(skb->len + pad_len);
-
-		if (!new_skb) {
-			esp_err("Failed to allocate SKB\n");
-			priv->stats.tx_errors++;
-			dev_kfree_skb(skb);
-			return NETDEV_TX_OK;
-		}
-
-		pos = new_skb->data;
-		pos += pad_len;
-
-		/* Populate new SKB */
-		skb_copy_from_linear_data(skb, pos, skb->len);
-		skb_put(new_skb, skb->len + pad_len);
-
-		/* Replace old SKB */
-		dev_kfree_skb_any(skb);
-		skb = new_skb;
-	} else {
-		/* Realloc is not needed, Make space for interface header */
-		skb_push(skb, pad_len);
+	/* Make space for interface header, skb is normally not copied */
+	pad_len = esp_tx_push_header(priv->adapter, skb);
+	if (pad_len < 0) {
+		priv->stats.tx_errors++;
+		dev_kfree_skb(skb);
+		if (!more)
+			esp_tx_kick(priv->adapter);
+		return NETDEV_TX_OK;
 	}
 
 	/* Set payload header */
 	payload_header = (struct esp_payload_header *) skb->data;
-	memset(payload_header, 0, pad_len);
 
 	payload_header->if_type = priv->if_type;
 	payload_header->if_num = priv->if_num;
 	payload_header->len = cpu_to_le16(len);
 	payload_header->offset = cpu_to_le16(pad_len);
 
+	if (q == ESP_NDEV_Q_HIGH)
+		payload_header->flags |= FRAME_PRIO_HIGH;
+
 	if (adapter.capabilities & ESP_CHECKSUM_ENABLED)
-		payload_header->checksum = cpu_to_le16(compute_checksum(skb->data, (len + pad_len)));
+		esp_set_frame_checksum(skb->data, (len + pad_len));
 
 	if (!stop_data) {
-		ret = esp_send_packet(priv->adapter, skb);
+		/* Account before queueing, transport may dequeue it right away.
+		 * BQL limits bytes held in transport queue, rest stays in qdisc */
+		netdev_tx_sent_queue(netdev_get_tx_queue(priv->ndev, q), len);
+
+		trace_esp_tx_enqueue(priv->if_type, priv->if_num, len, q,
+				atomic_read(&priv->tx_pending[q]));
+
+		if (atomic_inc_return(&priv->tx_pending[q]) >= ESP_NDEV_Q_STOP_THRESHOLD) {
+			netif_stop_subqueue(priv->ndev, q);
+
+			/* Transport may have drained it meanwhile */
+			smp_mb__after_atomic();
+			if (atomic_read(&priv->tx_pending[q]) < ESP_NDEV_Q_WAKE_THRESHOLD)
+				netif_wake_subqueue(priv->ndev, q);
+		}
+
+		/* Burst from stack is queued as a whole, transport is kicked
+		 * once at its end. Stopped queue ends the burst early */
+		if (more && !netif_xmit_stopped(netdev_get_tx_queue(priv->ndev, q)))
+			ret = esp_queue_packet(priv->adapter, skb);
+		else
+			ret = esp_send_packet(priv->adapter, skb);
 
 		if (ret) {
+			/* skb is freed by transport */
+			esp_tx_done(priv, q, len);
 			priv->stats.tx_errors++;
 		} else {
 			priv->stats.tx_packets++;
-			priv->stats.tx_bytes += skb->len;
+			/* skb is owned by transport now */
+			priv->stats.tx_bytes += len;
 		}
 	} else {
 		dev_kfree_skb_any(skb);
 		priv->stats.tx_dropped++;
+		if (!more)
+			esp_tx_kick(priv->adapter);
 	}
 
 	return 0;
@@ -360,6 +424,58 @@ void process_capabilities(u8 cap)
 	}
 }
 
+static int esp_send_host_init_event(struct esp_adapter *adapter)
+{
+	struct esp_payload_header *header = NULL;
+	struct esp_priv_event *event = NULL;
+	struct sk_buff *skb = NULL;
+	u8 *pos = NULL;
+	u16 len = 0;
+	u32 ext_cap = adapter->ext_capabilities;
+
+	skb = esp_alloc_skb(sizeof(struct esp_payload_header) +
+			sizeof(struct esp_priv_event) + 2 + sizeof(ext_cap));
+	if (!skb) {
+		esp_err("Failed to allocate SKB\n");
+		return -ENOMEM;
+	}
+
+	header = (struct esp_payload_header *) skb->data;
+	memset(header, 0, sizeof(struct esp_payload_header));
+
+	header->if_type = ESP_PRIV_IF;
+	header->if_num = 0;
+	header->offset = cpu_to_le16(sizeof(struct esp_payload_header));
+	header->priv_pkt_type = ESP_PACKET_TYPE_EVENT;
+
+	event = (struct esp_priv_event *) (skb->data + sizeof(struct esp_payload_header));
+	event->event_type = ESP_PRIV_EVENT_HOST_INIT;
+
+	/* TLV - Extended capabilities enabled by host */
+	pos = event->event_data;
+	*pos = ESP_PRIV_CAPABILITY_EXT;     pos++;len++;
+	*pos = sizeof(ext_cap);             pos++;len++;
+	*pos = ext_cap & 0xff;              pos++;len++;
+	*pos = (ext_cap >> 8) & 0xff;       pos++;len++;
+	*pos = (ext_cap >> 16) & 0xff;      pos++;len++;
+	*pos = (ext_cap >> 24) & 0xff;      pos++;len++;
+
+	event->event_len = len;
+
+	/* payload len = Event len + sizeof(event type) + sizeof(event len) */
+	len += 2;
+	header->len = cpu_to_le16(len);
+
+	skb_put(skb, len + sizeof(struct esp_payload_header));
+
+	if (adapter->capabilities & ESP_CHECKSUM_ENABLED)
+		esp_set_frame_checksum(skb->data, skb->len);
+
+	esp_info("Host extended capabilities: 0x%x\n", ext_cap);
+
+	return esp_send_packet(adapter, skb);
+}
+
 static void process_event(u8 *evt_buf, u16 len)
 {
 	int ret = 0;
@@ -378,7 +494,9 @@ static void process_event(u8 *evt_buf, u16 len)
 		if (ret)
 			esp_err("Failed to init serial interface\n");
 
-		process_init_event(event->event_data, event->event_len);
+		ret = process_init_event(event->event_data, event->event_len);
+		if (!ret && adapter.ext_capabilities)
+			esp_send_host_init_event(&adapter);
 
 	} else {
 		esp_warn("Drop unknown event\n");
@@ -414,13 +532,335 @@ static void esp_events_work(struct work_struct *work)
 	}
 }
 
+/* Checksum of frame (header included), as per its FRAME_CRC32 flag */
+u16 esp_frame_checksum(u8 *frame, u16 len)
+{
+	struct esp_payload_header *header = (struct esp_payload_header *) frame;
+
+	/* crc32_le() is arch optimized where available, e.g. arm64 crc32 insns */
+	if (header->flags & FRAME_CRC32)
+		return ESP_CRC32_FOLD(~crc32_le(~0, frame, len));
+
+	return compute_checksum(frame, len);
+}
+
+void esp_set_frame_checksum(u8 *frame, u16 len)
+{
+	struct esp_payload_header *header = (struct esp_payload_header *) frame;
+
+	header->checksum = 0;
+
+	if (adapter.ext_capabilities & ESP_TRANSPORT_CRC32)
+		header->flags |= FRAME_CRC32;
+
+	header->checksum = cpu_to_le16(esp_frame_checksum(frame, len));
+}
+
+/* Push zeroed interface header in front of skb data and pad frame to aligned
+ * length. Header is aligned by growing the offset, so payload stays where it
+ * is. Realloc is only needed if stack ignored needed_headroom/tailroom, or
+ * header is shared with a clone. Returns offset of payload, skb untouched on
+ * failure. */
+int esp_tx_push_header(struct esp_adapter *adapter, struct sk_buff *skb)
+{
+	int head_len = 0, tail_len = 0;
+	u16 pad_len = 0;
+
+	if (skb_linearize(skb))
+		return -ENOMEM;
+
+	if (skb_headroom(skb) < ESP_TX_HEADROOM)
+		head_len = ESP_TX_HEADROOM - skb_headroom(skb);
+
+	if (skb_tailroom(skb) < ESP_TX_TAILROOM)
+		tail_len = ESP_TX_TAILROOM - skb_tailroom(skb);
+
+	if (head_len || tail_len || skb_header_cloned(skb)) {
+		atomic_inc(&adapter->tx_realloc_count);
+
+		if (pskb_expand_head(skb, head_len, tail_len, GFP_ATOMIC))
+			return -ENOMEM;
+	}
+
+	pad_len = sizeof(struct esp_payload_header);
+	pad_len += ((unsigned long) skb->data - pad_len) & (SKB_DATA_ADDR_ALIGNMENT - 1);
+
+	tail_len = ALIGN(skb->len + pad_len, SKB_DATA_ADDR_ALIGNMENT) -
+		(skb->len + pad_len);
+
+	memset(skb_push(skb, pad_len), 0, pad_len);
+
+	if (tail_len)
+		memset(skb_put(skb, tail_len), 0, tail_len);
+
+	return pad_len;
+}
+
+#ifdef ESP_XDP_SUPPORT
+static int esp_xdp_init(struct esp_private *priv)
+{
+	int ret = 0;
+
+	ret = xdp_rxq_info_reg(&priv->xdp_rxq, priv->ndev, 0, 0);
+	if (ret)
+		return ret;
+
+	ret = xdp_rxq_info_reg_mem_model(&priv->xdp_rxq, MEM_TYPE_PAGE_SHARED, NULL);
+	if (ret) {
+		xdp_rxq_info_unreg(&priv->xdp_rxq);
+		return ret;
+	}
+
+	ESP_XDP_SET_FEATURES(priv->ndev);
+
+	return 0;
+}
+
+static void esp_xdp_deinit(struct esp_private *priv)
+{
+	/* Program, if any, is already removed by unregister_netdev() */
+	if (xdp_rxq_info_is_reg(&priv->xdp_rxq))
+		xdp_rxq_info_unreg(&priv->xdp_rxq);
+}
+
+static int esp_xdp(struct net_device *ndev, struct netdev_bpf *bpf)
+{
+	struct esp_private *priv = netdev_priv(ndev);
+	struct bpf_prog *old_prog = NULL;
+
+	switch (bpf->command) {
+	case XDP_SETUP_PROG:
+		old_prog = rtnl_dereference(priv->xdp_prog);
+		rcu_assign_pointer(priv->xdp_prog, bpf->prog);
+
+		if (old_prog)
+			bpf_prog_put(old_prog);
+
+		return 0;
+	default:
+		return -EINVAL;
+	}
+}
+
+/* Sends frame on normal priority queue, bypassing qdisc. Transport is
+ * kicked by caller. Frame is consumed in any case */
+static int esp_xdp_xmit_skb(struct esp_private *priv, struct sk_buff *skb)
+{
+	struct netdev_queue *txq = netdev_get_tx_queue(priv->ndev, ESP_NDEV_Q_NORMAL);
+	struct esp_skb_cb *cb = (struct esp_skb_cb *) skb->cb;
+	int ret = 0;
+
+	if ((skb->len < ETH_HLEN) || (skb->len > ETH_FRAME_LEN)) {
+		priv->stats.tx_dropped++;
+		dev_kfree_skb_any(skb);
+		return -EINVAL;
+	}
+
+	skb->dev = priv->ndev;
+	skb_set_queue_mapping(skb, ESP_NDEV_Q_NORMAL);
+	cb->priv = priv;
+
+	/* process_tx_packet() expects xmit lock of queue, as from stack */
+	__netif_tx_lock(txq, smp_processor_id());
+	ret = process_tx_packet(skb);
+	__netif_tx_unlock(txq);
+
+	if (ret == NETDEV_TX_BUSY) {
+		priv->stats.tx_dropped++;
+		dev_kfree_skb_any(skb);
+		return -EBUSY;
+	}
+
+	return 0;
+}
+
+static int esp_xdp_xmit(struct net_device *ndev, int n,
+		struct xdp_frame **frames, u32 flags)
+{
+	struct esp_private *priv = netdev_priv(ndev);
+	struct sk_buff *skb = NULL;
+	int nxmit = 0;
+
+	if (unlikely(flags & ~XDP_XMIT_FLAGS_MASK))
+		return -EINVAL;
+
+	if (!netif_running(ndev) || stop_data)
+		return -ENETDOWN;
+
+	/* Frames not taken here are freed by caller */
+	for (nxmit = 0; nxmit < n; nxmit++) {
+		if (netif_xmit_stopped(netdev_get_tx_queue(ndev, ESP_NDEV_Q_NORMAL)))
+			break;
+
+		skb = xdp_build_skb_from_frame(frames[nxmit], ndev);
+		if (!skb)
+			break;
+
+		/* Ethernet header was pulled by eth_type_trans() */
+		skb_push(skb, ETH_HLEN);
+
+		esp_xdp_xmit_skb(priv, skb);
+	}
+
+	if (flags & XDP_XMIT_FLUSH)
+		esp_tx_kick(priv->adapter);
+
+	return nxmit;
+}
+
+/* Redirected frame has to own its buffer. Transport buffer is handed over
+ * as is if it is page fragment, otherwise frame is copied to one */
+static int esp_xdp_redirect(struct esp_private *priv, struct sk_buff *skb,
+		struct xdp_buff *xdp, struct bpf_prog *prog)
+{
+	u32 len = xdp->data_end - xdp->data;
+	u32 frame_sz = 0;
+	void *buf = NULL;
+	int ret = 0;
+
+	if (skb->head_frag) {
+		ret = xdp_do_redirect(priv->ndev, xdp, prog);
+		if (!ret)
+			kfree_skb_partial(skb, true);
+
+		return ret;
+	}
+
+	frame_sz = SKB_DATA_ALIGN(XDP_PACKET_HEADROOM + len) +
+		SKB_DATA_ALIGN(sizeof(struct skb_shared_info));
+
+	buf = napi_alloc_frag(frame_sz);
+	if (!buf)
+		return -ENOMEM;
+
+	memcpy(buf + XDP_PACKET_HEADROOM, xdp->data, len);
+
+	xdp_init_buff(xdp, frame_sz, &priv->xdp_rxq);
+	xdp_prepare_buff(xdp, buf, XDP_PACKET_HEADROOM, len, false);
+
+	ret = xdp_do_redirect(priv->ndev, xdp, prog);
+	if (ret) {
+		skb_free_frag(buf);
+		return ret;
+	}
+
+	consume_skb(skb);
+
+	return 0;
+}
+
+/* Runs XDP program of interface on received frame, in place in transport
+ * buffer. Returns true if frame was consumed by XDP */
+static bool esp_xdp_rx(struct esp_private *priv, struct sk_buff *skb)
+{
+	struct esp_adapter *adapter = priv->adapter;
+	struct bpf_prog *prog = NULL;
+	struct xdp_buff xdp;
+	void *orig_data = NULL;
+	u32 act = XDP_PASS;
+	u32 frame_sz = 0;
+	int off = 0;
+
+	rcu_read_lock();
+
+	prog = rcu_dereference(priv->xdp_prog);
+	if (!prog) {
+		rcu_read_unlock();
+		return false;
+	}
+
+	/* Transport RX skbs are linear and not shared */
+	if (unlikely(skb_cloned(skb) || skb_is_nonlinear(skb)))
+		goto drop;
+
+	frame_sz = (skb_end_pointer(skb) - skb->head) +
+		SKB_DATA_ALIGN(sizeof(struct skb_shared_info));
+
+	xdp_init_buff(&xdp, frame_sz, &priv->xdp_rxq);
+	xdp_prepare_buff(&xdp, skb->head, skb_headroom(skb), skb->len, false);
+	orig_data = xdp.data;
+
+	act = bpf_prog_run_xdp(prog, &xdp);
+
+	/* Program may have moved start or end of frame */
+	off = xdp.data - orig_data;
+	if (off > 0)
+		__skb_pull(skb, off);
+	else if (off < 0)
+		__skb_push(skb, -off);
+
+	skb->len = xdp.data_end - xdp.data;
+	skb_set_tail_pointer(skb, skb->len);
+
+	switch (act) {
+	case XDP_PASS:
+		rcu_read_unlock();
+		return false;
+	case XDP_TX:
+		if (!esp_xdp_xmit_skb(priv, skb))
+			adapter->xdp_flush |= ESP_XDP_FLUSH_TX;
+		rcu_read_unlock();
+		return true;
+	case XDP_REDIRECT:
+		if (esp_xdp_redirect(priv, skb, &xdp, prog))
+			goto drop;
+		adapter->xdp_flush |= ESP_XDP_FLUSH_REDIRECT;
+		rcu_read_unlock();
+		return true;
+	default:
+		ESP_XDP_WARN_INVALID_ACTION(priv->ndev, prog, act);
+		fallthrough;
+	case XDP_ABORTED:
+		trace_xdp_exception(priv->ndev, prog, act);
+		fallthrough;
+	case XDP_DROP:
+		break;
+	}
+
+drop:
+	rcu_read_unlock();
+	priv->stats.rx_dropped++;
+	dev_kfree_skb_any(skb);
+	return true;
+}
+
+/* Completes XDP work of NAPI poll: redirect maps, and XDP_TX frames queued */
+static void esp_xdp_flush(struct esp_adapter *adapter)
+{
+	if (adapter->xdp_flush & ESP_XDP_FLUSH_REDIRECT)
+		xdp_do_flush();
+
+	if (adapter->xdp_flush & ESP_XDP_FLUSH_TX)
+		esp_tx_kick(adapter);
+
+	adapter->xdp_flush = 0;
+}
+#else
+static inline int esp_xdp_init(struct esp_private *priv)
+{
+	return 0;
+}
+
+static inline void esp_xdp_deinit(struct esp_private *priv)
+{
+}
+
+static inline bool esp_xdp_rx(struct esp_private *priv, struct sk_buff *skb)
+{
+	return false;
+}
+
+static inline void esp_xdp_flush(struct esp_adapter *adapter)
+{
+}
+#endif
+
 static void process_rx_packet(struct sk_buff *skb)
 {
 	struct esp_private *priv = NULL;
 	struct esp_payload_header *payload_header = NULL;
 	u16 len = 0, offset = 0;
 	u16 rx_checksum = 0, checksum = 0;
-	int ret = 0, ret_len = 0;
 	struct esp_adapter *adapter = esp_get_adapter();
 
 	if (!skb)
@@ -438,27 +878,20 @@ static void process_rx_packet(struct sk_buff *skb)
 		rx_checksum = le16_to_cpu(payload_header->checksum);
 		payload_header->checksum = 0;
 
-		checksum = compute_checksum(skb->data, (len + offset));
+		checksum = esp_frame_checksum(skb->data, (len + offset));
 
 		if (checksum != rx_checksum) {
 			esp_info("cal_chksum[%u]!=rx_chksum[%u]\n", checksum, rx_checksum);
+			ESP_IF_STATS_INC(adapter, rx_checksum_errors);
 			dev_kfree_skb_any(skb);
 			return;
 		}
 	}
 
 	if (payload_header->if_type == ESP_SERIAL_IF) {
-		do {
-			ret = esp_serial_data_received(payload_header->if_num,
-					(skb->data + offset + ret_len), (len - ret_len));
-			if (ret < 0) {
-				esp_err("Failed to process data for iface type %d\n",
-						payload_header->if_num);
-				break;
-			}
-			ret_len += ret;
-		} while (ret_len < len);
-		dev_kfree_skb_any(skb);
+		/* Serial ring buffer may sleep, not possible in NAPI poll */
+		skb_queue_tail(&adapter->serial_rx_skb_q, skb);
+		queue_work(adapter->if_rx_workqueue, &adapter->if_rx_work);
 	} else if (payload_header->if_type == ESP_STA_IF ||
 	           payload_header->if_type == ESP_AP_IF) {
 		/* chop off the header from skb */
@@ -473,15 +906,22 @@ static void process_rx_packet(struct sk_buff *skb)
 			return;
 		}
 
+		/* XDP program sees frame in transport buffer, before stack */
+		if (esp_xdp_rx(priv, skb))
+			return;
+
 		skb->dev = priv->ndev;
 		skb->protocol = eth_type_trans(skb, priv->ndev);
 		skb->ip_summed = CHECKSUM_NONE;
 
-		/* Forward skb to kernel */
-		netif_rx_ni(skb);
-
 		priv->stats.rx_bytes += skb->len;
 		priv->stats.rx_packets++;
+
+		trace_esp_rx_deliver(priv->if_type, priv->if_num, skb->len,
+				ntohs(skb->protocol));
+
+		/* Forward skb to kernel */
+		napi_gro_receive(&adapter->napi, skb);
 	} else if (payload_header->if_type == ESP_HCI_IF) {
 		esp_hci_rx(adapter, skb);
 	} else if (payload_header->if_type == ESP_PRIV_IF) {
@@ -497,50 +937,97 @@ static void process_rx_packet(struct sk_buff *skb)
 		#if TEST_RAW_TP
 			update_test_raw_tp_rx_stats(len);
 		#endif
+		esp_raw_tp_rx(skb->data + offset, len);
 		dev_kfree_skb_any(skb);
 	}
 }
 
+/* Whole network TX paused by transport, e.g. its queue is too long */
+static bool tx_paused;
+
+/* Returns 1 if network TX is not paused by transport */
 int esp_is_tx_queue_paused(void)
 {
-	if ((adapter.priv[0]->ndev &&
-			!netif_queue_stopped((const struct net_device *)
-				adapter.priv[0]->ndev)) ||
-	    (adapter.priv[1]->ndev &&
-			!netif_queue_stopped((const struct net_device *)
-				adapter.priv[1]->ndev)))
-		return 1;
-	return 0;
+	return !READ_ONCE(tx_paused);
 }
 
 void esp_tx_pause(void)
 {
-	if (adapter.priv[0]->ndev &&
-			!netif_queue_stopped((const struct net_device *)
-				adapter.priv[0]->ndev)) {
-		netif_stop_queue(adapter.priv[0]->ndev);
-	}
+	u8 i = 0;
+
+	if (!READ_ONCE(tx_paused))
+		ESP_IF_STATS_INC(&adapter, tx_pause_events);
 
-	if (adapter.priv[1]->ndev &&
-			!netif_queue_stopped((const struct net_device *)
-				adapter.priv[1]->ndev)) {
-		netif_stop_queue(adapter.priv[1]->ndev);
+	WRITE_ONCE(tx_paused, true);
+
+	for (i = 0; i < ESP_MAX_INTERFACE; i++) {
+		if (adapter.priv[i] && adapter.priv[i]->ndev)
+			netif_tx_stop_all_queues(adapter.priv[i]->ndev);
 	}
 }
 
 void esp_tx_resume(void)
 {
-	if (adapter.priv[0]->ndev &&
-			netif_queue_stopped((const struct net_device *)
-				adapter.priv[0]->ndev)) {
-		netif_wake_queue(adapter.priv[0]->ndev);
+	struct esp_private *priv = NULL;
+	u8 i = 0, q = 0;
+
+	WRITE_ONCE(tx_paused, false);
+
+	for (i = 0; i < ESP_MAX_INTERFACE; i++) {
+		priv = adapter.priv[i];
+		if (!priv || !priv->ndev)
+			continue;
+
+		/* Queues above their own limit stay stopped */
+		for (q = 0; q < ESP_NDEV_TX_QUEUES; q++) {
+			if (__netif_subqueue_stopped(priv->ndev, q) &&
+			    atomic_read(&priv->tx_pending[q]) < ESP_NDEV_Q_STOP_THRESHOLD)
+				netif_wake_subqueue(priv->ndev, q);
+		}
 	}
+}
 
-	if (adapter.priv[1]->ndev &&
-			netif_queue_stopped((const struct net_device *)
-				adapter.priv[1]->ndev)) {
-		netif_wake_queue(adapter.priv[1]->ndev);
+static void esp_tx_done(struct esp_private *priv, u16 q, u32 len)
+{
+	spin_lock_bh(&priv->tx_done_lock);
+	netdev_tx_completed_queue(netdev_get_tx_queue(priv->ndev, q), 1, len);
+	spin_unlock_bh(&priv->tx_done_lock);
+
+	if ((atomic_dec_return(&priv->tx_pending[q]) < ESP_NDEV_Q_WAKE_THRESHOLD) &&
+	    __netif_subqueue_stopped(priv->ndev, q) && !READ_ONCE(tx_paused))
+		netif_wake_subqueue(priv->ndev, q);
+}
+
+/* Transport took frame out of its TX queue, to send or aggregate it.
+ * This is TX completion for BQL, transport queue being the device ring.
+ * Wakes network TX queue the frame came from, if it got short enough */
+void esp_tx_dequeued(struct sk_buff *skb)
+{
+	struct esp_payload_header *header = (struct esp_payload_header *) skb->data;
+	struct esp_skb_cb *cb = (struct esp_skb_cb *) skb->cb;
+	struct esp_private *priv = NULL;
+	u16 q = 0;
+
+	/* Cleared as well, not to account requeued frame twice */
+	if (ktime_to_ns(cb->enq_time)) {
+		esp_hist_add_us_since(ESP_HIST_TX_WAIT_US, cb->enq_time);
+		esp_hist_add(ESP_HIST_TX_SIZE, skb->len);
+		cb->enq_time = 0;
 	}
+
+	/* Only network frames carry priv in cb. It is cleared once accounted,
+	 * frame may be dequeued again after requeue */
+	if ((header->if_type != ESP_STA_IF) && (header->if_type != ESP_AP_IF))
+		return;
+
+	priv = cb->priv;
+	if (!priv)
+		return;
+
+	cb->priv = NULL;
+	q = skb_get_queue_mapping(skb);
+
+	esp_tx_done(priv, q, le16_to_cpu(header->len));
 }
 
 struct sk_buff * esp_alloc_skb(u32 len)
@@ -563,9 +1050,49 @@ struct sk_buff * esp_alloc_skb(u32 len)
 }
 
 
+static void process_aggregated_rx_packet(struct sk_buff *skb)
+{
+	struct esp_payload_header *header = NULL;
+	struct sk_buff *frame_skb = NULL;
+	u32 pos = 0, end = 0, frame_len = 0;
+
+	header = (struct esp_payload_header *) skb->data;
+	pos = le16_to_cpu(header->offset);
+	end = pos + le16_to_cpu(header->len);
+
+	if (end > skb->len) {
+		esp_err("aggregated frame len[%u] > rx len[%u], drop\n", end, skb->len);
+		dev_kfree_skb_any(skb);
+		return;
+	}
+
+	/* Split frames into individual skbs */
+	while (pos + sizeof(struct esp_payload_header) <= end) {
+		header = (struct esp_payload_header *) (skb->data + pos);
+		frame_len = le16_to_cpu(header->offset) + le16_to_cpu(header->len);
+
+		if (!header->len || (pos + frame_len > end))
+			break;
+
+		frame_skb = esp_alloc_skb(frame_len);
+		if (!frame_skb) {
+			esp_err("Failed to allocate SKB\n");
+			break;
+		}
+
+		skb_put_data(frame_skb, header, frame_len);
+		process_rx_packet(frame_skb);
+
+		pos += AGGR_FRAME_ALIGN(frame_len);
+	}
+
+	dev_kfree_skb_any(skb);
+}
+
 static int esp_get_packets(struct esp_adapter *adapter)
 {
 	struct sk_buff *skb = NULL;
+	struct esp_payload_header *header = NULL;
 
 	if (!adapter || !adapter->if_ops || !adapter->if_ops->read)
 		return -EINVAL;
@@ -575,11 +1102,141 @@ static int esp_get_packets(struct esp_adapter *adapter)
 	if (!skb)
 		return -EFAULT;
 
-	process_rx_packet(skb);
+	header = (struct esp_payload_header *) skb->data;
+
+	if (header->flags & AGGREGATED_FRAME)
+		process_aggregated_rx_packet(skb);
+	else
+		process_rx_packet(skb);
 
 	return 0;
 }
 
+static int esp_rx_napi_poll(struct napi_struct *napi, int budget)
+{
+	struct esp_adapter *adapter = container_of(napi, struct esp_adapter, napi);
+	int work_done = 0;
+
+	/* read inbound packets and forward to network/serial interface */
+	while (work_done < budget) {
+		if (esp_get_packets(adapter))
+			break;
+
+		work_done++;
+	}
+
+	esp_xdp_flush(adapter);
+
+	if (work_done < budget)
+		napi_complete_done(napi, work_done);
+
+	return work_done;
+}
+
+/* Dequeue head of highest priority non-empty queue, if it fits in max_len */
+static struct sk_buff * dequeue_tx_skb_upto(struct sk_buff_head *tx_q,
+		u32 max_len, u8 *q_idx)
+{
+	struct sk_buff *skb = NULL;
+	unsigned long flags;
+	u8 i = 0;
+
+	for (i = 0; i < MAX_PRIORITY_QUEUES; i++) {
+		spin_lock_irqsave(&tx_q[i].lock, flags);
+		skb = skb_peek(&tx_q[i]);
+		if (skb) {
+			if (skb->len <= max_len)
+				__skb_unlink(skb, &tx_q[i]);
+			else
+				skb = NULL;
+			spin_unlock_irqrestore(&tx_q[i].lock, flags);
+			*q_idx = i;
+			return skb;
+		}
+		spin_unlock_irqrestore(&tx_q[i].lock, flags);
+	}
+
+	return NULL;
+}
+
+static u32 append_aggregated_frame(struct sk_buff *aggr_skb, u32 pos, struct sk_buff *skb)
+{
+	u32 aligned_len = AGGR_FRAME_ALIGN(skb->len);
+
+	memcpy(aggr_skb->data + pos, skb->data, skb->len);
+	memset(aggr_skb->data + pos + skb->len, 0, aligned_len - skb->len);
+
+	return pos + aligned_len;
+}
+
+/* Packs frames waiting in tx_q behind skb into one aggregated frame of
+ * at most max_len bytes. Number of frames picked from each queue is added
+ * to aggr_cnt[]. skb is returned as is, if aggregation is not negotiated
+ * or nothing more could be packed with it.
+ */
+struct sk_buff * esp_aggregate_tx_skb(struct sk_buff *skb,
+		struct sk_buff_head *tx_q, u32 max_len, u8 *aggr_cnt)
+{
+	struct esp_payload_header *header = NULL;
+	struct sk_buff *aggr_skb = NULL, *next_skb = NULL;
+	u32 pos = sizeof(struct esp_payload_header);
+	u8 q_idx = 0, if_type = 0, flags = 0;
+
+	if (!skb || !tx_q || !aggr_cnt ||
+	    !(adapter.ext_capabilities & ESP_TRANSPORT_AGGREGATION))
+		return skb;
+
+	/* Already aggregated, e.g. requeued after failed attempt */
+	if (((struct esp_payload_header *) skb->data)->flags & AGGREGATED_FRAME)
+		return skb;
+
+	if (pos + AGGR_FRAME_ALIGN(skb->len) >= max_len)
+		return skb;
+
+	next_skb = dequeue_tx_skb_upto(tx_q,
+			max_len - pos - AGGR_FRAME_ALIGN(skb->len), &q_idx);
+	if (!next_skb)
+		return skb;
+
+	aggr_skb = esp_alloc_skb(max_len);
+	if (!aggr_skb) {
+		skb_queue_head(&tx_q[q_idx], next_skb);
+		return skb;
+	}
+
+	if_type = ((struct esp_payload_header *) skb->data)->if_type;
+	flags = ((struct esp_payload_header *) skb->data)->flags & FRAME_PRIO_HIGH;
+	pos = append_aggregated_frame(aggr_skb, pos, skb);
+	esp_tx_dequeued(skb);
+	dev_kfree_skb_any(skb);
+
+	do {
+		trace_esp_tx_dequeue(((struct esp_payload_header *) next_skb->data)->if_type,
+				next_skb->len, q_idx, skb_queue_len(&tx_q[q_idx]),
+				((struct esp_skb_cb *) next_skb->cb)->enq_time);
+
+		pos = append_aggregated_frame(aggr_skb, pos, next_skb);
+		esp_tx_dequeued(next_skb);
+		dev_kfree_skb_any(next_skb);
+		aggr_cnt[q_idx]++;
+
+		next_skb = dequeue_tx_skb_upto(tx_q, max_len - pos, &q_idx);
+	} while (next_skb);
+
+	header = (struct esp_payload_header *) aggr_skb->data;
+	memset(header, 0, sizeof(struct esp_payload_header));
+
+	header->if_type = if_type;
+	/* Priority of first frame, which ESP accounts it to */
+	header->flags = AGGREGATED_FRAME | flags;
+	header->offset = cpu_to_le16(sizeof(struct esp_payload_header));
+	header->len = cpu_to_le16(pos - sizeof(struct esp_payload_header));
+
+	skb_put(aggr_skb, pos);
+
+	return aggr_skb;
+}
+
 int esp_send_packet(struct esp_adapter *adapter, struct sk_buff *skb)
 {
 	if (!adapter || !adapter->if_ops || !adapter->if_ops->write)
@@ -588,6 +1245,21 @@ int esp_send_packet(struct esp_adapter *adapter, struct sk_buff *skb)
 	return adapter->if_ops->write(adapter, skb);
 }
 
+/* Queue packet for TX, transport starts on next esp_tx_kick() */
+static int esp_queue_packet(struct esp_adapter *adapter, struct sk_buff *skb)
+{
+	if (!adapter || !adapter->if_ops || !adapter->if_ops->queue)
+		return esp_send_packet(adapter, skb);
+
+	return adapter->if_ops->queue(adapter, skb);
+}
+
+static void esp_tx_kick(struct esp_adapter *adapter)
+{
+	if (adapter && adapter->if_ops && adapter->if_ops->kick)
+		adapter->if_ops->kick(adapter);
+}
+
 static int insert_priv_to_adapter(struct esp_private *priv)
 {
 	int i = 0;
@@ -623,6 +1295,7 @@ static int esp_init_priv(struct esp_private *priv, struct net_device *dev,
 	priv->link_state = ESP_LINK_DOWN;
 	priv->adapter = &adapter;
 	memset(&priv->stats, 0, sizeof(priv->stats));
+	spin_lock_init(&priv->tx_done_lock);
 
 	return 0;
 }
@@ -636,8 +1309,13 @@ static int esp_init_net_dev(struct net_device *ndev, struct esp_private *priv)
 	/* set net dev ops */
 	ndev->netdev_ops = &esp_netdev_ops;
 
+	/* headroom for interface header, so that TX skbs need not be copied */
+	ndev->needed_headroom = ESP_TX_HEADROOM;
+	ndev->needed_tailroom = ESP_TX_TAILROOM;
+
 	eth_hw_addr_set(ndev, priv->mac_address);
 	/* set ethtool ops */
+	esp_set_ethtool_ops(ndev);
 
 	/* update features supported */
 
@@ -662,10 +1340,10 @@ static int esp_add_interface(struct esp_adapter *adapter, u8 if_type, u8 if_num,
 
 #if (LINUX_VERSION_CODE >= KERNEL_VERSION(3, 17, 0))
 	ndev = alloc_netdev_mqs(sizeof(struct esp_private), name,
-			NET_NAME_ENUM, ether_setup, 1, 1);
+			NET_NAME_ENUM, ether_setup, ESP_NDEV_TX_QUEUES, 1);
 #else
 	ndev = alloc_netdev_mqs(sizeof(struct esp_private), name,
-			ether_setup, 1, 1);
+			ether_setup, ESP_NDEV_TX_QUEUES, 1);
 #endif
 
 	if (!ndev) {
@@ -682,6 +1360,12 @@ static int esp_add_interface(struct esp_adapter *adapter, u8 if_type, u8 if_num,
 		goto error_exit;
 	}
 
+	ret = esp_xdp_init(priv);
+	if (ret) {
+		esp_err("Init XDP failed\n");
+		goto error_exit;
+	}
+
 	ret = esp_init_net_dev(ndev, priv);
 	if (ret) {
 		esp_err("Init netdev failed\n");
@@ -691,6 +1375,7 @@ static int esp_add_interface(struct esp_adapter *adapter, u8 if_type, u8 if_num,
 	return ret;
 
 error_exit:
+	esp_xdp_deinit(priv);
 	free_netdev(ndev);
 	return ret;
 }
@@ -698,15 +1383,17 @@ error_exit:
 static void esp_remove_network_interfaces(struct esp_adapter *adapter)
 {
 	if (adapter->priv[0] && adapter->priv[0]->ndev) {
-		netif_stop_queue(adapter->priv[0]->ndev);
+		netif_tx_stop_all_queues(adapter->priv[0]->ndev);
 		unregister_netdev(adapter->priv[0]->ndev);
+		esp_xdp_deinit(adapter->priv[0]);
 		free_netdev(adapter->priv[0]->ndev);
 		adapter->priv[0] = NULL;
 	}
 
 	if (adapter->priv[1] && adapter->priv[1]->ndev) {
-		netif_stop_queue(adapter->priv[1]->ndev);
+		netif_tx_stop_all_queues(adapter->priv[1]->ndev);
 		unregister_netdev(adapter->priv[1]->ndev);
+		esp_xdp_deinit(adapter->priv[1]);
 		free_netdev(adapter->priv[1]->ndev);
 		adapter->priv[1] = NULL;
 	}
@@ -748,7 +1435,9 @@ int esp_remove_card(struct esp_adapter *adapter)
 
 	esp_deinit_bt(adapter);
 
-	/* Flush workqueues */
+	/* Flush RX */
+	napi_synchronize(&adapter->napi);
+
 	if (adapter->if_rx_workqueue)
 		flush_workqueue(adapter->if_rx_workqueue);
 
@@ -761,8 +1450,31 @@ int esp_remove_card(struct esp_adapter *adapter)
 
 static void esp_if_rx_work (struct work_struct *work)
 {
-	/* read inbound packet and forward it to network/serial interface */
-	esp_get_packets(&adapter);
+	struct sk_buff *skb = NULL;
+	struct esp_payload_header *header = NULL;
+	u16 len = 0, offset = 0;
+	int ret = 0, ret_len = 0;
+
+	/* pass serial data, received in NAPI poll, to serial interface */
+	while ((skb = skb_dequeue(&adapter.serial_rx_skb_q)) != NULL) {
+		header = (struct esp_payload_header *) skb->data;
+		len = le16_to_cpu(header->len);
+		offset = le16_to_cpu(header->offset);
+		ret_len = 0;
+
+		do {
+			ret = esp_serial_data_received(header->if_num,
+					(skb->data + offset + ret_len), (len - ret_len));
+			if (ret < 0) {
+				esp_err("Failed to process data for iface type %d\n",
+						header->if_num);
+				break;
+			}
+			ret_len += ret;
+		} while (ret_len < len);
+
+		dev_kfree_skb_any(skb);
+	}
 }
 
 static void deinit_adapter(void)
@@ -770,6 +1482,13 @@ static void deinit_adapter(void)
 	if (adapter.if_context)
 		adapter.state = ESP_CONTEXT_DISABLED;
 
+	if (adapter.napi_dev) {
+		napi_disable(&adapter.napi);
+		netif_napi_del(&adapter.napi);
+		FREE_NETDEV_DUMMY(adapter.napi_dev);
+		adapter.napi_dev = NULL;
+	}
+
 	skb_queue_purge(&adapter.events_skb_q);
 
 	if (adapter.events_wq)
@@ -778,6 +1497,8 @@ static void deinit_adapter(void)
 	if (adapter.if_rx_workqueue)
 		destroy_workqueue(adapter.if_rx_workqueue);
 
+	skb_queue_purge(&adapter.serial_rx_skb_q);
+
 	esp_verbose("\n");
 }
 
@@ -818,6 +1539,7 @@ static int update_module_params(struct esp_adapter *adapter)
 	adapter->mod_param.spi_mode = spi_mode;
 	adapter->mod_param.spi_handshake = spi_handshake;
 	adapter->mod_param.spi_dataready = spi_dataready;
+	adapter->mod_param.spi_poll_us = spi_poll_us;
 	return 0;
 }
 
@@ -840,6 +1562,19 @@ static struct esp_adapter * init_adapter(void)
 	}
 
 	INIT_WORK(&adapter.if_rx_work, esp_if_rx_work);
+	skb_queue_head_init(&adapter.serial_rx_skb_q);
+
+	/* NAPI is not tied to a network interface, as STA and AP share RX */
+	adapter.napi_dev = ALLOC_NETDEV_DUMMY();
+
+	if (!adapter.napi_dev) {
+		esp_err("failed to alloc NAPI device\n");
+		deinit_adapter();
+		return NULL;
+	}
+
+	NETIF_NAPI_ADD(adapter.napi_dev, &adapter.napi, esp_rx_napi_poll);
+	napi_enable(&adapter.napi);
 
 	skb_queue_head_init(&adapter.events_skb_q);
 
@@ -871,10 +1606,14 @@ static int __init esp_init(void)
 	if (!adapter)
 		return -EFAULT;
 
+	/* Histograms are for debug only, driver works without these */
+	esp_debugfs_init();
+
 	/* Init transport layer */
 	ret = esp_init_interface_layer(adapter);
 
 	if (ret != 0) {
+		esp_debugfs_deinit();
 		deinit_adapter();
 	}
 
@@ -886,6 +1625,8 @@ static void __exit esp_exit(void)
 #if TEST_RAW_TP
 	test_raw_tp_cleanup();
 #endif
+	esp_debugfs_deinit();
+	esp_raw_tp_cleanup();
 	esp_serial_cleanup();
 	esp_deinit_interface_layer();
 	deinit_adapter();
@@ -35,10 +35,14 @@
 #include <linux/printk.h>
 #include "esp_stats.h"
 #include "esp_fw_verify.h"
+#include "esp_trace.h"
+#include "esp_debugfs.h"
 
 #define MAX_WRITE_RETRIES       2
+/* Default and max of TX queue limit, tunable as ethtool ring parameter */
 #define TX_MAX_PENDING_COUNT    200
-#define TX_RESUME_THRESHOLD     (TX_MAX_PENDING_COUNT/5)
+#define TX_MAX_PENDING_LIMIT    2000
+#define TX_RESUME_THRESHOLD(limit) ((limit)/5)
 
 #define CHECK_SDIO_RW_ERROR(ret) do {			\
 	if (ret)						\
@@ -62,10 +66,17 @@ static atomic_t tx_pending;
 static atomic_t queue_items[MAX_PRIORITY_QUEUES];
 
 struct task_struct *tx_thread;
+/* Kicked on new TX packet and on state change */
+static DECLARE_WAIT_QUEUE_HEAD(tx_wait);
+/* Packets of a TX batch, each at start of a slave buffer */
+static u8 *tx_batch_buf;
 
 static int init_context(struct esp_sdio_context *context);
 static struct sk_buff * read_packet(struct esp_adapter *adapter);
+static struct sk_buff * sdio_read_packet(struct esp_adapter *adapter);
 static int write_packet(struct esp_adapter *adapter, struct sk_buff *skb);
+static int queue_packet(struct esp_adapter *adapter, struct sk_buff *skb);
+static void kick_tx(struct esp_adapter *adapter);
 /*int deinit_context(struct esp_adapter *adapter);*/
 
 static const struct sdio_device_id esp_devices[] = {
@@ -97,13 +108,66 @@ static void print_capabilities(u32 cap)
 	}
 }
 
+/* All data pending at ESP is read at once. With ESP_TRANSPORT_SDIO_BATCH,
+ * that may be several frames back to back: queue each as own skb */
+static void sdio_queue_rx_frames(struct esp_sdio_context *context, struct sk_buff *skb)
+{
+	struct esp_payload_header *header = NULL;
+	struct sk_buff *frame_skb = NULL;
+	u32 pos = 0, frame_len = 0;
+
+	while (pos + sizeof(struct esp_payload_header) <= skb->len) {
+		header = (struct esp_payload_header *) (skb->data + pos);
+		frame_len = le16_to_cpu(header->offset) + le16_to_cpu(header->len);
+
+		if (!header->len || (pos + frame_len > skb->len))
+			break;
+
+		ESP_IF_STATS_INC(context->adapter,
+				q[ESP_PRIO_Q(header->if_type, header->flags)].rx_enqueued);
+		esp_hist_add(ESP_HIST_RX_SIZE, frame_len);
+		trace_esp_rx_parse(header->if_type, header->if_num,
+				le16_to_cpu(header->len), le16_to_cpu(header->offset),
+				header->flags, skb_queue_len(&context->rx_q));
+
+		if (!pos && ((frame_len == skb->len) ||
+		    !(context->adapter->ext_capabilities & ESP_TRANSPORT_SDIO_BATCH))) {
+			/* Single frame */
+			skb_queue_tail(&context->rx_q, skb);
+			return;
+		}
+
+		frame_skb = esp_alloc_skb(frame_len);
+		if (!frame_skb) {
+			esp_err("Failed to allocate SKB\n");
+			ESP_IF_STATS_INC(context->adapter, rx_errors);
+			break;
+		}
+
+		skb_put_data(frame_skb, header, frame_len);
+		skb_queue_tail(&context->rx_q, frame_skb);
+
+		pos += frame_len;
+	}
+
+	dev_kfree_skb(skb);
+}
+
 static void esp_process_interrupt(struct esp_sdio_context *context, u32 int_status)
 {
+	struct sk_buff *skb = NULL;
+
 	if (!context) {
 		return;
 	}
 
 	if (int_status & ESP_SLAVE_RX_NEW_PACKET_INT) {
+		/* Read from bus here, NAPI poll can not sleep */
+		esp_hist_add_us_since(ESP_HIST_IRQ_TO_READ_US, context->irq_time);
+		skb = sdio_read_packet(context->adapter);
+		if (skb)
+			sdio_queue_rx_frames(context, skb);
+
 		esp_process_new_packet_intr(context->adapter);
 	}
 }
@@ -126,6 +190,8 @@ static void esp_handle_isr(struct sdio_func *func)
 		return;
 	}
 
+	context->irq_time = ktime_get();
+
 	int_status = kmalloc(sizeof(u32), GFP_ATOMIC);
 
 	if (!int_status) {
@@ -258,7 +324,7 @@ static void flush_sdio(struct esp_sdio_context *context)
 		return;
 
 	while (1) {
-		skb = read_packet(context->adapter);
+		skb = sdio_read_packet(context->adapter);
 
 		if (!skb) {
 			break;
@@ -293,6 +359,9 @@ static void esp_remove(struct sdio_func *func)
 	if (tx_thread)
 		kthread_stop(tx_thread);
 
+	kfree(tx_batch_buf);
+	tx_batch_buf = NULL;
+
 	if (context) {
 		generate_slave_intr(context, BIT(ESP_CLOSE_DATA_PATH));
 		msleep(100);
@@ -308,6 +377,8 @@ static void esp_remove(struct sdio_func *func)
 
 		}
 
+		skb_queue_purge(&context->rx_q);
+
 		memset(context, 0, sizeof(struct esp_sdio_context));
 	}
 
@@ -325,6 +396,8 @@ static void esp_remove(struct sdio_func *func)
 static struct esp_if_ops if_ops = {
 	.read		= read_packet,
 	.write		= write_packet,
+	.queue		= queue_packet,
+	.kick		= kick_tx,
 };
 
 static int init_context(struct esp_sdio_context *context)
@@ -385,6 +458,8 @@ static int init_context(struct esp_sdio_context *context)
 		atomic_set(&queue_items[prio_q_idx], 0);
 	}
 
+	skb_queue_head_init(&sdio_context.rx_q);
+
 	context->adapter->if_type = ESP_IF_TYPE_SDIO;
 
 	kfree(val);
@@ -392,8 +467,29 @@ static int init_context(struct esp_sdio_context *context)
 }
 
 static struct sk_buff * read_packet(struct esp_adapter *adapter)
+{
+	struct esp_sdio_context *context;
+	struct esp_payload_header *header = NULL;
+	struct sk_buff *skb = NULL;
+
+	if (!adapter || !adapter->if_context)
+		return NULL;
+
+	context = adapter->if_context;
+
+	skb = skb_dequeue(&context->rx_q);
+	if (skb) {
+		header = (struct esp_payload_header *) skb->data;
+		ESP_IF_STATS_INC(adapter, q[ESP_PRIO_Q(header->if_type, header->flags)].rx_dequeued);
+	}
+
+	return skb;
+}
+
+static struct sk_buff * sdio_read_packet(struct esp_adapter *adapter)
 {
 	u32 len_from_slave, data_left, len_to_read, size, num_blocks;
+	ktime_t start_time;
 	int ret = 0;
 	struct sk_buff *skb;
 	u8 *pos;
@@ -418,9 +514,16 @@ static struct sk_buff * read_packet(struct esp_adapter *adapter)
 	/* Read length */
 	ret = esp_get_len_from_slave(context, &len_from_slave, is_lock_needed);
 
+	ESP_IF_STATS_INC(adapter, xfers);
+
 	if (ret || !len_from_slave) {
-		if (ret)
+		if (ret) {
 			esp_err("esp_get_len_from_slave ret[%d]\n", ret);
+			ESP_IF_STATS_INC(adapter, rx_errors);
+		} else {
+			/* Interrupt, but nothing to read */
+			ESP_IF_STATS_INC(adapter, xfers_dummy);
+		}
 
 		RELEASE_SDIO_HOST(context);
 		return NULL;
@@ -428,7 +531,8 @@ static struct sk_buff * read_packet(struct esp_adapter *adapter)
 
 	size = ESP_BLOCK_SIZE * 4;
 
-	if (len_from_slave > size) {
+	if ((len_from_slave > size) &&
+	    !(adapter->ext_capabilities & ESP_TRANSPORT_SDIO_BATCH)) {
 		esp_err("Rx large packet: %d\n", len_from_slave);
 	}
 
@@ -445,6 +549,9 @@ static struct sk_buff * read_packet(struct esp_adapter *adapter)
 
 	data_left = len_from_slave;
 
+	trace_esp_xfer_start(0, len_from_slave);
+	start_time = ktime_get();
+
 	do {
 		num_blocks = data_left/ESP_BLOCK_SIZE;
 
@@ -469,6 +576,8 @@ static struct sk_buff * read_packet(struct esp_adapter *adapter)
 
 		if (ret) {
 			esp_err("Failed to read data - %d [%u - %d]\n", ret, num_blocks, len_to_read);
+			ESP_IF_STATS_INC(adapter, rx_errors);
+			trace_esp_xfer_end(0, len_from_slave, ret, start_time);
 			context->adapter->state = ESP_CONTEXT_DISABLED;
 			dev_kfree_skb(skb);
 			RELEASE_SDIO_HOST(context);
@@ -484,15 +593,19 @@ static struct sk_buff * read_packet(struct esp_adapter *adapter)
 
 	} while (data_left > 0);
 
+	trace_esp_xfer_end(0, len_from_slave, 0, start_time);
+	esp_hist_add_us_since(ESP_HIST_XFER_US, start_time);
+
 	RELEASE_SDIO_HOST(context);
 
 	return skb;
 }
 
-static int write_packet(struct esp_adapter *adapter, struct sk_buff *skb)
+static int queue_packet(struct esp_adapter *adapter, struct sk_buff *skb)
 {
 	u32 max_pkt_size = ESP_RX_BUFFER_SIZE;
 	struct esp_payload_header *payload_header = (struct esp_payload_header *) skb->data;
+	u8 prio_q_idx = 0;
 
 	if (!adapter || !adapter->if_context || !skb || !skb->data || !skb->len) {
 		esp_err("Invalid args\n");
@@ -502,15 +615,19 @@ static int write_packet(struct esp_adapter *adapter, struct sk_buff *skb)
 		return -EINVAL;
 	}
 
+	prio_q_idx = ESP_PRIO_Q(payload_header->if_type, payload_header->flags);
+
 	if (skb->len > max_pkt_size) {
 		esp_err("Drop pkt of len[%u] > max SDIO transport len[%u]\n",
 				skb->len, max_pkt_size);
+		ESP_IF_STATS_INC(adapter, q[prio_q_idx].tx_dropped);
 		dev_kfree_skb(skb);
 		return -EPERM;
 	}
 
-	if (atomic_read(&tx_pending) >= TX_MAX_PENDING_COUNT) {
+	if (atomic_read(&tx_pending) >= READ_ONCE(adapter->tx_q_limit)) {
 		esp_tx_pause();
+		ESP_IF_STATS_INC(adapter, q[prio_q_idx].tx_dropped);
 		dev_kfree_skb(skb);
 		return -EBUSY;
 	}
@@ -519,37 +636,47 @@ static int write_packet(struct esp_adapter *adapter, struct sk_buff *skb)
 	atomic_inc(&tx_pending);
 
 	/* Notify to process queue */
-	if (payload_header->if_type == ESP_SERIAL_IF) {
-		atomic_inc(&queue_items[PRIO_Q_SERIAL]);
-		skb_queue_tail(&(sdio_context.tx_q[PRIO_Q_SERIAL]), skb);
-	} else if (payload_header->if_type == ESP_HCI_IF) {
-		atomic_inc(&queue_items[PRIO_Q_BT]);
-		skb_queue_tail(&(sdio_context.tx_q[PRIO_Q_BT]), skb);
-	} else {
-		atomic_inc(&queue_items[PRIO_Q_OTHERS]);
-		skb_queue_tail(&(sdio_context.tx_q[PRIO_Q_OTHERS]), skb);
-	}
+	ESP_IF_STATS_INC(adapter, q[prio_q_idx].tx_enqueued);
+	((struct esp_skb_cb *) skb->cb)->enq_time = ktime_get();
+	atomic_inc(&queue_items[prio_q_idx]);
+	skb_queue_tail(&(sdio_context.tx_q[prio_q_idx]), skb);
 
 	return 0;
 }
 
+static void kick_tx(struct esp_adapter *adapter)
+{
+	wake_up_interruptible(&tx_wait);
+}
+
+static int write_packet(struct esp_adapter *adapter, struct sk_buff *skb)
+{
+	int ret = queue_packet(adapter, skb);
+
+	/* Also on failure, for packets queued earlier without kick */
+	kick_tx(adapter);
+
+	return ret;
+}
+
+static u32 tx_buf_available;
+
 static int is_sdio_write_buffer_available(u32 buf_needed)
 {
 #define BUFFER_AVAILABLE        1
 #define BUFFER_UNAVAILABLE      0
 
 	int ret = 0;
-	static u32 buf_available = 0;
 	struct esp_sdio_context *context = &sdio_context;
 	u8 retry = MAX_WRITE_RETRIES;
 
 	/*If buffer needed are less than buffer available
 	  then only read for available buffer number from slave*/
-	if (buf_available < buf_needed) {
+	if (tx_buf_available < buf_needed) {
 		while (retry) {
-			ret = esp_slave_get_tx_buffer_num(context, &buf_available, ACQUIRE_LOCK);
+			ret = esp_slave_get_tx_buffer_num(context, &tx_buf_available, ACQUIRE_LOCK);
 
-			if (buf_available < buf_needed) {
+			if (tx_buf_available < buf_needed) {
 
 				/* Release SDIO and retry after delay*/
 				retry--;
@@ -561,8 +688,8 @@ static int is_sdio_write_buffer_available(u32 buf_needed)
 		}
 	}
 
-	if (buf_available >= buf_needed)
-		buf_available -= buf_needed;
+	if (tx_buf_available >= buf_needed)
+		tx_buf_available -= buf_needed;
 
 	if (!retry) {
 		esp_verbose("slave buffer unavailable\n");
@@ -573,102 +700,196 @@ static int is_sdio_write_buffer_available(u32 buf_needed)
 	return BUFFER_AVAILABLE;
 }
 
+/* Take one more slave buffer, as per last known count, without waiting */
+static int sdio_take_write_buffer(void)
+{
+	if (!tx_buf_available)
+		return BUFFER_UNAVAILABLE;
+
+	tx_buf_available--;
+	return BUFFER_AVAILABLE;
+}
+
+static inline int is_tx_ready(struct esp_sdio_context *context)
+{
+	u8 prio_q_idx = 0;
+
+	if (context->adapter->state < ESP_CONTEXT_READY)
+		return 0;
+
+	for (prio_q_idx = 0; prio_q_idx < MAX_PRIORITY_QUEUES; prio_q_idx++) {
+		if (atomic_read(&queue_items[prio_q_idx]) > 0)
+			return 1;
+	}
+
+	return 0;
+}
+
+/* Dequeue from highest priority queue, aggregated with following packets */
+static struct sk_buff * sdio_dequeue_tx_skb(struct esp_sdio_context *context)
+{
+	struct sk_buff *tx_skb = NULL;
+	u8 aggr_cnt[MAX_PRIORITY_QUEUES];
+	u8 prio_q_idx = 0;
+
+	for (prio_q_idx = 0; prio_q_idx < MAX_PRIORITY_QUEUES; prio_q_idx++) {
+		if (atomic_read(&queue_items[prio_q_idx]) > 0) {
+			tx_skb = skb_dequeue(&(context->tx_q[prio_q_idx]));
+			if (tx_skb) {
+				atomic_dec(&queue_items[prio_q_idx]);
+				trace_esp_tx_dequeue(((struct esp_payload_header *) tx_skb->data)->if_type,
+						tx_skb->len, prio_q_idx,
+						skb_queue_len(&context->tx_q[prio_q_idx]),
+						((struct esp_skb_cb *) tx_skb->cb)->enq_time);
+				ESP_IF_STATS_INC(context->adapter, q[prio_q_idx].tx_dequeued);
+				esp_tx_dequeued(tx_skb);
+				break;
+			}
+		}
+	}
+
+	if (!tx_skb)
+		return NULL;
+
+	memset(aggr_cnt, 0, sizeof(aggr_cnt));
+	tx_skb = esp_aggregate_tx_skb(tx_skb, context->tx_q,
+			ESP_RX_BUFFER_SIZE, aggr_cnt);
+
+	for (prio_q_idx = 0; prio_q_idx < MAX_PRIORITY_QUEUES; prio_q_idx++) {
+		atomic_sub(aggr_cnt[prio_q_idx], &queue_items[prio_q_idx]);
+		ESP_IF_STATS_ADD(context->adapter, q[prio_q_idx].tx_dequeued,
+				aggr_cnt[prio_q_idx]);
+		while (aggr_cnt[prio_q_idx]--)
+			atomic_dec_if_positive(&tx_pending);
+	}
+
+	if (atomic_read(&tx_pending))
+		atomic_dec(&tx_pending);
+
+	/* resume network tx queue if bearable load */
+	if (atomic_read(&tx_pending) <
+	    TX_RESUME_THRESHOLD(READ_ONCE(context->adapter->tx_q_limit))) {
+		esp_tx_resume();
+		esp_raw_tp_queue_resume();
+	}
+
+	return tx_skb;
+}
+
+/* Single CMD53 write of 'len' bytes, rounded up to block size */
+static int sdio_write_data(struct esp_sdio_context *context, u8 *pos, u32 len)
+{
+	u32 data_left, len_to_send, pad;
+	ktime_t start_time;
+	int ret = 0;
+
+	data_left = len;
+	pad = ESP_BLOCK_SIZE - (data_left % ESP_BLOCK_SIZE);
+	data_left += pad;
+
+	esp_hist_add(ESP_HIST_TX_Q_DEPTH, atomic_read(&tx_pending));
+
+	trace_esp_xfer_start(len, 0);
+	start_time = ktime_get();
+
+	do {
+		len_to_send = data_left;
+		ret = esp_write_block(context, ESP_SLAVE_CMD53_END_ADDR - len_to_send,
+				pos, (len_to_send + 3) & (~3), ACQUIRE_LOCK);
+
+		if (ret) {
+			esp_err("Failed to send data: %d %d %d\n", ret, len_to_send, data_left);
+			break;
+		}
+
+		data_left -= len_to_send;
+		pos += len_to_send;
+	} while (data_left);
+
+	trace_esp_xfer_end(len, 0, ret, start_time);
+	esp_hist_add_us_since(ESP_HIST_XFER_US, start_time);
+
+	return ret;
+}
+
 static int tx_process(void *data)
 {
 	int ret = 0;
-	u32 block_cnt = 0;
 	u32 buf_needed = 0;
-	u8 *pos = NULL;
-	u32 data_left, len_to_send, pad;
-	struct sk_buff *tx_skb = NULL;
+	u32 len = 0;
+	struct sk_buff *tx_skb[SDIO_TX_BATCH_MAX];
 	struct esp_sdio_context *context = &sdio_context;
+	u8 batch_cnt = 0, i = 0;
 
 	while (!kthread_should_stop()) {
 
-		if (context->adapter->state < ESP_CONTEXT_READY) {
-			esp_verbose("Tx process not ready yet\n");
-			msleep(1);
+		/* Sleep till there is something to send. Queued packets
+		 * are then sent back to back, till queues are empty */
+		if (!is_tx_ready(context)) {
+			wait_event_interruptible(tx_wait,
+					kthread_should_stop() || is_tx_ready(context));
 			continue;
 		}
 
-		if (atomic_read(&queue_items[PRIO_Q_SERIAL]) > 0) {
-			tx_skb = skb_dequeue(&(context->tx_q[PRIO_Q_SERIAL]));
-			if (!tx_skb) {
-				continue;
-			}
-			atomic_dec(&queue_items[PRIO_Q_SERIAL]);
-		} else if (atomic_read(&queue_items[PRIO_Q_BT]) > 0) {
-			tx_skb = skb_dequeue(&(context->tx_q[PRIO_Q_BT]));
-			if (!tx_skb) {
-				continue;
-			}
-			atomic_dec(&queue_items[PRIO_Q_BT]);
-		} else if (atomic_read(&queue_items[PRIO_Q_OTHERS]) > 0) {
-			tx_skb = skb_dequeue(&(context->tx_q[PRIO_Q_OTHERS]));
-			if (!tx_skb) {
-				continue;
-			}
-			atomic_dec(&queue_items[PRIO_Q_OTHERS]);
-		} else {
-			msleep(1);
+		tx_skb[0] = sdio_dequeue_tx_skb(context);
+		if (!tx_skb[0])
 			continue;
-		}
-
-		if (atomic_read(&tx_pending))
-			atomic_dec(&tx_pending);
-
-		/* resume network tx queue if bearable load */
-		if (atomic_read(&tx_pending) < TX_RESUME_THRESHOLD) {
-			esp_tx_resume();
-			#if TEST_RAW_TP
-				esp_raw_tp_queue_resume();
-			#endif
-		}
 
-		buf_needed = (tx_skb->len + ESP_RX_BUFFER_SIZE - 1) / ESP_RX_BUFFER_SIZE;
+		buf_needed = (tx_skb[0]->len + ESP_RX_BUFFER_SIZE - 1) / ESP_RX_BUFFER_SIZE;
 
 		/*If SDIO slave buffer is available to write then only write data
 		else wait till buffer is available*/
 		ret = is_sdio_write_buffer_available(buf_needed);
 		if(!ret) {
-			dev_kfree_skb(tx_skb);
+			ESP_IF_STATS_INC(context->adapter, tx_errors);
+			dev_kfree_skb(tx_skb[0]);
 			continue;
 		}
 
-		pos = tx_skb->data;
-		data_left = len_to_send = 0;
-
-		data_left = tx_skb->len;
-		pad = ESP_BLOCK_SIZE - (data_left % ESP_BLOCK_SIZE);
-		data_left += pad;
-
-		esp_hex_dump_dbg("sdio_tx: ", tx_skb->data, 32);
-
-		do {
-			block_cnt = data_left / ESP_BLOCK_SIZE;
-			len_to_send = data_left;
-			ret = esp_write_block(context, ESP_SLAVE_CMD53_END_ADDR - len_to_send,
-					pos, (len_to_send + 3) & (~3), ACQUIRE_LOCK);
-
-			if (ret) {
-				esp_err("Failed to send data: %d %d %d\n", ret, len_to_send, data_left);
+		/* Batch: each packet but the last takes whole slave buffer,
+		 * so add packets only while that costs no extra padding */
+		batch_cnt = 1;
+		while ((context->adapter->ext_capabilities & ESP_TRANSPORT_SDIO_BATCH) &&
+		       tx_batch_buf && (batch_cnt < SDIO_TX_BATCH_MAX) &&
+		       (tx_skb[batch_cnt - 1]->len > ESP_RX_BUFFER_SIZE - ESP_BLOCK_SIZE) &&
+		       is_tx_ready(context) && sdio_take_write_buffer()) {
+
+			tx_skb[batch_cnt] = sdio_dequeue_tx_skb(context);
+			if (!tx_skb[batch_cnt]) {
+				/* Buffer was not used */
+				tx_buf_available++;
 				break;
 			}
+			batch_cnt++;
+		}
+
+		if (batch_cnt == 1) {
+			esp_hex_dump_dbg("sdio_tx: ", tx_skb[0]->data, 32);
+			ret = sdio_write_data(context, tx_skb[0]->data, tx_skb[0]->len);
+		} else {
+			for (i = 0; i < batch_cnt; i++)
+				memcpy(tx_batch_buf + i * ESP_RX_BUFFER_SIZE,
+						tx_skb[i]->data, tx_skb[i]->len);
+
+			len = (batch_cnt - 1) * ESP_RX_BUFFER_SIZE + tx_skb[batch_cnt - 1]->len;
+			esp_hex_dump_dbg("sdio_tx: ", tx_batch_buf, 32);
+			ret = sdio_write_data(context, tx_batch_buf, len);
+			buf_needed += batch_cnt - 1;
+		}
 
-			data_left -= len_to_send;
-			pos += len_to_send;
-		} while (data_left);
+		ESP_IF_STATS_INC(context->adapter, xfers);
+
+		/* Drop the packets on failure */
+		for (i = 0; i < batch_cnt; i++)
+			dev_kfree_skb(tx_skb[i]);
 
 		if (ret) {
-			/* drop the packet */
-			dev_kfree_skb(tx_skb);
+			ESP_IF_STATS_ADD(context->adapter, tx_errors, batch_cnt);
 			continue;
 		}
 
 		context->tx_buffer_count += buf_needed;
 		context->tx_buffer_count = context->tx_buffer_count % ESP_TX_BUFFER_MAX;
-
-		dev_kfree_skb(tx_skb);
 	}
 
 	do_exit(0);
@@ -761,6 +982,11 @@ static int esp_probe(struct sdio_func *func,
 		return ret;
 	}
 
+	tx_batch_buf = kzalloc(SDIO_TX_BATCH_MAX * ESP_RX_BUFFER_SIZE + ESP_BLOCK_SIZE,
+			GFP_KERNEL);
+	if (!tx_batch_buf)
+		esp_warn("Failed to allocate TX batch buffer, batching disabled\n");
+
 	tx_thread = kthread_run(tx_process, context->adapter, "esp32_TX");
 
 	if (!tx_thread)
@@ -790,6 +1016,11 @@ int esp_init_interface_layer(struct esp_adapter *adapter)
 	adapter->if_context = &sdio_context;
 	adapter->if_ops = &if_ops;
 	sdio_context.adapter = adapter;
+
+	/* RX buffers are allocated per read, nothing to tune there */
+	adapter->tx_q_limit = TX_MAX_PENDING_COUNT;
+	adapter->tx_q_limit_max = TX_MAX_PENDING_LIMIT;
+
 	if (adapter->mod_param.clockspeed != MOD_PARAM_UNINITIALISED)
 		sdio_context.sdio_clk_mhz = adapter->mod_param.clockspeed;
 
@@ -809,6 +1040,7 @@ int process_init_event(u8 *evt_buf, u8 len)
 		return -1;
 
 	pos = evt_buf;
+	adapter->ext_capabilities = 0;
 
 	if (len_left >= 64) {
 		esp_warn("ESP init event len looks unexpected: %u (>=64)\n", len_left);
@@ -828,6 +1060,10 @@ int process_init_event(u8 *evt_buf, u8 len)
 				*(pos+2) == ESP_FIRMWARE_CHIP_ESP32 ? "esp32" :
 				*(pos+2) == ESP_FIRMWARE_CHIP_ESP32C6 ? "esp32-c6" :
 				"unknown/unsupported ESP chiset");
+		} else if (*pos == ESP_PRIV_CAPABILITY_EXT) {
+			adapter->ext_capabilities = (*(pos + 2) | (*(pos + 3) << 8) |
+					(*(pos + 4) << 16) | ((u32)*(pos + 5) << 24)) &
+					ESP_HOST_EXT_CAPABILITIES;
 		} else if (*pos == ESP_PRIV_FW_DATA) {
 			fw_p = (struct fw_version *)(pos + 2);
 			ret = process_fw_data(fw_p, tag_len);
@@ -849,6 +1085,8 @@ int process_init_event(u8 *evt_buf, u8 len)
 	}
 
 	sdio_context.adapter->state = ESP_CONTEXT_READY;
+	wake_up_interruptible(&tx_wait);
+
 	ret = esp_add_card(sdio_context.adapter);
 	if (ret) {
 		esp_err("network interface init failed\n");
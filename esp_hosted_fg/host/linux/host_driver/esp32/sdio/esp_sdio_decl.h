@@ -42,6 +42,8 @@
 #define ESP_BLOCK_SIZE                 512
 #define ESP_RX_BYTE_MAX                0x100000
 #define ESP_RX_BUFFER_SIZE             1536
+/* Max packets written in single CMD53, one slave buffer each */
+#define SDIO_TX_BATCH_MAX              4
 
 #define ESP_TX_BUFFER_MASK             0xFFF
 #define ESP_TX_BUFFER_MAX              0x1000
@@ -90,9 +92,13 @@ struct esp_sdio_context {
 	struct esp_adapter     *adapter;
 	struct sdio_func       *func;
 	struct sk_buff_head    tx_q[MAX_PRIORITY_QUEUES];
+	/* Read in SDIO irq thread, processed in NAPI poll */
+	struct sk_buff_head    rx_q;
 	u32                    rx_byte_count;
 	u32                    tx_buffer_count;
 	u32                    sdio_clk_mhz;
+	/* Start of interrupt handling, for read latency */
+	ktime_t                irq_time;
 };
 
 #endif
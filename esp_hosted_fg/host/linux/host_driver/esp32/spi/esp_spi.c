@@ -31,11 +31,15 @@
 #include "esp_kernel_port.h"
 #include "esp_stats.h"
 #include "esp_fw_verify.h"
+#include "esp_trace.h"
+#include "esp_debugfs.h"
 
 #define SPI_INITIAL_CLK_MHZ     10
 #define NUMBER_1M               1000000
+/* Default and max of TX queue limit, tunable as ethtool ring parameter */
 #define TX_MAX_PENDING_COUNT    100
-#define TX_RESUME_THRESHOLD     (TX_MAX_PENDING_COUNT/5)
+#define TX_MAX_PENDING_LIMIT    1000
+#define TX_RESUME_THRESHOLD(limit) ((limit)/5)
 
 /* ESP in sdkconfig has CONFIG_IDF_FIRMWARE_CHIP_ID entry.
  * supported values of CONFIG_IDF_FIRMWARE_CHIP_ID are - */
@@ -59,8 +63,10 @@
 
 static struct sk_buff * read_packet(struct esp_adapter *adapter);
 static int write_packet(struct esp_adapter *adapter, struct sk_buff *skb);
+static int queue_packet(struct esp_adapter *adapter, struct sk_buff *skb);
+static void kick_tx(struct esp_adapter *adapter);
 static void spi_exit(void);
-static void esp_spi_transaction(void);
+static int esp_spi_transaction(void);
 static int spi_dev_init(struct esp_spi_context *context);
 static int spi_init(void);
 
@@ -75,6 +81,8 @@ u8 first_esp_bootup_over;
 static struct esp_if_ops if_ops = {
 	.read		= read_packet,
 	.write		= write_packet,
+	.queue		= queue_packet,
+	.kick		= kick_tx,
 };
 
 static DEFINE_MUTEX(spi_lock);
@@ -93,8 +101,105 @@ static void close_data_path(void)
 	msleep(200);
 }
 
+static inline u8 spi_credit_pool(u8 prio_q_idx)
+{
+	return (spi_context.credit_pools == 1) ? 0 : prio_q_idx;
+}
+
+static inline u32 spi_credits_available(u8 prio_q_idx)
+{
+	u8 pool = spi_credit_pool(prio_q_idx);
+
+	return spi_context.credits_granted[pool] - spi_context.credits_used[pool];
+}
+
+static void spi_init_credits(u8 *pool_size, u8 pools)
+{
+	u8 pool = 0;
+
+	mutex_lock(&spi_lock);
+
+	spi_context.credit_pools = 0;
+
+	if (pool_size && ((pools == 1) || (pools == MAX_PRIORITY_QUEUES))) {
+		for (pool = 0; pool < pools; pool++) {
+			spi_context.credit_pool_size[pool] = pool_size[pool];
+			spi_context.credit_cnt[pool] = 0;
+			spi_context.credits_granted[pool] = pool_size[pool];
+			spi_context.credits_used[pool] = 0;
+		}
+		spi_context.credit_pools = pools;
+		esp_info("Credit based flow control, %u pool(s)\n", pools);
+	}
+
+	mutex_unlock(&spi_lock);
+}
+
+static void spi_update_credits(u8 credits)
+{
+	u8 pool = (credits >> ESP_CREDIT_POOL_SHIFT) - 1;
+	u8 cnt = credits & ESP_CREDIT_COUNT_MASK;
+
+	if (pool >= spi_context.credit_pools)
+		return;
+
+	spi_context.credits_granted[pool] +=
+		(cnt - spi_context.credit_cnt[pool]) & ESP_CREDIT_COUNT_MASK;
+	spi_context.credit_cnt[pool] = cnt;
+}
+
+/* Give back credit taken in spi_dequeue_tx_skb, for frame not sent */
+static void spi_refund_credit(struct sk_buff *skb)
+{
+	struct esp_payload_header *header = (struct esp_payload_header *) skb->data;
+	u8 pool = 0;
+
+	if (!spi_context.credit_pools)
+		return;
+
+	pool = spi_credit_pool(ESP_PRIO_Q(header->if_type, header->flags));
+
+	/* Credits may have been re-initialised meanwhile */
+	if (spi_context.credits_used[pool])
+		spi_context.credits_used[pool]--;
+}
+
+/* Dequeue from highest priority queue, ESP has room for */
+static struct sk_buff * spi_dequeue_tx_skb(void)
+{
+	struct sk_buff *skb = NULL;
+	u8 prio_q_idx = 0;
+
+	for (prio_q_idx = 0; prio_q_idx < MAX_PRIORITY_QUEUES; prio_q_idx++) {
+		if (spi_context.credit_pools && !spi_credits_available(prio_q_idx))
+			continue;
+
+		skb = skb_dequeue(&spi_context.tx_q[prio_q_idx]);
+		if (skb) {
+			trace_esp_tx_dequeue(((struct esp_payload_header *) skb->data)->if_type,
+					skb->len, prio_q_idx,
+					skb_queue_len(&spi_context.tx_q[prio_q_idx]),
+					((struct esp_skb_cb *) skb->cb)->enq_time);
+			ESP_IF_STATS_INC(spi_context.adapter, q[prio_q_idx].tx_dequeued);
+			if (spi_context.credit_pools)
+				spi_context.credits_used[spi_credit_pool(prio_q_idx)]++;
+			esp_tx_dequeued(skb);
+			return skb;
+		}
+	}
+
+	return NULL;
+}
+
 static irqreturn_t spi_data_ready_interrupt_handler(int irq, void * dev)
 {
+	if (!ktime_to_ns(spi_context.irq_time))
+		spi_context.irq_time = ktime_get();
+
+	/* SPI thread checks GPIO itself */
+	if (READ_ONCE(spi_context.polling))
+		return IRQ_HANDLED;
+
 	up(&spi_sem);
 	esp_verbose("\n");
  	return IRQ_HANDLED;
@@ -102,6 +207,10 @@ static irqreturn_t spi_data_ready_interrupt_handler(int irq, void * dev)
 
 static irqreturn_t spi_interrupt_handler(int irq, void * dev)
 {
+	/* SPI thread checks GPIO itself */
+	if (READ_ONCE(spi_context.polling))
+		return IRQ_HANDLED;
+
 	up(&spi_sem);
 	esp_verbose("\n");
 	return IRQ_HANDLED;
@@ -111,6 +220,7 @@ static struct sk_buff * read_packet(struct esp_adapter *adapter)
 {
 	struct esp_spi_context *context;
 	struct sk_buff *skb = NULL;
+	u8 prio_q_idx = 0;
 
 	if (!data_path) {
 		esp_verbose("datapath not yet open\n");
@@ -125,11 +235,13 @@ static struct sk_buff * read_packet(struct esp_adapter *adapter)
 	context = adapter->if_context;
 
 	if (context->esp_spi_dev) {
-		skb = skb_dequeue(&(context->rx_q[PRIO_Q_SERIAL]));
-		if (!skb)
-			skb = skb_dequeue(&(context->rx_q[PRIO_Q_BT]));
-		if (!skb)
-			skb = skb_dequeue(&(context->rx_q[PRIO_Q_OTHERS]));
+		for (prio_q_idx = 0; prio_q_idx < MAX_PRIORITY_QUEUES; prio_q_idx++) {
+			skb = skb_dequeue(&(context->rx_q[prio_q_idx]));
+			if (skb) {
+				ESP_IF_STATS_INC(adapter, q[prio_q_idx].rx_dequeued);
+				break;
+			}
+		}
 	} else {
 		esp_err("Invalid args\n");
 		return NULL;
@@ -138,10 +250,11 @@ static struct sk_buff * read_packet(struct esp_adapter *adapter)
 	return skb;
 }
 
-static int write_packet(struct esp_adapter *adapter, struct sk_buff *skb)
+static int queue_packet(struct esp_adapter *adapter, struct sk_buff *skb)
 {
 	u32 max_pkt_size = SPI_BUF_SIZE;
 	struct esp_payload_header *payload_header = (struct esp_payload_header *) skb->data;
+	u8 prio_q_idx = 0;
 
 	if (!adapter || !adapter->if_context || !skb || !skb->data || !skb->len) {
 		esp_err("Invalid args\n");
@@ -149,43 +262,61 @@ static int write_packet(struct esp_adapter *adapter, struct sk_buff *skb)
 		return -EINVAL;
 	}
 
+	prio_q_idx = ESP_PRIO_Q(payload_header->if_type, payload_header->flags);
+
 	if (skb->len > max_pkt_size) {
 		esp_err("Drop pkt of len[%u] > max spi transport len[%u]\n",
 				skb->len, max_pkt_size);
+		ESP_IF_STATS_INC(adapter, q[prio_q_idx].tx_dropped);
 		dev_kfree_skb(skb);
 		return -EPERM;
 	}
 
 	if (!data_path) {
 		esp_verbose("datapath not yet open\n");
+		ESP_IF_STATS_INC(adapter, q[prio_q_idx].tx_dropped);
 		dev_kfree_skb(skb);
 		return -EPERM;
 	}
 
 
 	/* Enqueue SKB in tx_q */
-	if (payload_header->if_type == ESP_SERIAL_IF) {
-		skb_queue_tail(&spi_context.tx_q[PRIO_Q_SERIAL], skb);
-	} else if (payload_header->if_type == ESP_HCI_IF) {
-		skb_queue_tail(&spi_context.tx_q[PRIO_Q_BT], skb);
-	} else {
-		if (atomic_read(&tx_pending) >= TX_MAX_PENDING_COUNT) {
+	if (prio_q_idx >= PRIO_Q_DATA_HI) {
+		/* Network queues are limited per interface and priority,
+		 * this caps their sum and raw throughput test frames */
+		if (atomic_read(&tx_pending) >= READ_ONCE(adapter->tx_q_limit))
 			esp_tx_pause();
-		}
-		skb_queue_tail(&spi_context.tx_q[PRIO_Q_OTHERS], skb);
 		atomic_inc(&tx_pending);
 	}
 
-	up(&spi_sem);
+	ESP_IF_STATS_INC(adapter, q[prio_q_idx].tx_enqueued);
+	((struct esp_skb_cb *) skb->cb)->enq_time = ktime_get();
+	skb_queue_tail(&spi_context.tx_q[prio_q_idx], skb);
 
 	return 0;
 }
 
+static void kick_tx(struct esp_adapter *adapter)
+{
+	up(&spi_sem);
+}
+
+static int write_packet(struct esp_adapter *adapter, struct sk_buff *skb)
+{
+	int ret = queue_packet(adapter, skb);
+
+	/* Also on failure, for packets queued earlier without kick */
+	kick_tx(adapter);
+
+	return ret;
+}
+
 
 int process_init_event(u8 *evt_buf, u8 len)
 {
 	u8 len_left = len, tag_len;
 	u8 *pos;
+	u8 *credit_pool_size = NULL, credit_pools = 0;
 	struct esp_adapter *adapter = esp_get_adapter();
 	uint8_t prio_q_idx = 0;
 	int ret = 0;
@@ -196,6 +327,7 @@ int process_init_event(u8 *evt_buf, u8 len)
 		return -1;
 
 	pos = evt_buf;
+	adapter->ext_capabilities = 0;
 
 	while (len_left) {
 		tag_len = *(pos + 1);
@@ -206,6 +338,13 @@ int process_init_event(u8 *evt_buf, u8 len)
 			hardware_type = *(pos+2);
 		} else if (*pos == ESP_PRIV_TEST_RAW_TP) {
 			process_test_capabilities(*(pos + 2));
+		} else if (*pos == ESP_PRIV_CAPABILITY_EXT) {
+			adapter->ext_capabilities = (*(pos + 2) | (*(pos + 3) << 8) |
+					(*(pos + 4) << 16) | ((u32)*(pos + 5) << 24)) &
+					ESP_HOST_EXT_CAPABILITIES;
+		} else if (*pos == ESP_PRIV_RX_QUEUE_SIZE) {
+			credit_pool_size = pos + 2;
+			credit_pools = tag_len;
 		} else if (*pos == ESP_PRIV_FW_DATA) {
 			fw_p = (struct fw_version *)(pos + 2);
 			ret = process_fw_data(fw_p, tag_len);
@@ -238,6 +377,11 @@ int process_init_event(u8 *evt_buf, u8 len)
 		return -1;
 	}
 
+	if (adapter->ext_capabilities & ESP_TRANSPORT_CREDITS)
+		spi_init_credits(credit_pool_size, credit_pools);
+	else
+		spi_init_credits(NULL, 0);
+
 	if (first_esp_bootup_over) {
 		for (prio_q_idx=0; prio_q_idx<MAX_PRIORITY_QUEUES; prio_q_idx++) {
 			skb_queue_purge(&spi_context.tx_q[prio_q_idx]);
@@ -267,11 +411,46 @@ int process_init_event(u8 *evt_buf, u8 len)
 }
 
 
+static struct sk_buff * spi_get_rx_skb(void)
+{
+	struct sk_buff *skb = skb_dequeue(&spi_context.rx_skb_pool);
+
+	if (!skb)
+		skb = esp_alloc_skb(SPI_BUF_SIZE);
+
+	return skb;
+}
+
+static void spi_recycle_rx_skb(struct sk_buff *skb)
+{
+	if (skb_queue_len(&spi_context.rx_skb_pool) >=
+	    READ_ONCE(spi_context.adapter->rx_q_limit)) {
+		dev_kfree_skb(skb);
+		return;
+	}
+
+	skb_trim(skb, 0);
+	skb_queue_tail(&spi_context.rx_skb_pool, skb);
+}
+
+/* ESP uses variable length transactions from next one on.
+ * Flag is not part of frame, it is cleared before checksum validation */
+static void spi_check_var_len_switch(struct esp_payload_header *header)
+{
+	if (!(header->flags & SPI_VAR_LEN_SWITCH))
+		return;
+
+	header->flags &= ~SPI_VAR_LEN_SWITCH;
+	spi_context.var_len = 1;
+	esp_info("Switched to variable length SPI transactions\n");
+}
+
 static int process_rx_buf(struct sk_buff *skb)
 {
 	struct esp_payload_header *header;
 	u16 len = 0;
 	u16 offset = 0;
+	u8 prio_q_idx = 0;
 
 	if (!skb)
 		return -EINVAL;
@@ -280,13 +459,22 @@ static int process_rx_buf(struct sk_buff *skb)
 
 	esp_hex_dump_dbg("spi_rx: ", skb->data , min(skb->len, 32));
 
+	spi_check_var_len_switch(header);
+
+	if (header->credits) {
+		/* Not covered by checksum either */
+		spi_update_credits(header->credits);
+		header->credits = 0;
+	}
+
 	if (header->if_type >= ESP_MAX_IF) {
 		return -EINVAL;
 	}
 
 	len = le16_to_cpu(header->len);
 	if (!len) {
-		return -EINVAL;
+		/* Nothing sent by ESP */
+		return -ENODATA;
 	}
 
 	offset = le16_to_cpu(header->offset);
@@ -316,13 +504,26 @@ static int process_rx_buf(struct sk_buff *skb)
 		return -EPERM;
 	}
 
+	/* Copy small frame, so that large buffer goes back to pool.
+	 * Aggregated frame gets split into new skbs anyway */
+	if ((len <= SPI_RX_COPYBREAK) && !(header->flags & AGGREGATED_FRAME)) {
+		struct sk_buff *copy_skb = esp_alloc_skb(len);
+
+		if (copy_skb) {
+			skb_put_data(copy_skb, skb->data, len);
+			spi_recycle_rx_skb(skb);
+			skb = copy_skb;
+			header = (struct esp_payload_header *) skb->data;
+		}
+	}
+
 	/* enqueue skb for read_packet to pick it */
-	if (header->if_type == ESP_SERIAL_IF)
-		skb_queue_tail(&spi_context.rx_q[PRIO_Q_SERIAL], skb);
-	else if (header->if_type == ESP_HCI_IF)
-		skb_queue_tail(&spi_context.rx_q[PRIO_Q_BT], skb);
-	else
-		skb_queue_tail(&spi_context.rx_q[PRIO_Q_OTHERS], skb);
+	prio_q_idx = ESP_PRIO_Q(header->if_type, header->flags);
+	trace_esp_rx_parse(header->if_type, header->if_num, len, offset,
+			header->flags, skb_queue_len(&spi_context.rx_q[prio_q_idx]));
+	esp_hist_add(ESP_HIST_RX_SIZE, len);
+	ESP_IF_STATS_INC(spi_context.adapter, q[prio_q_idx].rx_enqueued);
+	skb_queue_tail(&spi_context.rx_q[prio_q_idx], skb);
 
 	/* indicate reception of new packet */
 	esp_process_new_packet_intr(spi_context.adapter);
@@ -330,98 +531,361 @@ static int process_rx_buf(struct sk_buff *skb)
 	return 0;
 }
 
-static void esp_spi_transaction(void)
+static void spi_requeue_tx_skb(struct sk_buff *skb)
+{
+	struct esp_payload_header *header = (struct esp_payload_header *) skb->data;
+
+	spi_refund_credit(skb);
+	skb_queue_head(&spi_context.tx_q[ESP_PRIO_Q(header->if_type, header->flags)], skb);
+}
+
+/* Header phase of variable length transaction.
+ * Returns length to be clocked in payload phase */
+static int spi_var_len_hdr_transaction(struct sk_buff *tx_skb)
 {
+	struct esp_spi_var_len_hdr *tx_hdr, *rx_hdr;
 	struct spi_transfer trans;
-	struct sk_buff *tx_skb = NULL, *rx_skb = NULL;
-	u8 *rx_buf;
+	u32 host_len = tx_skb ? tx_skb->len : 0;
+	u32 esp_len = 0;
+	int ret = 0;
+
+	tx_hdr = (struct esp_spi_var_len_hdr *) spi_context.var_len_hdr;
+	rx_hdr = tx_hdr + 1;
+
+	memset(tx_hdr, 0, 2 * sizeof(struct esp_spi_var_len_hdr));
+	tx_hdr->magic = SPI_VAR_LEN_HDR_MAGIC;
+	tx_hdr->len = cpu_to_le16(host_len);
+
+	memset(&trans, 0, sizeof(trans));
+	trans.speed_hz = spi_context.spi_clk_mhz * NUMBER_1M;
+	trans.tx_buf = tx_hdr;
+	trans.rx_buf = rx_hdr;
+	trans.len = sizeof(struct esp_spi_var_len_hdr);
+
+#if (LINUX_VERSION_CODE >= KERNEL_VERSION(3, 15, 0))
+	if (hardware_type == ESP_PRIV_FIRMWARE_CHIP_ESP32) {
+		trans.cs_change = 1;
+	}
+#endif
+	ret = spi_sync_transfer(spi_context.esp_spi_dev, &trans, 1);
+	if (ret) {
+		esp_err("SPI header transaction failed: %d\n", ret);
+		return ret;
+	}
+
+	if (rx_hdr->magic != SPI_VAR_LEN_HDR_MAGIC) {
+		/* ESP restarted and is back to full length transactions */
+		esp_info("Invalid header phase magic[0x%x], back to full length transactions\n",
+				rx_hdr->magic);
+		spi_context.var_len = 0;
+		return -EPROTO;
+	}
+
+	esp_len = le16_to_cpu(rx_hdr->len);
+	if (esp_len > SPI_BUF_SIZE) {
+		esp_err("ESP announced len[%u] > max[%u]\n", esp_len, SPI_BUF_SIZE);
+		esp_len = SPI_BUF_SIZE;
+	}
+
+	return SPI_VAR_LEN_ALIGN(max(host_len, esp_len));
+}
+
+static void spi_xfer_complete(void *context)
+{
+	struct esp_spi_xfer_slot *slot = context;
+
+	complete(&slot->done);
+
+	/* Let SPI thread process RX and start next transaction */
+	up(&spi_sem);
+}
+
+static int spi_xfer_in_flight(void)
+{
+	struct esp_spi_xfer_slot *slot = NULL;
+	u8 i = 0;
+
+	for (i = 0; i < SPI_XFER_SLOTS; i++) {
+		slot = &spi_context.xfer_slots[i];
+		if (slot->busy && !completion_done(&slot->done))
+			return 1;
+	}
+
+	return 0;
+}
+
+/* Apply variable length switch of completed transactions, which are
+ * not yet reaped, so that next transaction already uses it */
+static void spi_peek_var_len_switch(void)
+{
+	struct esp_spi_xfer_slot *slot = NULL;
+	u8 i = 0;
+
+	if (spi_context.var_len)
+		return;
+
+	for (i = 0; i < SPI_XFER_SLOTS; i++) {
+		slot = &spi_context.xfer_slots[i];
+		if (slot->busy && completion_done(&slot->done) && !slot->msg.status)
+			spi_check_var_len_switch(
+				(struct esp_payload_header *) slot->rx_skb->data);
+	}
+}
+
+/* Process completed transactions, in submission order */
+static void spi_reap_xfer_slots(void)
+{
+	struct esp_spi_xfer_slot *slot = NULL;
+	struct esp_adapter *adapter = spi_context.adapter;
+	u8 i = 0, idx = 0;
+	int ret = 0;
+
+	for (i = 0; i < SPI_XFER_SLOTS; i++) {
+		idx = (spi_context.xfer_slot_next + i) % SPI_XFER_SLOTS;
+		slot = &spi_context.xfer_slots[idx];
+
+		if (!slot->busy)
+			continue;
+
+		if (!try_wait_for_completion(&slot->done))
+			break;
+
+		ESP_IF_STATS_INC(adapter, xfers);
+		trace_esp_xfer_end(slot->tx_skb ? slot->tx_skb->len : 0,
+				slot->trans.len, slot->msg.status, slot->start_time);
+		esp_hist_add_us_since(ESP_HIST_XFER_US, slot->start_time);
+
+		if (slot->msg.status) {
+			esp_err("SPI Transaction failed: %d\n", slot->msg.status);
+			ESP_IF_STATS_INC(adapter, rx_errors);
+			if (slot->tx_skb)
+				ESP_IF_STATS_INC(adapter, tx_errors);
+			spi_recycle_rx_skb(slot->rx_skb);
+		} else {
+			ret = process_rx_buf(slot->rx_skb);
+			if (ret) {
+				/* Recycle rx_skb if received data is not valid */
+				spi_recycle_rx_skb(slot->rx_skb);
+
+				if ((ret == -ENODATA) && !slot->tx_skb)
+					ESP_IF_STATS_INC(adapter, xfers_dummy);
+				else if ((ret != -ENODATA) && (ret != -EPERM))
+					ESP_IF_STATS_INC(adapter, rx_errors);
+			}
+		}
+
+		if (slot->tx_skb)
+			dev_kfree_skb(slot->tx_skb);
+
+		slot->tx_skb = NULL;
+		slot->rx_skb = NULL;
+		slot->busy = 0;
+	}
+}
+
+/* Wait for transactions in flight and process them */
+static void spi_flush_xfer_slots(void)
+{
+	struct esp_spi_xfer_slot *slot = NULL;
+	u8 i = 0;
+
+	for (i = 0; i < SPI_XFER_SLOTS; i++) {
+		slot = &spi_context.xfer_slots[i];
+		if (slot->busy) {
+			wait_for_completion(&slot->done);
+			/* Keep it done for spi_reap_xfer_slots() */
+			complete(&slot->done);
+		}
+	}
+
+	spi_reap_xfer_slots();
+}
+
+static void spi_data_transaction(struct sk_buff *tx_skb, u32 len)
+{
+	struct esp_spi_xfer_slot *slot = NULL;
+	struct sk_buff *rx_skb = NULL;
 	int ret = 0;
+
+	/* Setup and submit SPI transaction
+	 * 	Tx_buf: Check if tx_q has valid buffer for transmission,
+	 * 		else keep it blank
+	 *
+	 * 	Rx_buf: Take buffer from RX pool. Once transaction completes,
+	 *		this goes back to pool if received buffer is invalid
+	 *		or copied. Otherwise upper layer will free it.
+	 * */
+
+	slot = &spi_context.xfer_slots[spi_context.xfer_slot_next];
+	if (slot->busy) {
+		/* Completed, but not yet processed */
+		spi_reap_xfer_slots();
+	}
+
+	rx_skb = spi_get_rx_skb();
+	if (!rx_skb) {
+		esp_err("Failed to allocate RX SKB\n");
+		if (tx_skb)
+			spi_requeue_tx_skb(tx_skb);
+		return;
+	}
+
+	memset(&slot->trans, 0, sizeof(slot->trans));
+	slot->trans.speed_hz = spi_context.spi_clk_mhz * NUMBER_1M;
+
+	/* Configure TX buffer if available */
+	if (tx_skb) {
+		slot->trans.tx_buf = tx_skb->data;
+		esp_hex_dump_dbg("spi_tx: ", slot->trans.tx_buf, 32);
+	} else {
+		slot->trans.tx_buf = spi_context.tx_dummy_buf;
+	}
+
+	/* Configure RX buffer */
+	slot->trans.rx_buf = skb_put(rx_skb, len);
+	slot->trans.len = len;
+
+#if (LINUX_VERSION_CODE >= KERNEL_VERSION(3, 15, 0))
+	if (hardware_type == ESP_PRIV_FIRMWARE_CHIP_ESP32) {
+		slot->trans.cs_change = 1;
+	}
+#endif
+	spi_message_init(&slot->msg);
+	spi_message_add_tail(&slot->trans, &slot->msg);
+	slot->msg.complete = spi_xfer_complete;
+	slot->msg.context = slot;
+
+	slot->tx_skb = tx_skb;
+	slot->rx_skb = rx_skb;
+	reinit_completion(&slot->done);
+	slot->busy = 1;
+
+	trace_esp_xfer_start(tx_skb ? tx_skb->len : 0, len);
+	slot->start_time = ktime_get();
+
+	ret = spi_async(spi_context.esp_spi_dev, &slot->msg);
+	if (ret) {
+		esp_err("SPI Transaction failed: %d\n", ret);
+		spi_recycle_rx_skb(rx_skb);
+		if (tx_skb) {
+			ESP_IF_STATS_INC(spi_context.adapter, tx_errors);
+			spi_refund_credit(tx_skb);
+			dev_kfree_skb(tx_skb);
+		}
+		slot->tx_skb = NULL;
+		slot->rx_skb = NULL;
+		slot->busy = 0;
+		return;
+	}
+
+	spi_context.xfer_slot_next = (spi_context.xfer_slot_next + 1) % SPI_XFER_SLOTS;
+}
+
+/* Returns 1 if bus is busy, i.e. transaction was started or is in flight */
+static int esp_spi_transaction(void)
+{
+	struct sk_buff *tx_skb = NULL;
+	int ret = 0, busy = 0;
 	volatile int slave_ready, rx_pending;
+	u8 aggr_cnt[MAX_PRIORITY_QUEUES] = {0};
+	u8 prio_q_idx = 0;
+	u32 q_depth = 0;
 
 	mutex_lock(&spi_lock);
 
+	if (spi_xfer_in_flight()) {
+		/* Handshake is still for transaction on the bus. Completion
+		 * wakes SPI thread up again */
+		mutex_unlock(&spi_lock);
+		return 1;
+	}
+
+	/* Previous transaction may have switched ESP to variable length */
+	spi_peek_var_len_switch();
+
 	slave_ready = gpio_get_value(spi_context.handshake_gpio);
 	rx_pending = gpio_get_value(spi_context.dataready_gpio);
 
 	if (slave_ready) {
+		if (spi_context.var_len_xfer_len) {
+			/* Payload phase of variable length transaction */
+			tx_skb = spi_context.var_len_tx_skb;
+			spi_context.var_len_tx_skb = NULL;
+
+			spi_data_transaction(tx_skb, spi_context.var_len_xfer_len);
+			spi_context.var_len_xfer_len = 0;
+
+			spi_reap_xfer_slots();
+			mutex_unlock(&spi_lock);
+			return 1;
+		}
+
 		if (data_path) {
-			tx_skb = skb_dequeue(&spi_context.tx_q[PRIO_Q_SERIAL]);
-			if (!tx_skb)
-				tx_skb = skb_dequeue(&spi_context.tx_q[PRIO_Q_BT]);
-			if (!tx_skb)
-				tx_skb = skb_dequeue(&spi_context.tx_q[PRIO_Q_OTHERS]);
+			tx_skb = spi_dequeue_tx_skb();
 			if (tx_skb) {
+				tx_skb = esp_aggregate_tx_skb(tx_skb, spi_context.tx_q,
+						SPI_BUF_SIZE, aggr_cnt);
+
+				for (prio_q_idx = 0; prio_q_idx < MAX_PRIORITY_QUEUES; prio_q_idx++)
+					ESP_IF_STATS_ADD(spi_context.adapter,
+							q[prio_q_idx].tx_dequeued, aggr_cnt[prio_q_idx]);
+
 				if (atomic_read(&tx_pending))
 					atomic_dec(&tx_pending);
 
-				if (atomic_read(&tx_pending) < TX_RESUME_THRESHOLD) {
+				while (aggr_cnt[PRIO_Q_DATA_HI]--)
+					atomic_dec_if_positive(&tx_pending);
+				while (aggr_cnt[PRIO_Q_OTHERS]--)
+					atomic_dec_if_positive(&tx_pending);
+
+				if (atomic_read(&tx_pending) <
+				    TX_RESUME_THRESHOLD(READ_ONCE(spi_context.adapter->tx_q_limit))) {
 					esp_tx_resume();
-#if TEST_RAW_TP
 					esp_raw_tp_queue_resume();
-#endif
 				}
 			}
 		}
 
 		if (rx_pending || tx_skb) {
-			memset(&trans, 0, sizeof(trans));
-			trans.speed_hz = spi_context.spi_clk_mhz * NUMBER_1M;
-
-			/* Setup and execute SPI transaction
-			 * 	Tx_buf: Check if tx_q has valid buffer for transmission,
-			 * 		else keep it blank
-			 *
-			 * 	Rx_buf: Allocate memory for incoming data. This will be freed
-			 *		immediately if received buffer is invalid.
-			 *		If it is a valid buffer, upper layer will free it.
-			 * */
-
-			/* Configure TX buffer if available */
-
-			if (tx_skb) {
-				trans.tx_buf = tx_skb->data;
-				esp_hex_dump_dbg("spi_tx: ", trans.tx_buf, 32);
-			} else {
-				tx_skb = esp_alloc_skb(SPI_BUF_SIZE);
-				trans.tx_buf = skb_put(tx_skb, SPI_BUF_SIZE);
-				memset((void*)trans.tx_buf, 0, SPI_BUF_SIZE);
-			}
-
-			/* Configure RX buffer */
-			rx_skb = esp_alloc_skb(SPI_BUF_SIZE);
-			rx_buf = skb_put(rx_skb, SPI_BUF_SIZE);
+			busy = 1;
 
-			memset(rx_buf, 0, SPI_BUF_SIZE);
-
-			trans.rx_buf = rx_buf;
-			trans.len = SPI_BUF_SIZE;
-
-#if (LINUX_VERSION_CODE >= KERNEL_VERSION(3, 15, 0))
-			if (hardware_type == ESP_PRIV_FIRMWARE_CHIP_ESP32) {
-				trans.cs_change = 1;
+			if (rx_pending && ktime_to_ns(spi_context.irq_time)) {
+				esp_hist_add_us_since(ESP_HIST_IRQ_TO_READ_US, spi_context.irq_time);
+				spi_context.irq_time = 0;
 			}
-#endif
-			ret = spi_sync_transfer(spi_context.esp_spi_dev, &trans, 1);
-			if (ret) {
-				esp_err("SPI Transaction failed: %d\n", ret);
-				dev_kfree_skb(rx_skb);
-				dev_kfree_skb(tx_skb);
-			} else {
 
-				/* Free rx_skb if received data is not valid */
-				if (process_rx_buf(rx_skb)) {
-					dev_kfree_skb(rx_skb);
-				}
-
-				if (tx_skb)
+			for (prio_q_idx = 0; prio_q_idx < MAX_PRIORITY_QUEUES; prio_q_idx++)
+				q_depth += skb_queue_len(&spi_context.tx_q[prio_q_idx]);
+			esp_hist_add(ESP_HIST_TX_Q_DEPTH, q_depth);
+
+			if (spi_context.var_len) {
+				ret = spi_var_len_hdr_transaction(tx_skb);
+
+				if (ret > 0) {
+					/* Wait for ESP to be ready for payload phase */
+					spi_context.var_len_tx_skb = tx_skb;
+					spi_context.var_len_xfer_len = ret;
+				} else if (tx_skb && (ret == -EPROTO)) {
+					spi_requeue_tx_skb(tx_skb);
+				} else if (tx_skb) {
+					ESP_IF_STATS_INC(spi_context.adapter, tx_errors);
+					spi_refund_credit(tx_skb);
 					dev_kfree_skb(tx_skb);
+				}
+			} else {
+				spi_data_transaction(tx_skb, SPI_BUF_SIZE);
 			}
 		}
 	} else {
 		up(&spi_sem);
 	}
 
+	/* RX of previous transaction, while the one just started is on bus */
+	spi_reap_xfer_slots();
+
 	mutex_unlock(&spi_lock);
+
+	return busy;
 }
 
 #if (LINUX_VERSION_CODE >= KERNEL_VERSION(5, 16, 0))
@@ -579,6 +1043,73 @@ static int spi_dev_init(struct esp_spi_context *context)
 	return 0;
 }
 
+/* SPI thread polls GPIOs, their interrupts are ignored meanwhile.
+ * Interrupts stay enabled, as lines may be shared */
+static void spi_poll_enter(void)
+{
+	WRITE_ONCE(spi_context.polling, 1);
+	spi_context.poll_last_activity = ktime_get();
+	esp_verbose("SPI: polling\n");
+}
+
+static void spi_poll_exit(void)
+{
+	WRITE_ONCE(spi_context.polling, 0);
+	spi_context.poll_window_xfers = 0;
+
+	/* Edge may have been ignored while polling, check GPIOs once more */
+	up(&spi_sem);
+	esp_verbose("SPI: interrupt mode\n");
+}
+
+/* In interrupt mode, count transactions for switching to polling */
+static void spi_poll_account_xfer(void)
+{
+	ktime_t now = ktime_get();
+
+	if (!spi_context.poll_idle_us)
+		return;
+
+	if (ktime_us_delta(now, spi_context.poll_window_start) > SPI_POLL_WINDOW_US) {
+		spi_context.poll_window_start = now;
+		spi_context.poll_window_xfers = 0;
+	}
+
+	if (++spi_context.poll_window_xfers >= SPI_POLL_ENTRY_XFERS)
+		spi_poll_enter();
+}
+
+/* Transactions back to back, till bus is idle for poll_idle_us */
+static void spi_poll(void)
+{
+	struct esp_spi_context *context = &spi_context;
+
+	/* Wakeups for TX and completions are seen through GPIOs and queues */
+	while (!down_trylock(&spi_sem))
+		;
+
+	if (context->adapter->state != ESP_CONTEXT_READY) {
+		spi_poll_exit();
+		return;
+	}
+
+	if (esp_spi_transaction()) {
+		context->poll_last_activity = ktime_get();
+	} else if (ktime_us_delta(ktime_get(), context->poll_last_activity) >
+			READ_ONCE(context->poll_idle_us)) {
+		spi_poll_exit();
+		return;
+	}
+
+	/* Not to spin while transaction is on the bus */
+	if (spi_xfer_in_flight())
+		usleep_range(SPI_POLL_XFER_SLEEP_US, SPI_POLL_XFER_SLEEP_US * 2);
+	else if (need_resched())
+		cond_resched();
+	else
+		cpu_relax();
+}
+
 static int esp_spi_thread(void *data)
 {
 	struct esp_spi_context *context = &spi_context;
@@ -587,6 +1118,11 @@ static int esp_spi_thread(void *data)
 
 	while (!kthread_should_stop()) {
 
+		if (context->polling) {
+			spi_poll();
+			continue;
+		}
+
 		if (down_interruptible(&spi_sem)) {
 			esp_verbose("Failed to acquire spi_sem\n");
 			msleep(10);
@@ -598,8 +1134,13 @@ static int esp_spi_thread(void *data)
 			continue;
 		}
 
-		esp_spi_transaction();
+		if (esp_spi_transaction())
+			spi_poll_account_xfer();
 	}
+
+	if (context->polling)
+		spi_poll_exit();
+
 	esp_info("esp spi thread cleared\n");
 	do_exit(0);
 	return 0;
@@ -609,9 +1150,35 @@ static int spi_init(void)
 {
 	int status = 0;
 	uint8_t prio_q_idx = 0;
+	struct sk_buff *skb = NULL;
+	u8 i = 0;
 
 	sema_init(&spi_sem, 0);
 
+	spi_context.var_len_hdr = kzalloc(2 * sizeof(struct esp_spi_var_len_hdr), GFP_KERNEL);
+	if (!spi_context.var_len_hdr) {
+		esp_err("Failed to allocate SPI header buffer\n");
+		return -ENOMEM;
+	}
+
+	spi_context.tx_dummy_buf = kzalloc(SPI_BUF_SIZE, GFP_KERNEL);
+	if (!spi_context.tx_dummy_buf) {
+		esp_err("Failed to allocate SPI dummy TX buffer\n");
+		kfree(spi_context.var_len_hdr);
+		spi_context.var_len_hdr = NULL;
+		return -ENOMEM;
+	}
+
+	skb_queue_head_init(&spi_context.rx_skb_pool);
+	for (i = 0; i < SPI_XFER_SLOTS; i++)
+		init_completion(&spi_context.xfer_slots[i].done);
+
+	for (i = 0; i < SPI_RX_POOL_SIZE; i++) {
+		skb = esp_alloc_skb(SPI_BUF_SIZE);
+		if (skb)
+			skb_queue_tail(&spi_context.rx_skb_pool, skb);
+	}
+
 	spi_thread = kthread_run(esp_spi_thread, spi_context.adapter, "esp32_spi");
 	if (!spi_thread) {
 		esp_err("Failed to create esp32_spi thread\n");
@@ -665,19 +1232,34 @@ static void spi_exit(void)
 	close_data_path();
 	msleep(200);
 
-	for (prio_q_idx=0; prio_q_idx<MAX_PRIORITY_QUEUES; prio_q_idx++) {
-		skb_queue_purge(&spi_context.tx_q[prio_q_idx]);
-		skb_queue_purge(&spi_context.rx_q[prio_q_idx]);
-	}
-
 	up(&spi_sem);
 	if (spi_thread) {
 		kthread_stop(spi_thread);
 		spi_thread = NULL;
 	}
 
+	/* Completed transactions may requeue skbs to tx_q and rx_q */
+	spi_flush_xfer_slots();
+
+	for (prio_q_idx=0; prio_q_idx<MAX_PRIORITY_QUEUES; prio_q_idx++) {
+		skb_queue_purge(&spi_context.tx_q[prio_q_idx]);
+		skb_queue_purge(&spi_context.rx_q[prio_q_idx]);
+	}
+
 	esp_remove_card(spi_context.adapter);
 
+	if (spi_context.var_len_tx_skb) {
+		dev_kfree_skb(spi_context.var_len_tx_skb);
+		spi_context.var_len_tx_skb = NULL;
+	}
+
+	kfree(spi_context.var_len_hdr);
+	spi_context.var_len_hdr = NULL;
+
+	skb_queue_purge(&spi_context.rx_skb_pool);
+	kfree(spi_context.tx_dummy_buf);
+	spi_context.tx_dummy_buf = NULL;
+
 	if (test_bit(ESP_SPI_GPIO_HS_IRQ_DONE, &spi_context.spi_flags)) {
 		free_irq(gpio_to_irq(spi_context.handshake_gpio), spi_context.esp_spi_dev);
 		clear_bit(ESP_SPI_GPIO_HS_IRQ_DONE, &spi_context.spi_flags);
@@ -738,6 +1320,12 @@ int esp_init_interface_layer(struct esp_adapter *adapter)
 	adapter->if_ops = &if_ops;
 	adapter->if_type = ESP_IF_TYPE_SPI;
 	spi_context.adapter = adapter;
+
+	adapter->tx_q_limit = TX_MAX_PENDING_COUNT;
+	adapter->tx_q_limit_max = TX_MAX_PENDING_LIMIT;
+	adapter->rx_q_limit = SPI_RX_POOL_SIZE;
+	adapter->rx_q_limit_max = SPI_RX_POOL_SIZE_MAX;
+
 	if (adapter->mod_param.clockspeed != MOD_PARAM_UNINITIALISED)
 		spi_context.spi_clk_mhz = adapter->mod_param.clockspeed;
 	else
@@ -746,6 +1334,12 @@ int esp_init_interface_layer(struct esp_adapter *adapter)
 	spi_context.handshake_gpio = adapter->mod_param.spi_handshake;
 	spi_context.dataready_gpio = adapter->mod_param.spi_dataready;
 
+	/* Polling is opt-in */
+	if (adapter->mod_param.spi_poll_us > 0)
+		spi_context.poll_idle_us = adapter->mod_param.spi_poll_us;
+	else
+		spi_context.poll_idle_us = 0;
+
 	if(!gpio_is_valid(spi_context.handshake_gpio)) {
 		esp_err("Couldn't configure Handshake GPIO[%u]\n", spi_context.handshake_gpio);
 		return -EINVAL;
@@ -21,6 +21,22 @@
 #include "esp.h"
 
 #define SPI_BUF_SIZE            1600
+/* Preallocated RX buffers, recycled when not passed up */
+#define SPI_RX_POOL_SIZE        8
+#define SPI_RX_POOL_SIZE_MAX    64
+/* Frames up to this size are copied to right sized skb */
+#define SPI_RX_COPYBREAK        256
+/* Data transactions submitted with spi_async(). RX of completed one is
+ * processed while next one is on the bus */
+#define SPI_XFER_SLOTS          2
+/* If enabled with spi_poll_us, SPI thread polls Handshake and Data ready
+ * GPIOs under load, and their interrupts are ignored. Polling starts at
+ * SPI_POLL_ENTRY_XFERS transactions within SPI_POLL_WINDOW_US, and stops
+ * after idle time of spi_poll_us. Thread sleeps for SPI_POLL_XFER_SLEEP_US
+ * while a transaction is on the bus */
+#define SPI_POLL_ENTRY_XFERS    4
+#define SPI_POLL_WINDOW_US      1000
+#define SPI_POLL_XFER_SLEEP_US  20
 
 enum spi_flags_e {
 	ESP_SPI_BUS_CLAIMED,
@@ -32,11 +48,26 @@ enum spi_flags_e {
 	ESP_SPI_DATAPATH_OPEN,
 };
 
+struct esp_spi_xfer_slot {
+	struct spi_message          msg;
+	struct spi_transfer         trans;
+	struct completion           done;
+	struct sk_buff              *tx_skb;
+	struct sk_buff              *rx_skb;
+	ktime_t                     start_time;
+	u8                          busy;
+};
+
 struct esp_spi_context {
 	struct esp_adapter          *adapter;
 	struct spi_device           *esp_spi_dev;
 	struct sk_buff_head         tx_q[MAX_PRIORITY_QUEUES];
 	struct sk_buff_head         rx_q[MAX_PRIORITY_QUEUES];
+	struct sk_buff_head         rx_skb_pool;
+	/* Zeroed TX buffer for transactions with nothing to send */
+	u8                          *tx_dummy_buf;
+	struct esp_spi_xfer_slot    xfer_slots[SPI_XFER_SLOTS];
+	u8                          xfer_slot_next;
 	struct workqueue_struct     *spi_workqueue;
 	struct work_struct          spi_work;
 	enum context_state          state;
@@ -44,6 +75,25 @@ struct esp_spi_context {
 	unsigned long               spi_flags;
 	int                         handshake_gpio;
 	int                         dataready_gpio;
+	/* Variable length transactions */
+	u8                          var_len;
+	u8                          *var_len_hdr;
+	u32                         var_len_xfer_len;
+	struct sk_buff              *var_len_tx_skb;
+	/* Credit based flow control, per ESP rx queue (pool) */
+	u8                          credit_pools;
+	u8                          credit_pool_size[MAX_PRIORITY_QUEUES];
+	u8                          credit_cnt[MAX_PRIORITY_QUEUES];
+	u32                         credits_granted[MAX_PRIORITY_QUEUES];
+	u32                         credits_used[MAX_PRIORITY_QUEUES];
+	/* Data ready interrupt, not yet followed by transaction */
+	ktime_t                     irq_time;
+	/* Adaptive interrupt/poll mode */
+	u32                         poll_idle_us;
+	u8                          polling;
+	u32                         poll_window_xfers;
+	ktime_t                     poll_window_start;
+	ktime_t                     poll_last_activity;
 };
 
 enum {
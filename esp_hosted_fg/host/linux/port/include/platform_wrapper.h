@@ -109,6 +109,10 @@ void hosted_thread_create_hook(void);
 */
 int hosted_thread_cancel(void *thread_handle);
 
+/* hosted_thread_yield gives up CPU to other ready threads
+ */
+void hosted_thread_yield(void);
+
 /* hosted_create_semaphore creates semaphore
  * Input parameter
  *        init_value : Initial value of semaphore
@@ -163,6 +167,12 @@ int hosted_destroy_semaphore(void * semaphore_handle);
 void *hosted_timer_start(int duration, int type,
 		void (*timeout_handler)(void const *), void * arg);
 
+/* hosted_timer_start_ms is same as hosted_timer_start,
+ * with duration in milli seconds
+ */
+void *hosted_timer_start_ms(int duration_ms, int type,
+		void (*timeout_handler)(void const *), void * arg);
+
 /* hosted_timer_stop is to stop timer
  * Input parameters
  *      timer_handle : timer handle created from hosted_timer_start()
@@ -211,11 +221,24 @@ int serial_drv_write (struct serial_drv_handle_t* serial_drv_handle,
  * Returns
  *      buf                         :   Protocol encoded data Buffer
  *                                      caller will decode the protobuf
+ *                                      Buffer is owned by driver, valid
+ *                                      till serial_drv_read_done
  */
 
 uint8_t * serial_drv_read(struct serial_drv_handle_t *serial_drv_handle,
 		uint32_t *out_nbyte);
 
+/*
+ * serial_drv_read_done function releases buffer returned by
+ * serial_drv_read, once caller is done with it
+ *
+ * Input parameter
+ *      serial_drv_handle           :   Driver Handle
+ *      buf                         :   Buffer from serial_drv_read
+ */
+void serial_drv_read_done(struct serial_drv_handle_t *serial_drv_handle,
+		uint8_t *buf);
+
 /*
  * serial_drv_close function closes driver interface.
  *
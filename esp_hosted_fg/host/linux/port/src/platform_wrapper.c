@@ -16,32 +16,37 @@
 #include "ctrl_api.h"
 #include "esp_hosted_config.pb-c.h"
 #include <pthread.h>
+#include <sched.h>
 #include "string.h"
 #include <time.h>
 #include <signal.h>
+#include <sys/timerfd.h>
 
 #define SUCCESS                 0
 #define FAILURE                 -1
 #define DUMMY_READ_BUF_LEN      64
 #define EAGAIN                  11
 
-#define HOSTED_CALLOC(buff,nbytes) do {                           \
-    buff = (uint8_t *)hosted_calloc(1, nbytes);                   \
-    if (!buff) {                                                  \
-        printf("%s, Failed to allocate memory \n", __func__);     \
-        goto free_bufs;                                           \
-    }                                                             \
-} while(0);
-
 #define thread_handle_t pthread_t
 #define semaphore_handle_t sem_t
 
+/* Fits largest TLV frame, with 16 bit data length */
+#define SERIAL_DRV_RX_BUF_SIZE  (64 * 1024 + 256)
+
+/* Received serial data is kept in rx_buf from rx_head to rx_tail.
+ * rx_frame_len of it is frame handed out by serial_drv_read */
 struct serial_drv_handle_t {
 	int file_desc;
+	uint8_t *rx_buf;
+	uint32_t rx_head;
+	uint32_t rx_tail;
+	uint32_t rx_frame_len;
 };
 
 extern int errno;
 
+static void timer_wheel_deinit(void);
+
 #if defined __ANDROID__
 /* Android does not implement pthread_cancel()
  *
@@ -156,6 +161,11 @@ int control_path_platform_init(struct serial_drv_handle_t* serial_drv_handle)
 
 	mem_free(buf);
 
+	/* drop stale data already buffered */
+	serial_drv_handle->rx_head = 0;
+	serial_drv_handle->rx_tail = 0;
+	serial_drv_handle->rx_frame_len = 0;
+
 	/* set to blocking: expected behaviour of read() in the rx thread */
 	if (SUCCESS != set_read_access_nonblocking(serial_drv_handle, false)) {
 		printf("%s:%u: failed to set_read_access back to blocking\n", __func__, __LINE__);
@@ -176,7 +186,7 @@ close1:
 
 int control_path_platform_deinit(void)
 {
-	/* Empty as if now */
+	timer_wheel_deinit();
 	return SUCCESS;
 }
 
@@ -285,6 +295,11 @@ int hosted_thread_cancel(void *thread_handle)
 	return SUCCESS;
 }
 
+void hosted_thread_yield(void)
+{
+	sched_yield();
+}
+
 /* -------- Semaphores ---------- */
 void * hosted_create_semaphore(int init_value)
 {
@@ -386,49 +401,281 @@ int hosted_destroy_semaphore(void * semaphore_handle)
 
 /* -------- Timers  ---------- */
 
+/* All timers are served by single thread, woken up by timerfd.
+ * Timers are kept in hashed timer wheel of TIMER_WHEEL_SLOTS slots,
+ * each of one msec tick, so that start and stop are O(1) for any
+ * number of timers. Timer due after a full revolution waits in its
+ * slot till its round comes. Clock is CLOCK_MONOTONIC, not affected
+ * by wall clock changes */
+#define TIMER_WHEEL_SLOTS       1024
+#define TIMER_WHEEL_SLOT(tick)  ((tick) & (TIMER_WHEEL_SLOTS - 1))
+
 typedef void (*hosted_timer_cb_t) (void const* resp);
 
 struct timer_handle_t {
-	timer_t timer_id;
+	struct timer_handle_t *next;
+	struct timer_handle_t *prev;
+	uint64_t expiry_ms;
+	uint32_t period_ms;
+	uint8_t armed;
 	hosted_timer_cb_t timer_cb;
 	void * arg;
 };
 
+struct timer_wheel_t {
+	pthread_mutex_t lock;
+	pthread_t thread;
+	int timer_fd;
+	uint8_t running;
+	uint8_t stop;
+	/* Ticks up to this are processed */
+	uint64_t now_ms;
+	/* timerfd expiry, 0 if disarmed */
+	uint64_t next_ms;
+	struct timer_handle_t *slots[TIMER_WHEEL_SLOTS];
+};
+
+static struct timer_wheel_t timer_wheel = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+	.timer_fd = -1,
+};
+
+static uint64_t timer_wheel_clock_ms(void)
+{
+	struct timespec ts = {0};
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((uint64_t)ts.tv_sec * 1000) + (ts.tv_nsec / 1000000);
+}
+
+/* Program timerfd for expiry_ms (absolute), 0 to disarm. Lock is held */
+static void timer_wheel_set_fd(uint64_t expiry_ms)
+{
+	struct itimerspec its = {0};
+
+	if (expiry_ms) {
+		its.it_value.tv_sec = expiry_ms / 1000;
+		its.it_value.tv_nsec = (expiry_ms % 1000) * 1000000;
+	}
+
+	if (timerfd_settime(timer_wheel.timer_fd, TFD_TIMER_ABSTIME, &its, NULL))
+		fprintf(stderr, "Error timerfd_settime: %s\n", strerror(errno));
+
+	timer_wheel.next_ms = expiry_ms;
+}
+
+static void timer_wheel_link(struct timer_handle_t *timer)
+{
+	struct timer_handle_t **head = NULL;
+
+	/* Slots up to now_ms are already processed */
+	if (timer->expiry_ms <= timer_wheel.now_ms)
+		timer->expiry_ms = timer_wheel.now_ms + 1;
+
+	head = &timer_wheel.slots[TIMER_WHEEL_SLOT(timer->expiry_ms)];
+
+	timer->prev = NULL;
+	timer->next = *head;
+	if (*head)
+		(*head)->prev = timer;
+	*head = timer;
+	timer->armed = 1;
+
+	/* Wake up service thread earlier, if needed */
+	if (!timer_wheel.next_ms || (timer->expiry_ms < timer_wheel.next_ms))
+		timer_wheel_set_fd(timer->expiry_ms);
+}
+
+static void timer_wheel_unlink(struct timer_handle_t *timer)
+{
+	if (!timer->armed)
+		return;
+
+	if (timer->prev)
+		timer->prev->next = timer->next;
+	else
+		timer_wheel.slots[TIMER_WHEEL_SLOT(timer->expiry_ms)] = timer->next;
+
+	if (timer->next)
+		timer->next->prev = timer->prev;
+
+	timer->next = timer->prev = NULL;
+	timer->armed = 0;
+}
+
+/* Take out one expired timer, if any. Lock is held */
+static struct timer_handle_t * timer_wheel_pop_expired(uint64_t now_ms)
+{
+	struct timer_handle_t *timer = NULL;
+	uint64_t tick = 0, last = now_ms;
+
+	/* Each slot is visited once at most, even after long sleep */
+	if (now_ms - timer_wheel.now_ms > TIMER_WHEEL_SLOTS)
+		timer_wheel.now_ms = now_ms - TIMER_WHEEL_SLOTS;
+
+	for (tick = timer_wheel.now_ms + 1; tick <= last; tick++) {
+		for (timer = timer_wheel.slots[TIMER_WHEEL_SLOT(tick)];
+		     timer; timer = timer->next) {
+			if (timer->expiry_ms <= now_ms) {
+				timer_wheel_unlink(timer);
+				return timer;
+			}
+		}
+		timer_wheel.now_ms = tick;
+	}
+
+	return NULL;
+}
+
+/* Earliest expiry within one revolution, or end of revolution to look
+ * again at timers of later rounds. 0 if there are no timers */
+static uint64_t timer_wheel_next_expiry(void)
+{
+	struct timer_handle_t *timer = NULL;
+	uint64_t tick = 0, last = timer_wheel.now_ms + TIMER_WHEEL_SLOTS;
+	uint8_t found = 0;
+
+	for (tick = timer_wheel.now_ms + 1; tick <= last; tick++) {
+		for (timer = timer_wheel.slots[TIMER_WHEEL_SLOT(tick)];
+		     timer; timer = timer->next) {
+			found = 1;
+			if (timer->expiry_ms <= tick)
+				return tick;
+		}
+	}
+
+	return found ? last : 0;
+}
+
+static void *timer_wheel_thread(void *arg)
+{
+	struct timer_handle_t *timer = NULL;
+	hosted_timer_cb_t timer_cb = NULL;
+	void *timer_arg = NULL;
+	uint64_t expirations = 0;
+
+	while (1) {
+		if (read(timer_wheel.timer_fd, &expirations, sizeof(expirations)) < 0) {
+			if (errno == EINTR)
+				continue;
+			fprintf(stderr, "Error timerfd read: %s\n", strerror(errno));
+		}
+
+		pthread_mutex_lock(&timer_wheel.lock);
+
+		while (!timer_wheel.stop) {
+			timer = timer_wheel_pop_expired(timer_wheel_clock_ms());
+			if (!timer)
+				break;
+
+			timer_cb = timer->timer_cb;
+			timer_arg = timer->arg;
+
+			if (timer->period_ms) {
+				timer->expiry_ms += timer->period_ms;
+				timer_wheel_link(timer);
+			}
+
+			/* Callback may stop its own or other timers */
+			pthread_mutex_unlock(&timer_wheel.lock);
+			timer_cb(timer_arg);
+			pthread_mutex_lock(&timer_wheel.lock);
+		}
+
+		if (timer_wheel.stop) {
+			pthread_mutex_unlock(&timer_wheel.lock);
+			break;
+		}
+
+		timer_wheel_set_fd(timer_wheel_next_expiry());
+		pthread_mutex_unlock(&timer_wheel.lock);
+	}
+
+	return NULL;
+}
+
+/* Start service thread on first use. Lock is held */
+static int timer_wheel_init(void)
+{
+	if (timer_wheel.running)
+		return SUCCESS;
+
+	timer_wheel.timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+	if (timer_wheel.timer_fd < 0) {
+		fprintf(stderr, "Error timerfd_create: %s\n", strerror(errno));
+		return FAILURE;
+	}
+
+	timer_wheel.stop = 0;
+	timer_wheel.next_ms = 0;
+	timer_wheel.now_ms = timer_wheel_clock_ms();
+
+	if (pthread_create(&timer_wheel.thread, NULL, timer_wheel_thread, NULL)) {
+		printf("Failed to create timer thread\n");
+		close(timer_wheel.timer_fd);
+		timer_wheel.timer_fd = -1;
+		return FAILURE;
+	}
+
+	timer_wheel.running = 1;
+	return SUCCESS;
+}
+
+/* Stop service thread. Timers not yet stopped do not expire */
+static void timer_wheel_deinit(void)
+{
+	int slot = 0;
+
+	pthread_mutex_lock(&timer_wheel.lock);
+	if (!timer_wheel.running) {
+		pthread_mutex_unlock(&timer_wheel.lock);
+		return;
+	}
+
+	timer_wheel.stop = 1;
+	/* Expire right away, to wake up thread */
+	timer_wheel_set_fd(1);
+	pthread_mutex_unlock(&timer_wheel.lock);
+
+	pthread_join(timer_wheel.thread, NULL);
+
+	pthread_mutex_lock(&timer_wheel.lock);
+	close(timer_wheel.timer_fd);
+	timer_wheel.timer_fd = -1;
+	timer_wheel.running = 0;
+
+	/* Handles are still owned by callers, to be freed by hosted_timer_stop */
+	for (slot = 0; slot < TIMER_WHEEL_SLOTS; slot++) {
+		while (timer_wheel.slots[slot])
+			timer_wheel_unlink(timer_wheel.slots[slot]);
+	}
+	pthread_mutex_unlock(&timer_wheel.lock);
+}
+
 int hosted_timer_stop(void *timer_handle)
 {
 	if (timer_handle) {
-		int ret = timer_delete(((struct timer_handle_t *)timer_handle)->timer_id);
-		if (ret < 0)
-			printf("Failed to stop timer\n");
+		pthread_mutex_lock(&timer_wheel.lock);
+		timer_wheel_unlink((struct timer_handle_t *)timer_handle);
+		pthread_mutex_unlock(&timer_wheel.lock);
 
 		mem_free(timer_handle);
-		return ret;
+		return SUCCESS;
 	}
 	return FAILURE;
 }
 
 /* Sample timer_handler looks like this:
  *
- * void expired(union sigval timer_data){
- *     struct mystruct *a = timer_data.sival_ptr;
+ * void expired(void const *arg){
+ *     struct mystruct *a = (struct mystruct *)arg;
  * 	printf("Expired %u\n", a->mydata++);
  * }
  **/
 
-static void timer_ll_callback(union sigval timer_data)
-{
-	struct timer_handle_t *timer_handle = timer_data.sival_ptr;
-
-	if (timer_handle->timer_cb)
-		timer_handle->timer_cb(timer_handle->arg);
-	else
-		printf("NULL func, failed to call callback\n");
-}
-
-void *hosted_timer_start(int duration, int type,
+void *hosted_timer_start_ms(int duration_ms, int type,
 		void (*timeout_handler)(void const *), void * arg)
 {
-	int res = 0;
 	struct timer_handle_t *timer_handle = NULL;
 
 	if (!timeout_handler) {
@@ -436,62 +683,51 @@ void *hosted_timer_start(int duration, int type,
 		return NULL;
 	}
 
-	timer_handle = (struct timer_handle_t *)hosted_malloc(
+	if ((type != CTRL__TIMER_ONESHOT) && (type != CTRL__TIMER_PERIODIC)) {
+		printf("Unsupported timer type. supported: one_shot, periodic\n");
+		return NULL;
+	}
+
+	/* Expires on next tick at the earliest */
+	if (duration_ms <= 0)
+		duration_ms = 1;
+
+	timer_handle = (struct timer_handle_t *)hosted_calloc(1,
 			sizeof(struct timer_handle_t));
 	if (!timer_handle) {
 		printf("Mem Alloc for Timer failed\n");
-		mem_free(timer_handle);
 		return NULL;
 	}
 
-	/*  sigevent specifies behaviour on expiration  */
-	struct sigevent sev = { 0 };
-
-	/* specify start delay and interval
-	 * it_value and it_interval must not be zero */
-
-
-	struct itimerspec its = {   .it_value.tv_sec  = duration,
-		.it_value.tv_nsec = 0,
-		.it_interval.tv_sec  = 0,
-		.it_interval.tv_nsec = 0
-	};
-
 	timer_handle->timer_cb = timeout_handler;
 	timer_handle->arg = arg;
 
-	if (type == CTRL__TIMER_PERIODIC) {
-		assert(0); // periodic timers not supported for now
-		its.it_interval.tv_sec = duration;
-	}
-
-	sev.sigev_notify = SIGEV_THREAD;
-	sev.sigev_notify_function = timer_ll_callback;
-	sev.sigev_signo = SIGRTMAX-1;
-	sev.sigev_value.sival_ptr = timer_handle;
+	if (type == CTRL__TIMER_PERIODIC)
+		timer_handle->period_ms = duration_ms;
 
+	pthread_mutex_lock(&timer_wheel.lock);
 
-	/* create timer */
-	res = timer_create(CLOCK_REALTIME, &sev, &(timer_handle->timer_id));
-
-	if (res != 0){
-		fprintf(stderr, "Error timer_create: %s\n", strerror(errno));
+	if (timer_wheel_init()) {
+		pthread_mutex_unlock(&timer_wheel.lock);
 		mem_free(timer_handle);
 		return NULL;
 	}
 
-	/* start timer */
-	res = timer_settime(timer_handle->timer_id, 0, &its, NULL);
+	timer_handle->expiry_ms = timer_wheel_clock_ms() + duration_ms;
+	timer_wheel_link(timer_handle);
 
-	if (res != 0){
-		fprintf(stderr, "Error timer_settime: %s\n", strerror(errno));
-		mem_free(timer_handle);
-		return NULL;
-	}
+	pthread_mutex_unlock(&timer_wheel.lock);
 
 	return timer_handle;
 }
 
+void *hosted_timer_start(int duration, int type,
+		void (*timeout_handler)(void const *), void * arg)
+{
+	return hosted_timer_start_ms(duration * 1000, type,
+			timeout_handler, arg);
+}
+
 
 /* -------- Serial Drv ---------- */
 struct serial_drv_handle_t* serial_drv_open(const char *transport)
@@ -507,6 +743,13 @@ struct serial_drv_handle_t* serial_drv_open(const char *transport)
 		return NULL;
 	}
 
+	serial_drv_handle->rx_buf = (uint8_t *)hosted_malloc(SERIAL_DRV_RX_BUF_SIZE);
+	if (!serial_drv_handle->rx_buf) {
+		printf("%s, Failed to allocate memory \n",__func__);
+		mem_free(serial_drv_handle);
+		return NULL;
+	}
+
 	serial_drv_handle->file_desc = open(transport, O_RDWR);
 	if (serial_drv_handle->file_desc == -1) {
 		int errsv = errno;
@@ -523,6 +766,7 @@ struct serial_drv_handle_t* serial_drv_open(const char *transport)
 				break;
 			}
 		}
+		mem_free(serial_drv_handle->rx_buf);
 		mem_free(serial_drv_handle);
 		return NULL;
 	}
@@ -562,39 +806,18 @@ int serial_drv_close(struct serial_drv_handle_t **serial_drv_handle)
 	}
 	if(close((*serial_drv_handle)->file_desc) < 0) {
 		perror("close:");
+		mem_free((*serial_drv_handle)->rx_buf);
 		mem_free(*serial_drv_handle);
 		return FAILURE;
 	}
 	if (*serial_drv_handle) {
+		mem_free((*serial_drv_handle)->rx_buf);
 		mem_free(*serial_drv_handle);
 	}
 	return SUCCESS;
 }
 
-/* This whole processing of two step parsing TLV is common for MPU and MCU
- * and ideally this processing should have been done in serial_if.c.
- * But the problem is there is difference in reading in MPU and MCU.
- * For MPU, it is straight forward, read on character driver file and
- * partial reads are supported.
- * But For MCU, the problem is it doesn't have that capability and gets complete
- * serial buffer on transport.
- * To keep it simple, two step parsing TLV buffer is kept in platform specific code
- */
-uint8_t * serial_drv_read(struct serial_drv_handle_t *serial_drv_handle,
-		uint32_t *out_nbyte)
-{
-	int ret = 0, count = 0, total_read_len = 0;
-	const char* ep_name = CTRL_EP_NAME_RESP;
-	uint16_t init_read_len = SIZE_OF_TYPE + SIZE_OF_LENGTH + strlen(ep_name) +
-		SIZE_OF_TYPE + SIZE_OF_LENGTH;
-	uint8_t init_read_buf[init_read_len];
-	uint8_t *buf = NULL;
-	uint32_t buf_len = 0;
-	/* Any of `CTRL_EP_NAME_EVENT` and `CTRL_EP_NAME_RESP` could be used,
-	 * as both have same strlen in adapter.h */
-
-/*
- * Read fixed length of received data in below format:
+/* Received data is in below format, back to back for multiple frames:
  * ----------------------------------------------------------------------------
  *  Endpoint Type | Endpoint Length | Endpoint Value  | Data Type | Data Length
  * ----------------------------------------------------------------------------
@@ -603,70 +826,114 @@ uint8_t * serial_drv_read(struct serial_drv_handle_t *serial_drv_handle,
  *  ---------------------------------------------------------------------------
  *      1         |       2         | Endpoint Length |     1     |     2     |
  *  ---------------------------------------------------------------------------
+ *
+ * Any of `CTRL_EP_NAME_EVENT` and `CTRL_EP_NAME_RESP` could be Endpoint Value,
+ * as both have same strlen in adapter.h
+ */
+#define SERIAL_DRV_EP_NAME_LEN  (sizeof(CTRL_EP_NAME_RESP) - 1)
+#define SERIAL_DRV_TLV_HDR_LEN  (SIZE_OF_TYPE + SIZE_OF_LENGTH + \
+                                 SERIAL_DRV_EP_NAME_LEN +         \
+                                 SIZE_OF_TYPE + SIZE_OF_LENGTH)
+
+/* Validate TLV header at data. Returns data length, or FAILURE */
+static int serial_drv_parse_tlv_hdr(const uint8_t *data)
+{
+	const uint8_t *ep_name = data + SIZE_OF_TYPE + SIZE_OF_LENGTH;
+	const uint8_t *data_tlv = ep_name + SERIAL_DRV_EP_NAME_LEN;
+	uint16_t ep_len = data[1] | (data[2] << 8);
+
+	if ((data[0] != PROTO_PSER_TLV_T_EPNAME) ||
+	    (ep_len != SERIAL_DRV_EP_NAME_LEN) ||
+	    (memcmp(ep_name, CTRL_EP_NAME_RESP, SERIAL_DRV_EP_NAME_LEN) &&
+	     memcmp(ep_name, CTRL_EP_NAME_EVENT, SERIAL_DRV_EP_NAME_LEN)) ||
+	    (data_tlv[0] != PROTO_PSER_TLV_T_DATA)) {
+		printf("%s: Unexpected TLV header, type[%u] ep_len[%u]\n",
+				__func__, data[0], ep_len);
+		return FAILURE;
+	}
+
+	return data_tlv[1] | (data_tlv[2] << 8);
+}
+
+/* Frames are read in bulk into rx_buf, as much as available per read(),
+ * and then handed out one by one, without copy.
+ * Returned buffer points in rx_buf, so it is valid till
+ * serial_drv_read_done(), or till next serial_drv_read() call
  */
+uint8_t * serial_drv_read(struct serial_drv_handle_t *serial_drv_handle,
+		uint32_t *out_nbyte)
+{
+	uint32_t avail = 0;
+	int count = 0, data_len = 0;
+	uint8_t *frame = NULL;
 
 	if (!serial_drv_handle ||
 	    serial_drv_handle->file_desc < 0 ||
+	    !serial_drv_handle->rx_buf ||
 	    !out_nbyte) {
 		printf("%s:%u Invalid parameter\n",__func__,__LINE__);
 		return NULL;
 	}
 
-	memset(init_read_buf, 0, sizeof(init_read_buf));
-
-	total_read_len = 0;
-	do {
-		count = read(serial_drv_handle->file_desc,
-				(init_read_buf+total_read_len), (init_read_len-total_read_len));
-		if (count <= 0) {
-			perror("read fail:");
-			printf("Exp read of %u bytes: ret[%d]\n",
-					(init_read_len-total_read_len), count);
-			goto free_bufs;
-		}
-		total_read_len += count;
-	} while (total_read_len < init_read_len);
+	*out_nbyte = 0;
 
-	if (total_read_len != init_read_len) {
-		printf("%s, read_bytes exp[%d] vs recvd[%d]\n"
-				,__func__, init_read_len, total_read_len);
-		goto free_bufs;
-	}
+	/* Frame handed out earlier, if not yet released */
+	serial_drv_read_done(serial_drv_handle, NULL);
+
+	while (1) {
+		frame = serial_drv_handle->rx_buf + serial_drv_handle->rx_head;
+		avail = serial_drv_handle->rx_tail - serial_drv_handle->rx_head;
+
+		data_len = 0;
+		if (avail >= SERIAL_DRV_TLV_HDR_LEN) {
+			data_len = serial_drv_parse_tlv_hdr(frame);
+			if (data_len <= 0) {
+				/* Stream out of sync, drop what is buffered */
+				serial_drv_handle->rx_head = 0;
+				serial_drv_handle->rx_tail = 0;
+				return NULL;
+			}
 
-	ret = parse_tlv(init_read_buf, &buf_len);
-	if ((ret != SUCCESS) || !buf_len) {
-		goto free_bufs;
-	}
+			/* Complete frame available */
+			if (avail >= SERIAL_DRV_TLV_HDR_LEN + data_len) {
+				serial_drv_handle->rx_frame_len =
+					SERIAL_DRV_TLV_HDR_LEN + data_len;
+				*out_nbyte = data_len;
+				return frame + SERIAL_DRV_TLV_HDR_LEN;
+			}
+		}
 
-	/*
-	 * Read variable length of received data.
-	 * Variable length is obtained after
-	 * parsing of previously read data.
-	 */
-	HOSTED_CALLOC(buf,buf_len);
+		/* Move partial frame to start, to read rest of it after */
+		if (serial_drv_handle->rx_head) {
+			memmove(serial_drv_handle->rx_buf, frame, avail);
+			serial_drv_handle->rx_head = 0;
+			serial_drv_handle->rx_tail = avail;
+		}
 
-	total_read_len = 0;
-	do {
 		count = read(serial_drv_handle->file_desc,
-				(buf+total_read_len), (buf_len-total_read_len));
+				serial_drv_handle->rx_buf + serial_drv_handle->rx_tail,
+				SERIAL_DRV_RX_BUF_SIZE - serial_drv_handle->rx_tail);
 		if (count <= 0) {
-			perror("Fail to read serial data");
-			break;
+			if ((count < 0) && (errno == EINTR))
+				continue;
+			perror("read fail:");
+			return NULL;
 		}
-		total_read_len += count;
-	} while (total_read_len < buf_len);
-
-	if (total_read_len != buf_len) {
-		printf("%s, Exp num_bytes[%d] != recvd[%d]\n",
-				__func__, buf_len, total_read_len);
-		goto free_bufs;
+		serial_drv_handle->rx_tail += count;
 	}
+}
 
-	*out_nbyte = buf_len;
-	return buf;
+void serial_drv_read_done(struct serial_drv_handle_t *serial_drv_handle,
+		uint8_t *buf)
+{
+	if (!serial_drv_handle || !serial_drv_handle->rx_frame_len)
+		return;
 
-free_bufs:
-	mem_free(buf);
-	*out_nbyte = 0;
-	return NULL;
+	serial_drv_handle->rx_head += serial_drv_handle->rx_frame_len;
+	serial_drv_handle->rx_frame_len = 0;
+
+	if (serial_drv_handle->rx_head == serial_drv_handle->rx_tail) {
+		serial_drv_handle->rx_head = 0;
+		serial_drv_handle->rx_tail = 0;
+	}
 }
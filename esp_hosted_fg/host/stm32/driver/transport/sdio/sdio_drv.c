@@ -538,7 +538,7 @@ static void tx_task(void const* pvParameters)
 			payload_header->offset = htole16(sizeof(struct esp_payload_header));
 			payload_header->if_type = buf_handle.if_type;
 			payload_header->if_num = buf_handle.if_num;
-			payload_header->reserved2 = 0;
+			payload_header->credits = 0;
 
 			/* Copy payload */
 			memcpy(payload, buf_handle.payload, buf_handle.payload_len);
@@ -115,6 +115,10 @@ void *hosted_thread_create(void (*start_routine)(void const *), void *arg);
 */
 int hosted_thread_cancel(void *thread_handle);
 
+/* hosted_thread_yield gives up CPU to other ready threads
+ */
+void hosted_thread_yield(void);
+
 /* hosted_create_semaphore creates semaphore
  * Input parameter
  *        init_value : Initial value of semaphore
@@ -169,6 +173,12 @@ int hosted_destroy_semaphore(void * semaphore_handle);
 void *hosted_timer_start(int duration, int type,
 		void (*timeout_handler)(void const *), void *arg);
 
+/* hosted_timer_start_ms is same as hosted_timer_start,
+ * with duration in milli seconds
+ */
+void *hosted_timer_start_ms(int duration_ms, int type,
+		void (*timeout_handler)(void const *), void *arg);
+
 /* hosted_timer_stop is to stop timer
  * Input parameters
  *      timer_handle : timer handle created from hosted_timer_start()
@@ -240,6 +250,17 @@ int serial_drv_write (struct serial_drv_handle_t* serial_drv_handle,
 uint8_t * serial_drv_read(struct serial_drv_handle_t *serial_drv_handle,
 		uint32_t *out_nbyte);
 
+/*
+ * serial_drv_read_done function releases buffer returned by
+ * serial_drv_read, once caller is done with it
+ *
+ * Input parameter
+ *      serial_drv_handle           :   Driver Handle
+ *      buf                         :   Buffer from serial_drv_read
+ */
+void serial_drv_read_done(struct serial_drv_handle_t *serial_drv_handle,
+		uint8_t *buf);
+
 /*
  * serial_drv_close function closes driver interface.
  *
@@ -187,6 +187,11 @@ int hosted_thread_cancel(void *thread_handle)
 	return STM_OK;
 }
 
+void hosted_thread_yield(void)
+{
+	osThreadYield();
+}
+
 /* -------- Semaphores ---------- */
 void * hosted_create_semaphore(int init_value)
 {
@@ -201,7 +206,10 @@ void * hosted_create_semaphore(int init_value)
 		return NULL;
 	}
 
-	*sem_id = osSemaphoreCreate(osSemaphore(sem_template_ctrl) , 1);
+	/* Counting semaphore for init_value > 1, e.g. control requests
+	 * pending at a time. Otherwise binary, which is created available */
+	*sem_id = osSemaphoreCreate(osSemaphore(sem_template_ctrl) ,
+			(init_value > 1) ? init_value : 1);
 
 	if (!*sem_id) {
 		printf("sem create failed\n");
@@ -309,7 +317,7 @@ int hosted_timer_stop(void *timer_handle)
  * }
  **/
 
-void *hosted_timer_start(int duration, int type,
+void *hosted_timer_start_ms(int duration_ms, int type,
 		void (*timeout_handler)(void const *), void *arg)
 {
 	struct timer_handle_t *timer_handle = NULL;
@@ -351,7 +359,7 @@ void *hosted_timer_start(int duration, int type,
 	}
 
 	/* start */
-	ret = osTimerStart (timer_handle->timer_id, SEC_TO_MILLISEC(duration));
+	ret = osTimerStart (timer_handle->timer_id, duration_ms);
 	if(ret) {
 		printf("Failed to start timer, destroying timer\n");
 
@@ -366,6 +374,13 @@ void *hosted_timer_start(int duration, int type,
 	return timer_handle;
 }
 
+void *hosted_timer_start(int duration, int type,
+		void (*timeout_handler)(void const *), void *arg)
+{
+	return hosted_timer_start_ms(SEC_TO_MILLISEC(duration), type,
+			timeout_handler, arg);
+}
+
 /* -------- Serial Drv ---------- */
 struct serial_drv_handle_t* serial_drv_open(const char *transport)
 {
@@ -531,6 +546,12 @@ free_bufs:
 	return NULL;
 }
 
+void serial_drv_read_done(struct serial_drv_handle_t *serial_drv_handle,
+		uint8_t *buf)
+{
+	mem_free(buf);
+}
+
 int serial_drv_close(struct serial_drv_handle_t** serial_drv_handle)
 {
 	if (!serial_drv_handle || !(*serial_drv_handle)) {
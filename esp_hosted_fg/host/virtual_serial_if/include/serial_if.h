@@ -14,6 +14,9 @@
 #define SIZE_OF_TYPE                1
 #define SIZE_OF_LENGTH              2
 
+#define PROTO_PSER_TLV_T_EPNAME     0x01
+#define PROTO_PSER_TLV_T_DATA       0x02
+
 /*
  * The data written on serial driver file, `SERIAL_IF_FILE` from adapter.h
  * In TLV i.e. Type Length Value format, to transfer data between host and ESP32
@@ -45,4 +48,8 @@ int transport_pserial_send(uint8_t* data, uint16_t data_length);
 /* Read and return number of bytes and buffer from serial interface
  **/
 uint8_t * transport_pserial_read(uint32_t *out_nbyte);
+
+/* Release buffer returned by transport_pserial_read
+ **/
+void transport_pserial_read_done(uint8_t *buf);
 #endif
@@ -11,9 +11,6 @@
 #define FAILURE                          -1
 
 
-#define PROTO_PSER_TLV_T_EPNAME           0x01
-#define PROTO_PSER_TLV_T_DATA             0x02
-
 #ifdef MCU_SYS
 #define command_log(format, ...)          printf(format "\r", ##__VA_ARGS__);
 #else
@@ -203,3 +200,8 @@ uint8_t * transport_pserial_read(uint32_t *out_nbyte)
 	/* Two step parsing TLV is moved in serial_drv_read */
 	return serial_drv_read(serial_handle, out_nbyte);
 }
+
+void transport_pserial_read_done(uint8_t *buf)
+{
+	serial_drv_read_done(serial_handle, buf);
+}
@@ -3,10 +3,13 @@
 #include <linux/module.h>
 #include <linux/fs.h>
 #include <linux/uaccess.h>
+#include <linux/seq_file.h>
+#include <linux/percpu.h>
 
 #define DEBUGFS_DIR_NAME "esp32"
 #define LOG_LEVEL "log_level"
 #define VERSION "version"
+#define HIST_DIR_NAME "hist"
 
 #define DEBUGFS_TODO 0
 
@@ -23,6 +26,7 @@ struct esp32_debugfs {
 	struct dentry *debugfs_dir;
 	struct dentry *log_level_file; /* log level for host dmesg */
 	struct dentry *version;
+	struct dentry *hist_dir;
 #if DEBUGFS_TODO
 	struct dentry *host_log_level_file; /* log level for host logs in debugfs logger */
 	struct dentry *host_log_file; /* debugfs host logger */
@@ -190,6 +194,88 @@ static const struct file_operations debugfs_fw_log_output_ops = {
 };
 #endif
 
+/* Histograms use log2 buckets: bucket 0 counts value 0, bucket n counts
+ * [2^(n-1), 2^n) and the last one everything above. Each CPU updates
+ * its own buckets, these are summed up only when read */
+#define ESP_HIST_BUCKETS 24
+
+struct esp_hist_cpu {
+	u64 bucket[ESP_HIST_MAX][ESP_HIST_BUCKETS];
+};
+
+static DEFINE_PER_CPU(struct esp_hist_cpu, esp_hist);
+
+static const char * const esp_hist_names[ESP_HIST_MAX] = {
+	[ESP_HIST_XFER_US]        = "xfer_us",
+	[ESP_HIST_TX_SIZE]        = "tx_size",
+	[ESP_HIST_RX_SIZE]        = "rx_size",
+	[ESP_HIST_TX_WAIT_US]     = "tx_wait_us",
+	[ESP_HIST_IRQ_TO_READ_US] = "irq_to_read_us",
+	[ESP_HIST_TX_Q_DEPTH]     = "tx_q_depth",
+};
+
+void esp_hist_add(enum esp_hist_id id, u64 val)
+{
+	u32 idx = val ? min_t(u32, fls64(val), ESP_HIST_BUCKETS - 1) : 0;
+
+	this_cpu_inc(esp_hist.bucket[id][idx]);
+}
+
+static int hist_show(struct seq_file *s, void *data)
+{
+	enum esp_hist_id id = (uintptr_t) s->private;
+	u64 count = 0, total = 0;
+	int cpu = 0;
+	u32 idx = 0;
+
+	for (idx = 0; idx < ESP_HIST_BUCKETS; idx++) {
+		count = 0;
+		for_each_possible_cpu(cpu)
+			count += per_cpu(esp_hist, cpu).bucket[id][idx];
+
+		total += count;
+
+		if (!idx)
+			seq_printf(s, "%10u             : %llu\n", 0, count);
+		else if (idx < ESP_HIST_BUCKETS - 1)
+			seq_printf(s, "%10llu - %-10llu: %llu\n",
+					1ULL << (idx - 1), (1ULL << idx) - 1, count);
+		else
+			seq_printf(s, "%10llu -           : %llu\n",
+					1ULL << (idx - 1), count);
+	}
+
+	seq_printf(s, "samples: %llu\n", total);
+
+	return 0;
+}
+
+static int hist_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, hist_show, inode->i_private);
+}
+
+// Any write resets the histogram
+static ssize_t hist_write(struct file *file, const char __user *buf, size_t count, loff_t *ppos)
+{
+	enum esp_hist_id id = (uintptr_t) file_inode(file)->i_private;
+	int cpu = 0;
+
+	for_each_possible_cpu(cpu)
+		memset(per_cpu(esp_hist, cpu).bucket[id], 0,
+				sizeof(per_cpu(esp_hist, cpu).bucket[id]));
+
+	return count;
+}
+
+static const struct file_operations hist_ops = {
+	.open = hist_open,
+	.read = seq_read,
+	.write = hist_write,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
 // File operations for the debugfs file
 static const struct file_operations log_level_ops = {
 	.read = log_level_read,
@@ -205,6 +291,7 @@ int debugfs_init(void)
 {
 	struct esp32_debugfs *debugfs = &drv_debugfs;
 	int ret = -ENODEV;
+	int id = 0;
 	// Create debugfs directory
 	debugfs->debugfs_dir = debugfs_create_dir(DEBUGFS_DIR_NAME, NULL);
 
@@ -226,6 +313,20 @@ int debugfs_init(void)
 		goto cleanup;
 	}
 
+	debugfs->hist_dir = debugfs_create_dir(HIST_DIR_NAME, debugfs->debugfs_dir);
+	if (!debugfs->hist_dir) {
+		esp_err("Failed to create debugfs %s directory\n", HIST_DIR_NAME);
+		goto cleanup;
+	}
+
+	for (id = 0; id < ESP_HIST_MAX; id++) {
+		if (!debugfs_create_file(esp_hist_names[id], 0644, debugfs->hist_dir,
+					(void *)(uintptr_t) id, &hist_ops)) {
+			esp_err("Failed to create debugfs %s file\n", esp_hist_names[id]);
+			goto cleanup;
+		}
+	}
+
 #if DEBUGFS_TODO
 	debugfs->host_log_level_file = debugfs_create_file(DEBUGFS_LOG_LEVEL, 0644, debugfs_dir, NULL, &debugfs_log_level_ops);
 	if (!debugfs->debugfs_log_level_file) {
@@ -280,6 +381,10 @@ void debugfs_exit(void)
 		debugfs_remove(debugfs->version);
 		debugfs->version = NULL;
 	}
+	if (debugfs->hist_dir) {
+		debugfs_remove_recursive(debugfs->hist_dir);
+		debugfs->hist_dir = NULL;
+	}
 	if (debugfs->debugfs_dir) {
 		debugfs_remove(debugfs->debugfs_dir);
 		debugfs->debugfs_dir = NULL;
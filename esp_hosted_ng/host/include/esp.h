@@ -177,5 +177,7 @@ struct esp_wifi_device {
 
 struct esp_skb_cb {
 	struct esp_wifi_device      *priv;
+	/* When queued for transmission by transport */
+	ktime_t                     enq_time;
 };
 #endif
@@ -8,6 +8,7 @@
 
 #include <linux/kernel.h>
 #include <linux/types.h>
+#include <linux/ktime.h>
 
 
 #ifndef NUMBER_1M
@@ -36,6 +37,25 @@ void esp_hex_dump_verbose(const char *prefix_str, const void *buf, size_t len);
 int debugfs_init(void);
 void debugfs_exit(void);
 
+/* Datapath histograms in debugfs, see esp_debugfs.c */
+enum esp_hist_id {
+	ESP_HIST_XFER_US,	/* SPI/SDIO transaction duration */
+	ESP_HIST_TX_SIZE,	/* Frame size */
+	ESP_HIST_RX_SIZE,
+	ESP_HIST_TX_WAIT_US,	/* Host enqueue to bus transmission */
+	ESP_HIST_IRQ_TO_READ_US,	/* Interrupt to start of read */
+	ESP_HIST_TX_Q_DEPTH,	/* TX queue occupancy, per transaction */
+	ESP_HIST_MAX,
+};
+
+void esp_hist_add(enum esp_hist_id id, u64 val);
+
+static inline void esp_hist_add_us_since(enum esp_hist_id id, ktime_t start)
+{
+	if (ktime_to_ns(start))
+		esp_hist_add(id, ktime_us_delta(ktime_get(), start));
+}
+
 #define esp_err(format, ...) esp_logger(ESP_ERR, __func__, format, ##__VA_ARGS__)
 #define esp_warn(format, ...) esp_logger(ESP_WARNING, __func__, format, ##__VA_ARGS__)
 #define esp_info(format, ...) esp_logger(ESP_INFO, __func__, format, ##__VA_ARGS__)
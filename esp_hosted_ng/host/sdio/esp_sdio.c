@@ -40,6 +40,8 @@ static atomic_t queue_items[MAX_PRIORITY_QUEUES];
 struct task_struct *monitor_thread;
 #endif
 struct task_struct *tx_thread;
+/* Kicked on new TX packet and on host resume */
+static DECLARE_WAIT_QUEUE_HEAD(tx_wait);
 
 volatile u8 host_sleep;
 
@@ -63,6 +65,9 @@ static void esp_process_interrupt(struct esp_sdio_context *context, u32 int_stat
 	}
 
 	if (int_status & ESP_SLAVE_RX_NEW_PACKET_INT) {
+		if (!ktime_to_ns(context->irq_time))
+			context->irq_time = ktime_get();
+
 		esp_process_new_packet_intr(context->adapter);
 	}
 }
@@ -375,6 +380,7 @@ static struct sk_buff *read_packet(struct esp_adapter *adapter)
 	struct sk_buff *skb;
 	u8 *pos;
 	struct esp_sdio_context *context;
+	ktime_t start_time;
 
 	if (!adapter || !adapter->if_context) {
 		esp_err("INVALID args\n");
@@ -388,6 +394,11 @@ static struct sk_buff *read_packet(struct esp_adapter *adapter)
 		return NULL;
 	}
 
+	if (ktime_to_ns(context->irq_time)) {
+		esp_hist_add_us_since(ESP_HIST_IRQ_TO_READ_US, context->irq_time);
+		context->irq_time = 0;
+	}
+
 	sdio_claim_host(context->func);
 
 	data_left = len_to_read = len_from_slave = num_blocks = 0;
@@ -418,6 +429,7 @@ static struct sk_buff *read_packet(struct esp_adapter *adapter)
 	pos = skb->data;
 
 	data_left = len_from_slave;
+	start_time = ktime_get();
 
 	do {
 		num_blocks = data_left/ESP_BLOCK_SIZE;
@@ -459,6 +471,9 @@ static struct sk_buff *read_packet(struct esp_adapter *adapter)
 
 	sdio_release_host(context->func);
 
+	esp_hist_add_us_since(ESP_HIST_XFER_US, start_time);
+	esp_hist_add(ESP_HIST_RX_SIZE, len_from_slave);
+
 	return skb;
 }
 
@@ -508,8 +523,11 @@ static int write_packet(struct esp_adapter *adapter, struct sk_buff *skb)
 		prio = PRIO_Q_LOW;
 
 	atomic_inc(&queue_items[prio]);
+	((struct esp_skb_cb *)skb->cb)->enq_time = ktime_get();
 	skb_queue_tail(&(sdio_context.tx_q[prio]), skb);
 
+	wake_up_interruptible(&tx_wait);
+
 	return 0;
 }
 
@@ -552,6 +570,13 @@ static int is_sdio_write_buffer_available(u32 buf_needed)
 	return BUFFER_AVAILABLE;
 }
 
+static inline int is_tx_queued(void)
+{
+	return atomic_read(&queue_items[PRIO_Q_HIGH]) > 0 ||
+		atomic_read(&queue_items[PRIO_Q_MID]) > 0 ||
+		atomic_read(&queue_items[PRIO_Q_LOW]) > 0;
+}
+
 static int tx_process(void *data)
 {
 	int ret = 0;
@@ -563,21 +588,27 @@ static int tx_process(void *data)
 	struct esp_adapter *adapter = (struct esp_adapter *) data;
 	struct esp_sdio_context *context = NULL;
 	struct esp_skb_cb *cb = NULL;
+	ktime_t start_time;
 	u8 retry;
 
 	context = adapter->if_context;
 
 	while (!kthread_should_stop()) {
 
-		if (atomic_read(&context->adapter->state) < ESP_CONTEXT_READY) {
-			msleep(10);
-			esp_err("not ready");
+		/* State is changed outside of transport, so check again
+		 * after a while even without any kick */
+		if ((atomic_read(&context->adapter->state) < ESP_CONTEXT_READY) || host_sleep) {
+			wait_event_interruptible_timeout(tx_wait, kthread_should_stop() ||
+					((atomic_read(&context->adapter->state) >= ESP_CONTEXT_READY) &&
+					 !host_sleep), msecs_to_jiffies(100));
 			continue;
 		}
 
-		if (host_sleep) {
-			/* TODO: Use wait_event_interruptible_timeout */
-			msleep(100);
+		/* Sleep till there is something to send. Queued packets
+		 * are then sent back to back, till queues are empty */
+		if (!is_tx_queued()) {
+			wait_event_interruptible(tx_wait,
+					kthread_should_stop() || is_tx_queued());
 			continue;
 		}
 
@@ -600,21 +631,20 @@ static int tx_process(void *data)
 			}
 			atomic_dec(&queue_items[PRIO_Q_LOW]);
 		} else {
-			/* esp_verbose("not ready high=%d mid=%d low=%d\n",
-					atomic_read(&queue_items[PRIO_Q_HIGH]),
-					atomic_read(&queue_items[PRIO_Q_MID]),
-					atomic_read(&queue_items[PRIO_Q_LOW])); */
-			msleep(1);
 			continue;
 		}
 
+		cb = (struct esp_skb_cb *)tx_skb->cb;
+		esp_hist_add_us_since(ESP_HIST_TX_WAIT_US, cb->enq_time);
+		esp_hist_add(ESP_HIST_TX_SIZE, tx_skb->len);
+		esp_hist_add(ESP_HIST_TX_Q_DEPTH, atomic_read(&tx_pending));
+
 		if (atomic_read(&tx_pending))
 			atomic_dec(&tx_pending);
 
 		retry = MAX_WRITE_RETRIES;
 
 		/* resume network tx queue if bearable load */
-		cb = (struct esp_skb_cb *)tx_skb->cb;
 		if (cb && cb->priv && atomic_read(&tx_pending) < TX_RESUME_THRESHOLD) {
 			esp_tx_resume(cb->priv);
 #if TEST_RAW_TP
@@ -641,6 +671,7 @@ static int tx_process(void *data)
 		pad = ESP_BLOCK_SIZE - (data_left % ESP_BLOCK_SIZE);
 		data_left += pad;
 
+		start_time = ktime_get();
 
 		do {
 			block_cnt = data_left / ESP_BLOCK_SIZE;
@@ -657,6 +688,8 @@ static int tx_process(void *data)
 			pos += len_to_send;
 		} while (data_left);
 
+		esp_hist_add_us_since(ESP_HIST_XFER_US, start_time);
+
 		if (ret) {
 			/* drop the packet */
 			dev_kfree_skb(tx_skb);
@@ -905,6 +938,7 @@ static int esp_resume(struct device *dev)
 	msleep(100);
 	generate_slave_intr(context, BIT(ESP_POWER_SAVE_OFF));
 	host_sleep = 0;
+	wake_up_interruptible(&tx_wait);
 	return 0;
 }
 
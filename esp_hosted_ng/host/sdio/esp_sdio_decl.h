@@ -80,6 +80,8 @@ struct esp_sdio_context {
 	u32                    rx_byte_count;
 	u32                    tx_buffer_count;
 	u32			sdio_clk_mhz;
+	/* New packet interrupt, not yet followed by read */
+	ktime_t                irq_time;
 };
 
 #endif
@@ -59,6 +59,9 @@ static void close_data_path(void)
 static irqreturn_t spi_data_ready_interrupt_handler(int irq, void *dev)
 {
 	/* ESP peripheral has queued buffer for transmission */
+	if (!ktime_to_ns(spi_context.irq_time))
+		spi_context.irq_time = ktime_get();
+
 	if (spi_context.spi_workqueue)
 		queue_work(spi_context.spi_workqueue, &spi_context.spi_work);
 
@@ -144,6 +147,8 @@ static int write_packet(struct esp_adapter *adapter, struct sk_buff *skb)
 	}
 
 	/* Enqueue SKB in tx_q */
+	cb->enq_time = ktime_get();
+
 	if (payload_header->if_type == ESP_INTERNAL_IF) {
 		skb_queue_tail(&spi_context.tx_q[PRIO_Q_HIGH], skb);
 	} else if (payload_header->if_type == ESP_HCI_IF) {
@@ -248,6 +253,7 @@ static int process_rx_buf(struct sk_buff *skb)
 	/* Trim SKB to actual size */
 	skb_trim(skb, len);
 
+	esp_hist_add(ESP_HIST_RX_SIZE, len);
 
 	if (!data_path) {
 		esp_verbose("%u datapath closed\n", __LINE__);
@@ -276,6 +282,9 @@ static void esp_spi_work(struct work_struct *work)
 	u8 *rx_buf = NULL;
 	int ret = 0;
 	volatile int trans_ready, rx_pending;
+	ktime_t start_time;
+	u8 prio_q_idx = 0;
+	u32 q_depth = 0;
 
 	mutex_lock(&spi_lock);
 
@@ -290,11 +299,14 @@ static void esp_spi_work(struct work_struct *work)
 			if (!tx_skb)
 				tx_skb = skb_dequeue(&spi_context.tx_q[PRIO_Q_LOW]);
 			if (tx_skb) {
+				cb = (struct esp_skb_cb *)tx_skb->cb;
+				esp_hist_add_us_since(ESP_HIST_TX_WAIT_US, cb->enq_time);
+				esp_hist_add(ESP_HIST_TX_SIZE, tx_skb->len);
+
 				if (atomic_read(&tx_pending))
 					atomic_dec(&tx_pending);
 
 				/* resume network tx queue if bearable load */
-				cb = (struct esp_skb_cb *)tx_skb->cb;
 				if (cb && cb->priv && atomic_read(&tx_pending) < TX_RESUME_THRESHOLD) {
 					esp_tx_resume(cb->priv);
 #if TEST_RAW_TP
@@ -307,6 +319,15 @@ static void esp_spi_work(struct work_struct *work)
 		}
 
 		if (rx_pending || tx_skb) {
+			if (ktime_to_ns(spi_context.irq_time)) {
+				esp_hist_add_us_since(ESP_HIST_IRQ_TO_READ_US, spi_context.irq_time);
+				spi_context.irq_time = 0;
+			}
+
+			for (prio_q_idx = 0; prio_q_idx < MAX_PRIORITY_QUEUES; prio_q_idx++)
+				q_depth += skb_queue_len(&spi_context.tx_q[prio_q_idx]);
+			esp_hist_add(ESP_HIST_TX_Q_DEPTH, q_depth);
+
 			memset(&trans, 0, sizeof(trans));
 			trans.speed_hz = spi_context.spi_clk_mhz * NUMBER_1M;
 
@@ -345,7 +366,9 @@ static void esp_spi_work(struct work_struct *work)
 			}
 #endif
 
+			start_time = ktime_get();
 			ret = spi_sync_transfer(spi_context.esp_spi_dev, &trans, 1);
+			esp_hist_add_us_since(ESP_HIST_XFER_US, start_time);
 			if (ret) {
 				esp_err("SPI Transaction failed: %d", ret);
 				dev_kfree_skb(rx_skb);
@@ -37,6 +37,8 @@ struct esp_spi_context {
 	uint8_t                     spi_clk_mhz;
 	uint8_t                     reserved[2];
 	unsigned long               spi_flags;
+	/* Data ready interrupt, not yet followed by transaction */
+	ktime_t                     irq_time;
 };
 
 enum {